@@ -0,0 +1,197 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <aio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "cpupdate.h"
+#include "scan.h"
+#include "aload.h"
+
+// the files of the tree, in scan order
+struct aload_list {
+	char	  **paths;
+	int			n,
+				max;
+};
+
+// a file being read
+struct aload_slot {
+	struct aiocb
+				cb;
+	int			file;			// index into the list, -1 if unused
+	void	   *image;
+	size_t		size;
+	int			pending;		// bool: asynchronous read submitted
+	int			err;			// bool: reading failed
+};
+
+static int aload_collect( int dfd, const char *name, const char *path, void *arg);
+static void aload_start( struct aload_slot *s, int file, const char *path, int *useaio);
+static void aload_finish( struct aload_slot *s);
+
+
+// scan_tree() callback for aload_tree: lists the file
+static int
+aload_collect( int dfd, const char *name, const char *path, void *arg)
+{
+	struct aload_list *list = arg;
+
+	if (list->n == list->max) {
+		int max = list->max ? 2 * list->max : 256;
+		char **p;
+
+		if ((p = reallocarray( list->paths, max, sizeof( *p))) == NULL) {
+			INFO( 0, "Could not allocate file list!\n");
+			return 1;
+		}
+		list->paths = p;
+		list->max = max;
+	}
+	if ((list->paths[ list->n] = strdup( path)) == NULL) {
+		INFO( 0, "Could not allocate file list!\n");
+		return 1;
+	}
+	++list->n;
+	return 0;
+}
+
+
+/* opens the file and submits the read of its content. open and fstat stay synchronous,
+ * as there are no asynchronous variants, but overlap with the reads in flight
+ */
+static void
+aload_start( struct aload_slot *s, int file, const char *path, int *useaio)
+{
+	struct stat st;
+	int		fd;
+
+	memset( s, 0, sizeof( *s));
+	s->file = file;
+	if ((fd = open( path, O_RDONLY | O_CLOEXEC)) < 0 || fstat( fd, &st) < 0 ||
+			(s->image = malloc( st.st_size ? st.st_size : 1)) == NULL) {
+		s->err = 1;
+		if (fd >= 0)
+			close( fd);
+		return;
+	}
+	s->size = st.st_size;
+	if (s->size == 0) {
+		close( fd);
+		return;
+	}
+	s->cb.aio_fildes = fd;
+	s->cb.aio_buf	 = s->image;
+	s->cb.aio_nbytes = s->size;
+	s->cb.aio_offset = 0;
+	if (*useaio) {
+		if (aio_read( &s->cb) == 0) {
+			s->pending = 1;
+			return;
+		}
+		INFO( 11, "Asynchronous reads not available, reading files synchronously\n");
+		*useaio = 0;
+	}
+	if (pread( fd, s->image, s->size, 0) != (ssize_t) s->size)
+		s->err = 1;
+	close( fd);
+}
+
+
+// waits for the read of s to complete
+static void
+aload_finish( struct aload_slot *s)
+{
+	const struct aiocb *list[ 1] = { &s->cb };
+
+	if (!s->pending)
+		return;
+	while (aio_error( &s->cb) == EINPROGRESS)
+		aio_suspend( list, 1, NULL);
+	if (aio_return( &s->cb) != (ssize_t) s->size)
+		s->err = 1;
+	close( s->cb.aio_fildes);
+	s->pending = 0;
+}
+
+
+/* calls cb for every file of the tree at root matching pattern, as scan_tree() does, with
+ * the file's content set in params. if a file could not be read, no content is set, so
+ * the loader tries itself and reports the error. returns the first nonzero cb return
+ */
+int
+aload_tree( struct cpupdate_params *params, const char *root, const char *pattern, scan_cb cb, void *arg)
+{
+	struct aload_list list;
+	struct aload_slot slots[ ALOAD_DEPTH];
+	int		useaio = 1, i, r;
+
+	memset( &list, 0, sizeof( list));
+	r = scan_tree( root, pattern, aload_collect, &list);
+	// slot i % ALOAD_DEPTH holds file i, files i to i + ALOAD_DEPTH - 1 are read ahead
+	for (i = 0; i < ALOAD_DEPTH; ++i)
+		slots[ i].file = -1;
+	for (i = 0; !r && i < list.n && i < ALOAD_DEPTH; ++i)
+		aload_start( &slots[ i], i, list.paths[ i], &useaio);
+	for (i = 0; !r && i < list.n; ++i) {
+		struct aload_slot *s = &slots[ i % ALOAD_DEPTH];
+
+		aload_finish( s);
+		if (s->err) {
+			free( s->image);
+		} else {
+			params->fileimage = s->image;
+			params->fileimagesize = s->size;
+		}
+		r = cb( AT_FDCWD, list.paths[ i], list.paths[ i], arg);
+		// not taken over if the callback did not load the file
+		free( params->fileimage);
+		params->fileimage = NULL;
+		s->file = -1;
+		if (!r && i + ALOAD_DEPTH < list.n)
+			aload_start( s, i + ALOAD_DEPTH, list.paths[ i + ALOAD_DEPTH], &useaio);
+	}
+	// stopped early: the buffers of the reads in flight may only be freed when they are done
+	for (i = 0; i < ALOAD_DEPTH; ++i)
+		if (slots[ i].file >= 0) {
+			aload_finish( &slots[ i]);
+			free( slots[ i].image);
+		}
+	for (i = 0; i < list.n; ++i)
+		free( list.paths[ i]);
+	free( list.paths);
+	return r;
+}
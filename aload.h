@@ -0,0 +1,41 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ALOAD_H
+#define	ALOAD_H
+
+/* Batched loading of repository files.
+ * The tree is listed first, then up to ALOAD_DEPTH files are read ahead with POSIX
+ * asynchronous reads while the earlier ones are validated, so a cold cache scan keeps
+ * the device busy instead of waiting for one read after the other. Files are handed
+ * to the scan callback in listing order, their content set as params->fileimage,
+ * which the vendor loader takes over instead of reading the file again.
+ * Where asynchronous reads are not available, the files are read synchronously.
+ */
+
+#define ALOAD_DEPTH		32		// files read ahead at most
+
+int aload_tree( struct cpupdate_params *params, const char *root, const char *pattern, scan_cb cb, void *arg);
+
+#endif /* !ALOAD_H */
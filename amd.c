@@ -0,0 +1,787 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/ioccom.h>
+#include <sys/cpuctl.h>
+
+#include <machine/cpufunc.h>
+#include <machine/specialreg.h>
+
+#include "cpupdate.h"
+#include "amd.h"
+#include "coretab.h"
+#include "devio.h"
+#include "report.h"
+
+int amd_probe( struct cpupdate_params *);
+int amd_loadcheckmicrocode( struct cpupdate_params *);
+int amd_printcpustats( struct cpupdate_params *);
+int amd_printmicrocodestats( struct cpupdate_params *);
+int amd_update( struct cpupdate_params *);
+int amd_freeucodeinfo( struct cpupdate_params *params);
+int amd_unsupported( struct cpupdate_params *params);
+const char *amd_getvendorname( struct cpupdate_params *);
+int amd_getcores( struct cpupdate_params *params, struct cpup_coreinfo *cores, int max);
+int amd_getblobs( struct cpupdate_params *params, struct cpup_blobinfo *blobs, int max);
+int amd_refreshrevs( struct cpupdate_params *params);
+
+// the repository tools work on Intel's formats only
+struct vendor_funcs amd_funcs = {
+	(hnd_f)	&amd_probe,
+	(hnd_f)	&amd_printcpustats,
+	(hnd_f)	&amd_loadcheckmicrocode,
+	(hnd_f)	&amd_printmicrocodestats,
+	(hnd_f)	&amd_update,
+	(hnd_f)	&amd_freeucodeinfo,
+	(hnd_f)	&amd_unsupported,		// extractformat
+	(hnd_f)	&amd_unsupported,		// compactformat
+	(hnd_f)	&amd_unsupported,		// pack
+	(hnd_n)	&amd_getvendorname,
+	(hnd_c)	&amd_getcores,
+	(hnd_b)	&amd_getblobs,
+	(hnd_f)	&amd_refreshrevs,
+	(hnd_f)	&amd_unsupported,		// prune
+	(hnd_f)	&amd_unsupported,		// earlycpio
+	(hnd_f)	&amd_unsupported,		// sync
+	(hnd_f)	&amd_unsupported,		// scanimage
+	(hnd_f)	&amd_unsupported		// verifytree
+};
+
+static uint32_t amd_getFamily( uint32_t sig);
+static uint32_t amd_getModel( uint32_t sig);
+static uint32_t amd_getDate( uint32_t datacode);
+static int amd_getCoreInfo( struct amd_ProcessorInfo *coreinfo, int core);
+static int amd_filename( uint32_t family, char *buf, size_t size);
+static int amd_readfile( struct amd_file *file, int dirfd, const char *relpath);
+static int amd_grow( void **array, int n, int *max, size_t size);
+static int amd_parsefile( struct amd_ucinfo *ucinfo, int f);
+static uint32_t amd_hash( uint32_t key, uint32_t mask);
+static int amd_index( struct amd_ucinfo *ucinfo);
+static int amd_findequiv( struct amd_ucinfo *ucinfo, uint32_t signature);
+static const struct amd_patchref *amd_findpatch( struct amd_ucinfo *ucinfo, uint32_t signature);
+static uint32_t amd_patchsig( struct amd_ucinfo *ucinfo, uint16_t equiv, int *count);
+
+
+// family: base family, plus the extended family for base family 0xf
+static uint32_t
+amd_getFamily( uint32_t sig)
+{
+	uint32_t family = (sig >> 8) & 0xf;
+
+	return (family == 0xf) ? family + ((sig >> 20) & 0xff) : family;
+}
+
+
+// model: base model, with the extended model as high nibble for base family 0xf
+static uint32_t
+amd_getModel( uint32_t sig)
+{
+	uint32_t model = (sig >> 4) & 0xf;
+
+	return (((sig >> 8) & 0xf) == 0xf) ? model | ((sig >> 12) & 0xf0) : model;
+}
+
+
+// the patch date yyyymmdd as in the Intel headers, mmddyyyy
+static uint32_t
+amd_getDate( uint32_t datacode)
+{
+	return (datacode << 16) | (datacode >> 16);
+}
+
+
+static int
+amd_getCoreInfo( struct amd_ProcessorInfo *coreinfo, int core)
+{
+	int					r = 0;
+	int					cpufd;
+	cpuctl_msr_args_t   msrargs;
+	cpuctl_cpuid_args_t idargs = {
+		.level  = 1,  /* Signature. */
+	};
+
+	cpufd = devio_open( core, O_RDWR);
+	if (cpufd < 0) {
+		INFO( 0, "could not open /dev/cpuctl%d for writing\n", core);
+		return 1;
+	}
+	if (devio_ioctl( cpufd, CPUCTL_CPUID, &idargs) < 0) {
+		INFO( 0, "/dev/cpuctl%d CPUID failed\n", core);
+		r = 1;
+	} else
+		coreinfo->signature = idargs.data[ 0];
+	if (!r) {
+		// MSR_BIOS_SIGN is the patch level MSR on AMD, the level is in the low dword
+		msrargs.msr = MSR_BIOS_SIGN;
+		if (devio_ioctl( cpufd, CPUCTL_RDMSR, &msrargs) < 0) {
+			INFO( 0, "/dev/cpuctl%d patch level read failed\n", core);
+			r = 1;
+		} else {
+			coreinfo->patchlevel = (uint32_t) msrargs.data;
+			INFO( 12, "/dev/cpuctl%d identification successful!\n", core);
+		}
+	}
+	close( cpufd);
+	return r;
+}
+
+
+int
+amd_refreshrevs( struct cpupdate_params *params)
+{
+	struct amd_ProcessorInfo *coreinfo = (struct amd_ProcessorInfo *) params->coreinfop;
+	cpuctl_msr_args_t msrargs;
+	int core, r = 0;
+
+	assert( coreinfo != NULL);
+	if (cpu_opencorefds( params))
+		return 1;
+	for (core = 0; !r && core < params->numcores; ++core, ++coreinfo) {
+		msrargs.msr = MSR_BIOS_SIGN;
+		if (devio_ioctl( params->corefds[ core], CPUCTL_RDMSR, &msrargs) < 0) {
+			INFO( 0, "Reading the microcode revision of core %d failed\n", core);
+			r = 1;
+		} else
+			coreinfo->patchlevel = (uint32_t) msrargs.data;
+	}
+	return r;
+}
+
+
+int
+amd_probe( struct cpupdate_params *params)
+{
+	char vendor[ MAXVENDORNAMELEN];
+	cpuctl_cpuid_args_t idargs = {
+		.level  = 0,
+	};
+	int cpufd, r = 0;
+
+	cpufd = devio_open( 0, O_RDONLY);
+	if (cpufd < 0) {
+		INFO( 0, "error opening /dev/cpuctl0 for reading\n");
+		r = -1;
+	}
+	if (!r && devio_ioctl( cpufd, CPUCTL_CPUID, &idargs) < 0) {
+		INFO( 0, "ioctl( CPUCTL_CPUID) failed\n");
+		r = -1;
+	}
+	if (!r) {
+		((uint32_t *)vendor)[0] = idargs.data[1];
+		((uint32_t *)vendor)[1] = idargs.data[3];
+		((uint32_t *)vendor)[2] = idargs.data[2];
+		vendor[12] = '\0';
+		r = (strncmp( vendor, AMD_VENDOR_ID, sizeof( AMD_VENDOR_ID))) ? 1 : 0;
+	}
+	if (cpufd >= 0)
+		close( cpufd);
+	if (!r && (params->coreinfop = calloc( params->numcores, sizeof( struct amd_ProcessorInfo))) == NULL) {
+		INFO( 0, "Failed to allocate memory for coreinfos structures\n");
+		r = 1;
+	}
+	for (int core = 0; !r && core < params->numcores; ++core)
+		r = amd_getCoreInfo( (struct amd_ProcessorInfo *) params->coreinfop + core, core);
+	return r;
+}
+
+
+int
+amd_printcpustats( struct cpupdate_params *params)
+{
+	struct amd_ProcessorInfo *coreinfo = (struct amd_ProcessorInfo *) params->coreinfop, *info;
+	struct coretab ct;
+	char	cpulist[ CORETAB_LISTMAX];
+
+	if (coretab_init( &ct, params->numcores))
+		return 1;
+	for (int core = 0; core < params->numcores; ++core)
+		coretab_set( &ct, core, coreinfo[ core].signature, 0, coreinfo[ core].patchlevel);
+	if (coretab_group( &ct) < 0) {
+		coretab_free( &ct);
+		return 1;
+	}
+	for (int g = 0; g < ct.ngroups; ++g) {
+		coretab_cpulist( &ct, g, cpulist, sizeof( cpulist));
+		info = &coreinfo[ ct.gfirst[ g]];
+		if (params->report != NULL) {
+			struct report_rec rec = { .type = REPORT_CORES };
+
+			rec.signature = info->signature;
+			rec.revision = info->patchlevel;
+			rec.count = ct.gcount[ g];
+			report_row( params->report, &rec, cpulist);
+		} else
+			INFO( 10, "Cores %s: CPUID: %x  Fam %02x  Mod %02x  Step %02x  uCode %08x\n",
+					cpulist, info->signature, amd_getFamily( info->signature),
+					amd_getModel( info->signature), info->signature & 0xf, info->patchlevel);
+	}
+	coretab_free( &ct);
+	return 0;
+}
+
+
+// the container file name of family
+static int
+amd_filename( uint32_t family, char *buf, size_t size)
+{
+	if (family < AMD_FAMILY_SPLIT)
+		return snprintf( buf, size, "microcode_amd.bin");
+	return snprintf( buf, size, "microcode_amd_fam%02xh.bin", family);
+}
+
+
+/* maps the file relpath, relative to directory descriptor dirfd (or AT_FDCWD).
+ * file->path is used for messages
+ */
+static int
+amd_readfile( struct amd_file *file, int dirfd, const char *relpath)
+{
+	struct stat	st;
+	int			fd, r = 0;
+
+	if ((fd = openat( dirfd, relpath, O_RDONLY | O_CLOEXEC)) < 0) {
+		INFO( 12, "Failed to open %s file\n", file->path);
+		return 1;
+	}
+	if (fstat( fd, &st) < 0) {
+		INFO( 0, "File %s fstat failed\n", file->path);
+		r = 1;
+	} else if (st.st_size == 0) {
+		INFO( 0, "File %s is empty\n", file->path);
+		r = 1;
+	} else if ((file->image = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		INFO( 0, "Mapping file %s failed: %s\n", file->path, strerror( errno));
+		file->image = NULL;
+		r = 1;
+	} else {
+		file->size = st.st_size;
+		file->mapped = 1;
+	}
+	close( fd);
+	return r;
+}
+
+
+// makes room for element n of the array, doubling it if full
+static int
+amd_grow( void **array, int n, int *max, size_t size)
+{
+	void *p;
+	int m;
+
+	if (n < *max)
+		return 0;
+	m = *max ? 2 * *max : 64;
+	if ((p = reallocarray( *array, m, size)) == NULL) {
+		INFO( 0, "Could not allocate microcode index!\n");
+		return 1;
+	}
+	*array = p;
+	*max = m;
+	return 0;
+}
+
+
+/* validates the containers of the file f and collects their equivalence entries
+ * and patches. the entries point into the file image
+ */
+static int
+amd_parsefile( struct amd_ucinfo *ucinfo, int f)
+{
+	struct amd_file *file = &ucinfo->files[ f];
+	const uint8_t *p = file->image, *end = p + file->size;
+	const struct amd_section_hdr *sec;
+	const struct amd_equiv_entry *entry;
+	struct amd_patchref *ref;
+	int ncontainers = 0;
+
+	while (p < end) {
+		sec = (const struct amd_section_hdr *) (p + sizeof( uint32_t));
+		if (end - p < sizeof( uint32_t) + sizeof( *sec) || *(const uint32_t *) p != AMD_MAGIC) {
+			INFO( 0, "File %s: No AMD microcode container at 0x%zx\n", file->path, (size_t) (p - file->image));
+			return 1;
+		}
+		if (sec->type != AMD_SECTION_EQUIV || sec->size % sizeof( *entry) ||
+				sec->size > (size_t) (end - (const uint8_t *) (sec + 1))) {
+			INFO( 0, "File %s: Bad equivalence table at 0x%zx\n", file->path, (size_t) (p - file->image));
+			return 1;
+		}
+		entry = (const struct amd_equiv_entry *) (sec + 1);
+		// the table ends with an empty entry
+		for (uint32_t i = 0; i < sec->size / sizeof( *entry) && entry[ i].installed_cpu != 0; ++i) {
+			if (amd_grow( (void **) &ucinfo->equivs, ucinfo->nequivs, &ucinfo->maxequivs, sizeof( *ucinfo->equivs)))
+				return 1;
+			ucinfo->equivs[ ucinfo->nequivs++] = &entry[ i];
+		}
+		p = (const uint8_t *) (sec + 1) + sec->size;
+		// the patches, up to the next container
+		while (p < end && (end - p < sizeof( uint32_t) || *(const uint32_t *) p != AMD_MAGIC)) {
+			sec = (const struct amd_section_hdr *) p;
+			if (end - p < sizeof( *sec) || sec->type != AMD_SECTION_PATCH) {
+				INFO( 0, "File %s: Bad section at 0x%zx\n", file->path, (size_t) (p - file->image));
+				return 1;
+			}
+			if (sec->size < sizeof( struct amd_patch_hdr) || sec->size > AMD_MAXPATCH ||
+					sec->size > (size_t) (end - (const uint8_t *) (sec + 1))) {
+				INFO( 0, "File %s: Patch at 0x%zx has a bad size\n", file->path, (size_t) (p - file->image));
+				return 1;
+			}
+			if (amd_grow( (void **) &ucinfo->patches, ucinfo->npatches, &ucinfo->maxpatches, sizeof( *ucinfo->patches)))
+				return 1;
+			ref = &ucinfo->patches[ ucinfo->npatches++];
+			ref->hdr = (const struct amd_patch_hdr *) (sec + 1);
+			ref->size = sec->size;
+			ref->file = f;
+			ref->off = (const uint8_t *) ref->hdr - file->image;
+			p = (const uint8_t *) (sec + 1) + sec->size;
+		}
+		++ncontainers;
+	}
+	INFO( 11, "File %s: %d containers\n", file->path, ncontainers);
+	return 0;
+}
+
+
+static uint32_t
+amd_hash( uint32_t key, uint32_t mask)
+{
+	key *= 0x9e3779b1;
+	return (key ^ (key >> 16)) & mask;
+}
+
+
+/* builds the hash tables: signature to equivalence ID, and equivalence ID to the newest
+ * patch for it, so the lookup for a core takes constant time however many families the
+ * containers hold
+ */
+static int
+amd_index( struct amd_ucinfo *ucinfo)
+{
+	struct amd_equivslot *es;
+	struct amd_patchslot *ps;
+	const struct amd_patch_hdr *hdr;
+	uint32_t size = 16, h;
+
+	while (size < 2 * (uint32_t) MAX( ucinfo->nequivs, ucinfo->npatches))
+		size *= 2;
+	ucinfo->mask = size - 1;
+	if ((ucinfo->equivtab = calloc( size, sizeof( *ucinfo->equivtab))) == NULL ||
+			(ucinfo->patchtab = calloc( size, sizeof( *ucinfo->patchtab))) == NULL) {
+		INFO( 0, "Could not allocate microcode index!\n");
+		return 1;
+	}
+	for (int i = 0; i < ucinfo->nequivs; ++i) {
+		const struct amd_equiv_entry *entry = ucinfo->equivs[ i];
+
+		for (h = amd_hash( entry->installed_cpu, ucinfo->mask); ; h = (h + 1) & ucinfo->mask) {
+			es = &ucinfo->equivtab[ h];
+			if (!es->used) {
+				es->used = 1;
+				es->signature = entry->installed_cpu;
+				es->equiv = entry->equiv_cpu;
+				break;
+			}
+			if (es->signature == entry->installed_cpu) {
+				// the first container listing a signature wins
+				if (es->equiv != entry->equiv_cpu)
+					INFO( 11, "Notice: CPUID %08x has equivalence IDs %04x and %04x, using %04x\n",
+							entry->installed_cpu, es->equiv, entry->equiv_cpu, es->equiv);
+				break;
+			}
+		}
+	}
+	for (int i = 0; i < ucinfo->npatches; ++i) {
+		hdr = ucinfo->patches[ i].hdr;
+		// patches for particular chipsets are not applied
+		if (hdr->nb_dev_id || hdr->sb_dev_id)
+			continue;
+		for (h = amd_hash( hdr->processor_rev_id, ucinfo->mask); ; h = (h + 1) & ucinfo->mask) {
+			ps = &ucinfo->patchtab[ h];
+			if (!ps->used) {
+				ps->used = 1;
+				ps->equiv = hdr->processor_rev_id;
+				ps->patch = i;
+				break;
+			}
+			if (ps->equiv == hdr->processor_rev_id) {
+				if (ucinfo->patches[ ps->patch].hdr->patch_id < hdr->patch_id)
+					ps->patch = i;
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+
+// the equivalence ID of the processors with signature, -1 if there is none
+static int
+amd_findequiv( struct amd_ucinfo *ucinfo, uint32_t signature)
+{
+	struct amd_equivslot *es;
+
+	if (ucinfo->equivtab == NULL)
+		return -1;
+	for (uint32_t h = amd_hash( signature, ucinfo->mask); ; h = (h + 1) & ucinfo->mask) {
+		es = &ucinfo->equivtab[ h];
+		if (!es->used)
+			return -1;
+		if (es->signature == signature)
+			return es->equiv;
+	}
+}
+
+
+// the newest patch for the processors with signature, NULL if there is none
+static const struct amd_patchref *
+amd_findpatch( struct amd_ucinfo *ucinfo, uint32_t signature)
+{
+	struct amd_patchslot *ps;
+	int equiv;
+
+	if ((equiv = amd_findequiv( ucinfo, signature)) < 0)
+		return NULL;
+	for (uint32_t h = amd_hash( equiv, ucinfo->mask); ; h = (h + 1) & ucinfo->mask) {
+		ps = &ucinfo->patchtab[ h];
+		if (!ps->used)
+			return NULL;
+		if (ps->equiv == equiv)
+			return &ucinfo->patches[ ps->patch];
+	}
+}
+
+
+// the first signature of equivalence ID equiv, and in count the number of them. for the stats
+static uint32_t
+amd_patchsig( struct amd_ucinfo *ucinfo, uint16_t equiv, int *count)
+{
+	uint32_t sig = 0;
+
+	*count = 0;
+	for (int i = 0; i < ucinfo->nequivs; ++i)
+		if (ucinfo->equivs[ i]->equiv_cpu == equiv && (*count)++ == 0)
+			sig = ucinfo->equivs[ i]->installed_cpu;
+	return sig;
+}
+
+
+int
+amd_loadcheckmicrocode( struct cpupdate_params *params)
+{
+	struct amd_ucinfo *ucinfo;
+	struct amd_ProcessorInfo *info;
+	struct amd_file *file;
+	char	names[ AMD_MAXFILES][ 32];
+	const char *dirs[ 2] = { params->primdir, params->secdir };
+	int		nnames = 0, r = 0;
+
+	if ((ucinfo = calloc( 1, sizeof( struct amd_ucinfo))) == NULL) {
+		INFO( 0, "Could not allocate ucodeinfo struct!\n");
+		return 1;
+	}
+	params->ucodeinfop = ucinfo;
+	// if filepath has been preset, use this for all cores
+	if (strlen( params->filepath)) {
+		file = &ucinfo->files[ ucinfo->nfiles++];
+		strcpy( file->path, params->filepath);
+		if (params->fileimage != NULL) {
+			file->image = params->fileimage;
+			file->size = params->fileimagesize;
+			params->fileimage = NULL;
+		} else if (params->filename != NULL)
+			r = amd_readfile( file, params->filedirfd, params->filename);
+		else
+			r = amd_readfile( file, AT_FDCWD, file->path);
+		if (r) {
+			INFO( 0, "File %s: Does not exist or could not be read!\n", file->path);
+			return r;
+		}
+	} else {
+		if (!strlen( params->primdir) && !strlen( params->secdir)) {
+			INFO( 0, "No file and no directories specified!\n");
+			return 1;
+		}
+		// the container files of the cores' families, each looked up once
+		assert( params->coreinfop != NULL);
+		for (int core = 0; core < params->numcores && nnames < AMD_MAXFILES; ++core) {
+			int i;
+
+			info = (struct amd_ProcessorInfo *) params->coreinfop + core;
+			amd_filename( amd_getFamily( info->signature), names[ nnames], sizeof( names[ 0]));
+			for (i = 0; i < nnames && strcmp( names[ i], names[ nnames]); ++i)
+				;
+			if (i == nnames)
+				++nnames;
+		}
+		for (int n = 0; !r && n < nnames; ++n) {
+			file = &ucinfo->files[ ucinfo->nfiles];
+			for (int i = 0; i < 2; ++i) {
+				if (!strlen( dirs[ i]))
+					continue;
+				if (snprintf( file->path, sizeof( file->path), "%s/%s", dirs[ i], names[ n]) >= sizeof( file->path)) {
+					INFO( 0, "filename buffer for %s too short\n", file->path);
+					r = 1;
+					break;
+				}
+				if (amd_readfile( file, AT_FDCWD, file->path) == 0) {
+					++ucinfo->nfiles;
+					break;
+				}
+			}
+			if (file->image == NULL)
+				INFO( 0, "No microcode file %s found\n", names[ n]);
+		}
+		if (!r && ucinfo->nfiles == 0)
+			r = 1;
+	}
+	strcpy( ucinfo->path, ucinfo->files[ 0].path);
+	for (int f = 0; !r && f < ucinfo->nfiles; ++f) {
+		if ((r = amd_parsefile( ucinfo, f)))
+			INFO( 0, "File %s: Container seems to be inconsistent!\n", ucinfo->files[ f].path);
+		else
+			INFO( 11, "File %s has been read.\n", ucinfo->files[ f].path);
+	}
+	if (!r)
+		r = amd_index( ucinfo);
+	return r;
+}
+
+
+int
+amd_printmicrocodestats( struct cpupdate_params *params)
+{
+	struct amd_ucinfo *ucinfo = (struct amd_ucinfo *) params->ucodeinfop;
+	const struct amd_patchref *ref;
+	const struct amd_patch_hdr *hdr;
+	struct report_rec rec = { .type = REPORT_BLOB };
+	uint32_t date;
+	int count;
+
+	if (ucinfo == NULL)
+		return 1;
+	if (params->report == NULL)
+		INFO( 10, "%d equivalence entries, %d patches\n", ucinfo->nequivs, ucinfo->npatches);
+	for (int i = 0; i < ucinfo->npatches; ++i) {
+		ref = &ucinfo->patches[ i];
+		hdr = ref->hdr;
+		// the first CPUID mapped to the patch's equivalence ID stands for the patch
+		rec.signature = amd_patchsig( ucinfo, hdr->processor_rev_id, &count);
+		if (params->report != NULL) {
+			rec.revision = hdr->patch_id;
+			rec.date = amd_getDate( hdr->data_code);
+			rec.datasize = ref->size - sizeof( *hdr);
+			rec.totalsize = ref->size;
+			rec.offset = ref->off;
+			report_row( params->report, &rec, ucinfo->files[ ref->file].path);
+			continue;
+		}
+		date = hdr->data_code;
+		INFO( 10, "Patch %d of %d:\n", i + 1, ucinfo->npatches);
+		INFO( 10, "  Equivalence ID %04x, CPUID %08x%s\n", hdr->processor_rev_id, rec.signature,
+				count > 1 ? " and others" : "");
+		INFO( 11, "  Date %04x/%02x/%02x\n", date >> 16, (date >> 8) & 0xff, date & 0xff);
+		INFO( 10, "  Patch level 0x%08x\n", hdr->patch_id);
+		INFO( 12, "  Size %u (0x%x)\n", ref->size, ref->size);
+		if (hdr->nb_dev_id || hdr->sb_dev_id)
+			INFO( 10, "  Chipset specific, not used\n");
+	}
+	return 0;
+}
+
+
+int
+amd_update( struct cpupdate_params *params)
+{
+	struct amd_ProcessorInfo *pcoreinfo = (struct amd_ProcessorInfo *) params->coreinfop;
+	struct amd_ucinfo *ucinfo = (struct amd_ucinfo *) params->ucodeinfop;
+	struct amd_ProcessorInfo *coreinfo;
+	const struct amd_patchref *ref;
+	char cpupath[ MAXPATHLEN];
+	int order[ MAXCORES];
+	int updated = 0;			// number of cores updated so far, for the rolling mode batches
+	int core, n, ncores;
+	int r = 0;					// bool: updating some core failed
+
+	assert( pcoreinfo != NULL);
+	assert( ucinfo != NULL);
+
+	memset( params->changed, 0, sizeof( params->changed));
+	memset( params->updfailed, 0, sizeof( params->updfailed));
+	params->nchanged = 0;
+	// walk each core (the exclusion set ones last) and look up its patch in the index
+	ncores = cpu_updateorder( params, order);
+	for (n = 0; n < ncores; ++n) {
+		int cpufd = -1, rc = 0;		// status of this core
+
+		core = order[ n];
+		coreinfo = pcoreinfo + core;
+
+		// reload the core information, in case we have a faked core
+		if (amd_getCoreInfo( coreinfo, core)) {
+			params->updfailed[ core] = 1;
+			r = 1;
+			continue;
+		}
+		if ((ref = amd_findpatch( ucinfo, coreinfo->signature)) == NULL) {
+			INFO( 11, "No microcode patch for core %d. Not updated.\n", core);
+			continue;
+		}
+		sprintf( cpupath, "/dev/cpuctl%d", core);
+		if (coreinfo->patchlevel >= ref->hdr->patch_id) {
+			INFO( 11, "Core %d is up-to-date. Not updated.\n", core);
+		} else if ((cpufd = devio_open( core, O_RDWR)) < 0) {
+			INFO( 0, "Failed to open %s for writing\n", cpupath);
+			rc = 1;
+		} else {
+			cpuctl_update_args_t args;
+
+			// cpuctl hands the whole patch, header included, to the processor
+			args.data = (void *) ref->hdr;
+			args.size = ref->size;
+			if (params->writeit) {
+				uint64_t t0 = cpu_nsecs();
+				rc = devio_ioctl( cpufd, CPUCTL_UPDATE, &args);
+				cpu_addupdtime( params, core, cpu_nsecs() - t0);
+			} else {
+				INFO( 12, "(Simulated only!) ");
+			}
+			if (!rc) {
+				uint32_t oldlevel = coreinfo->patchlevel;
+
+				INFO( 11, "Updated core %d from microcode revision 0x%08x to 0x%08x\n", 
+						core, coreinfo->patchlevel, ref->hdr->patch_id);
+				// re-read the patch level to record whether the core actually moved
+				if (params->writeit && amd_getCoreInfo( coreinfo, core) == 0 && 
+						coreinfo->patchlevel != oldlevel)
+					cpu_setchanged( params, core);
+				cpu_batchpause( params, ++updated, n + 1 < ncores);
+			} else {
+				INFO( 0, "Updating core %d failed!\n", core);
+			}
+		}
+		if (rc) {
+			params->updfailed[ core] = 1;
+			r = 1;
+		}
+		if (cpufd >= 0)
+			close( cpufd);
+	}
+	return r;
+}
+
+
+int
+amd_freeucodeinfo( struct cpupdate_params *params)
+{
+	struct amd_ucinfo *ucinfo = (struct amd_ucinfo *) params->ucodeinfop;
+
+	if (ucinfo == NULL)
+		return 0;
+	for (int f = 0; f < AMD_MAXFILES; ++f) {
+		struct amd_file *file = &ucinfo->files[ f];
+
+		if (file->image == NULL)
+			continue;
+		if (file->mapped)
+			munmap( file->image, file->size);
+		else
+			free( file->image);
+	}
+	free( ucinfo->equivs);
+	free( ucinfo->patches);
+	free( ucinfo->equivtab);
+	free( ucinfo->patchtab);
+	free( ucinfo);
+	params->ucodeinfop = NULL;
+	return 0;
+}
+
+
+int
+amd_unsupported( struct cpupdate_params *params)
+{
+	INFO( 0, "Sorry, this function currently only supports Intel microcode\n");
+	return 1;
+}
+
+
+int
+amd_getcores( struct cpupdate_params *params, struct cpup_coreinfo *cores, int max)
+{
+	struct amd_ProcessorInfo *coreinfo = (struct amd_ProcessorInfo *) params->coreinfop;
+
+	for (int core = 0; core < params->numcores && core < max; ++core, ++coreinfo) {
+		cores[ core].core			= core;
+		cores[ core].signature		= coreinfo->signature;
+		cores[ core].platformflags	= 0;
+		cores[ core].revision		= coreinfo->patchlevel;
+	}
+	return params->numcores;
+}
+
+
+int
+amd_getblobs( struct cpupdate_params *params, struct cpup_blobinfo *blobs, int max)
+{
+	struct amd_ucinfo *ucinfo = (struct amd_ucinfo *) params->ucodeinfop;
+	const struct amd_patchref *ref;
+	int count, n;
+
+	assert( ucinfo != NULL);
+	for (n = 0; n < ucinfo->npatches && n < max; ++n) {
+		ref = &ucinfo->patches[ n];
+		blobs[ n].signature		= amd_patchsig( ucinfo, ref->hdr->processor_rev_id, &count);
+		blobs[ n].flags			= 0;
+		blobs[ n].revision		= ref->hdr->patch_id;
+		blobs[ n].date			= amd_getDate( ref->hdr->data_code);
+		blobs[ n].datasize		= ref->size - sizeof( *ref->hdr);
+		blobs[ n].totalsize		= ref->size;
+		blobs[ n].hasexttable	= 0;
+	}
+	return ucinfo->npatches;
+}
+
+
+const char *
+amd_getvendorname( struct cpupdate_params *params)
+{
+	return VENDORNAME_AMD;
+}
@@ -0,0 +1,131 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AMD_H
+#define	AMD_H
+
+/* AMD microcode container files, as distributed in linux-firmware amd-ucode/:
+ * a container is the magic, an equivalence table section, then patch sections.
+ * The equivalence table maps the CPUID signature of a processor to its 16 bit
+ * equivalence ID, a patch applies to the processors whose equivalence ID is its
+ * processor_rev_id. A file may hold several containers, e.g. for several families.
+ * Families before 15h share microcode_amd.bin, later ones have microcode_amd_famXXh.bin.
+ */
+
+#define AMD_MAGIC			0x00414d44		// "DMA\0"
+#define AMD_SECTION_EQUIV	0
+#define AMD_SECTION_PATCH	1
+#define AMD_MAXPATCH		(256 * 1024)	// largest patch cpuctl takes
+#define AMD_MAXFILES		8				// container files loaded, one per family
+#define AMD_FAMILY_SPLIT	0x15			// first family with a file of its own
+
+struct amd_section_hdr {
+	uint32_t	type;
+	uint32_t	size;				// of the data following
+};
+
+struct amd_equiv_entry {
+	uint32_t	installed_cpu;		// CPUID 1 EAX
+	uint32_t	fixed_errata_mask;
+	uint32_t	fixed_errata_compare;
+	uint16_t	equiv_cpu;
+	uint16_t	res;
+};
+
+struct amd_patch_hdr {
+	uint32_t	data_code;			// date as BCD yyyymmdd
+	uint32_t	patch_id;			// the patch level the processor reports after loading
+	uint16_t	mc_patch_data_id;
+	uint8_t		mc_patch_data_len;
+	uint8_t		init_flag;
+	uint32_t	mc_patch_data_checksum;
+	uint32_t	nb_dev_id;			// chipset specific patches have these set, they are not used
+	uint32_t	sb_dev_id;
+	uint16_t	processor_rev_id;	// equivalence ID
+	uint8_t		nb_rev_id;
+	uint8_t		sb_rev_id;
+	uint8_t		bios_api_rev;
+	uint8_t		reserved1[ 3];
+	uint32_t	match_reg[ 8];
+};
+
+struct amd_ProcessorInfo {
+	uint32_t	signature;			// CPUID 1 EAX
+	uint32_t	patchlevel;
+};
+
+// a container file, memory mapped or (read by the batched loader) malloc()ed
+struct amd_file {
+	uint8_t	   *image;
+	size_t		size;
+	int			mapped;
+	char		path[ MAXPATHLEN];
+};
+
+struct amd_patchref {
+	const struct amd_patch_hdr
+			   *hdr;
+	uint32_t	size;
+	int			file;
+	size_t		off;				// in the file
+};
+
+// hash table slots. equivalence IDs by signature, best patches by equivalence ID
+struct amd_equivslot {
+	uint32_t	signature;
+	uint16_t	equiv;
+	uint16_t	used;
+};
+
+struct amd_patchslot {
+	uint16_t	equiv;
+	uint16_t	used;
+	int			patch;				// index of the newest patch in patches
+};
+
+struct amd_ucinfo {
+	struct amd_file
+				files[ AMD_MAXFILES];
+	int			nfiles;
+	// all equivalence entries, pointing into the files, and all patches, in file order
+	const struct amd_equiv_entry
+			  **equivs;
+	int			nequivs,
+				maxequivs;
+	struct amd_patchref
+			   *patches;
+	int			npatches,
+				maxpatches;
+	// the index, built once when loading. both tables have mask + 1 slots
+	struct amd_equivslot
+			   *equivtab;
+	struct amd_patchslot
+			   *patchtab;
+	uint32_t	mask;
+	char		path[ MAXPATHLEN];	// of the first file, for messages
+};
+
+extern struct vendor_funcs amd_funcs;
+
+#endif /* !AMD_H */
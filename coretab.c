@@ -0,0 +1,160 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/param.h>
+
+#include "cpupdate.h"
+#include "coretab.h"
+
+static uint32_t coretab_hash( struct coretab *ct, int core);
+static int coretab_samekey( struct coretab *ct, int a, int b);
+
+
+// allocates the columns for ncores cores, all in one block
+int
+coretab_init( struct coretab *ct, int ncores)
+{
+	memset( ct, 0, sizeof( *ct));
+	if ((ct->sig = calloc( ncores, 3 * sizeof( uint32_t) + 4 * sizeof( int))) == NULL) {
+		INFO( 0, "Could not allocate core table!\n");
+		return 1;
+	}
+	ct->flags	= ct->sig + ncores;
+	ct->rev		= (int32_t *) (ct->flags + ncores);
+	ct->next	= (int *) (ct->rev + ncores);
+	ct->gfirst	= ct->next + ncores;
+	ct->glast	= ct->gfirst + ncores;
+	ct->gcount	= ct->glast + ncores;
+	ct->ncores	= ncores;
+	return 0;
+}
+
+
+void
+coretab_set( struct coretab *ct, int core, uint32_t sig, uint32_t flags, int32_t rev)
+{
+	ct->sig[ core]	 = sig;
+	ct->flags[ core] = flags;
+	ct->rev[ core]	 = rev;
+}
+
+
+static uint32_t
+coretab_hash( struct coretab *ct, int core)
+{
+	uint32_t h = ct->sig[ core];
+
+	h = (h ^ ct->flags[ core]) * 0x9e3779b1;
+	h = (h ^ (uint32_t) ct->rev[ core]) * 0x9e3779b1;
+	return h ^ (h >> 16);
+}
+
+
+static int
+coretab_samekey( struct coretab *ct, int a, int b)
+{
+	return ct->sig[ a] == ct->sig[ b] && ct->flags[ a] == ct->flags[ b] && ct->rev[ a] == ct->rev[ b];
+}
+
+
+/* groups the cores by key, using an open addressing hash of group numbers.
+ * returns the number of groups, or -1
+ */
+int
+coretab_group( struct coretab *ct)
+{
+	int	   *slots;
+	int		nslots = 16, g;
+	uint32_t i;
+
+	while (nslots < 2 * ct->ncores)
+		nslots <<= 1;
+	if ((slots = malloc( nslots * sizeof( *slots))) == NULL) {
+		INFO( 0, "Could not allocate core table!\n");
+		return -1;
+	}
+	memset( slots, 0xff, nslots * sizeof( *slots));
+	ct->ngroups = 0;
+	for (int core = 0; core < ct->ncores; ++core) {
+		i = coretab_hash( ct, core) & (nslots - 1);
+		// a group is represented by its first core
+		while ((g = slots[ i]) >= 0 && !coretab_samekey( ct, ct->gfirst[ g], core))
+			i = (i + 1) & (nslots - 1);
+		if (g < 0) {
+			g = slots[ i] = ct->ngroups++;
+			ct->gfirst[ g] = core;
+			ct->gcount[ g] = 0;
+		} else
+			ct->next[ ct->glast[ g]] = core;
+		ct->next[ core] = -1;
+		ct->glast[ g] = core;
+		++ct->gcount[ g];
+	}
+	free( slots);
+	return ct->ngroups;
+}
+
+
+/* writes the cores of group as CPU list, like "0-27,56-83", to buf.
+ * returns 0, or -1 if it was cut short
+ */
+int
+coretab_cpulist( struct coretab *ct, int group, char *buf, size_t size)
+{
+	char	range[ 32];
+	size_t	n = 0, len;
+	int		first;
+
+	buf[ 0] = '\0';
+	for (int core = ct->gfirst[ group]; core >= 0; core = ct->next[ core]) {
+		// extend over consecutive cores
+		for (first = core; ct->next[ core] == core + 1; core = ct->next[ core])
+			;
+		if (first == core)
+			len = snprintf( range, sizeof( range), "%s%d", n ? "," : "", first);
+		else
+			len = snprintf( range, sizeof( range), "%s%d-%d", n ? "," : "", first, core);
+		if (n + len >= size)
+			return -1;
+		memcpy( buf + n, range, len + 1);
+		n += len;
+	}
+	return 0;
+}
+
+
+void
+coretab_free( struct coretab *ct)
+{
+	free( ct->sig);
+	memset( ct, 0, sizeof( *ct));
+}
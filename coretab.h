@@ -0,0 +1,58 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CORETAB_H
+#define	CORETAB_H
+
+/* Table of the cores' identity, for printing cores of equal kind together.
+ * The key of a core is its raw signature, platform flags and microcode revision, held
+ * column wise. coretab_group() puts cores of equal key into one group by hashing the key,
+ * wherever they are in the core order, so each core is compared once against its group
+ * only. The cores of a group are chained in ascending order.
+ */
+
+// longest CPU list, "0,2,4,...": up to 3 digits and a comma per core
+#define CORETAB_LISTMAX	(4 * MAXCORES + 1)
+
+struct coretab {
+	int			ncores;
+	// per core
+	uint32_t   *sig;
+	uint32_t   *flags;
+	int32_t	   *rev;
+	int		   *next;			// next core of the same group, -1 at the end
+	// per group, in the order of their first core
+	int			ngroups;
+	int		   *gfirst;
+	int		   *glast;
+	int		   *gcount;
+};
+
+int  coretab_init( struct coretab *ct, int ncores);
+void coretab_set( struct coretab *ct, int core, uint32_t sig, uint32_t flags, int32_t rev);
+int  coretab_group( struct coretab *ct);
+int  coretab_cpulist( struct coretab *ct, int group, char *buf, size_t size);
+void coretab_free( struct coretab *ct);
+
+#endif /* !CORETAB_H */
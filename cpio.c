@@ -0,0 +1,128 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "cpupdate.h"
+#include "cpio.h"
+
+static void cpio_pad( struct cpio_writer *cw);
+
+
+int
+cpio_open( struct cpio_writer *cw, const char *path)
+{
+	int fd;
+
+	memset( cw, 0, sizeof( *cw));
+	cw->path = path;
+	if (snprintf( cw->tmppath, sizeof( cw->tmppath), "%s.XXXXXX", path) >= sizeof( cw->tmppath)) {
+		INFO( 0, "filename buffer too short for %s\n", cw->tmppath);
+		return 1;
+	}
+	if ((fd = mkstemp( cw->tmppath)) < 0) {
+		INFO( 0, "error opening output file %s\n", cw->tmppath);
+		return 1;
+	}
+	fchmod( fd, 0644);
+	if ((cw->fp = fdopen( fd, "w")) == NULL) {
+		INFO( 0, "error opening output file %s\n", cw->tmppath);
+		close( fd);
+		unlink( cw->tmppath);
+		return 1;
+	}
+	return 0;
+}
+
+
+// headers and data are padded to multiples of 4 bytes
+static void
+cpio_pad( struct cpio_writer *cw)
+{
+	static const char zeros[ 4];
+	long pos = ftell( cw->fp);
+
+	if (pos < 0 || fwrite( zeros, 1, (4 - (pos & 3)) & 3, cw->fp) != (size_t) ((4 - (pos & 3)) & 3))
+		cw->err = 1;
+}
+
+
+// adds an entry. directories and the trailer have no data
+void
+cpio_add( struct cpio_writer *cw, const char *name, uint32_t mode, const void *data, uint32_t size)
+{
+	size_t namesize = strlen( name) + 1;
+
+	if (cw->err)
+		return;
+	if (fprintf( cw->fp, "%s%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x", CPIO_MAGIC,
+				++cw->ino,				// inode
+				mode,
+				0, 0,					// uid, gid
+				S_ISDIR( mode) ? 2 : 1,	// nlink
+				0,						// mtime
+				size,
+				0, 0, 0, 0,				// devmajor, devminor, rdevmajor, rdevminor
+				(uint32_t) namesize,
+				0) < 0 ||				// check, only used by the CRC format
+			fwrite( name, 1, namesize, cw->fp) != namesize)
+		cw->err = 1;
+	cpio_pad( cw);
+	if (size > 0 && fwrite( data, 1, size, cw->fp) != size)
+		cw->err = 1;
+	cpio_pad( cw);
+}
+
+
+// adds the trailer and moves the archive into place, or discards it on errors
+int
+cpio_close( struct cpio_writer *cw)
+{
+	int r;
+
+	cpio_add( cw, CPIO_TRAILER, 0, NULL, 0);
+	r = cw->err;
+	if (fflush( cw->fp) || fsync( fileno( cw->fp)) < 0)
+		r = 1;
+	if (fclose( cw->fp))
+		r = 1;
+	cw->fp = NULL;
+	if (!r && rename( cw->tmppath, cw->path) < 0)
+		r = 1;
+	if (r) {
+		INFO( 0, "error writing archive %s\n", cw->path);
+		unlink( cw->tmppath);
+	}
+	return r;
+}
@@ -0,0 +1,52 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CPIO_H
+#define	CPIO_H
+
+/* Minimal writer for uncompressed cpio archives in the "newc" (SVR4, no CRC) format,
+ * as the Linux kernel expects for the early microcode archive prepended to an initramfs.
+ * Entries have uid/gid 0 and mtime 0, so the output only depends on the content.
+ * The archive is written to a temporary file, cpio_close() renames it into place.
+ */
+
+#define CPIO_MAGIC		("070701")
+#define CPIO_TRAILER	("TRAILER!!!")
+
+#define CPIO_MODE_DIR	0040755
+#define CPIO_MODE_FILE	0100644
+
+struct cpio_writer {
+	FILE	   *fp;
+	const char *path;
+	char		tmppath[ MAXPATHLEN];
+	uint32_t	ino;
+	int			err;			// bool: a write failed, cpio_close() discards the archive
+};
+
+int  cpio_open( struct cpio_writer *cw, const char *path);
+void cpio_add( struct cpio_writer *cw, const char *name, uint32_t mode, const void *data, uint32_t size);
+int  cpio_close( struct cpio_writer *cw);
+
+#endif /* !CPIO_H */
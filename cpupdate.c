@@ -34,13 +34,16 @@ __FBSDID("$FreeBSD$");
 #include <unistd.h>
 #include <fcntl.h>
 #include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <sysexits.h>
 #include <dirent.h>
+#include <getopt.h>
+#include <time.h>
 
 #include <sys/queue.h>
 #include <sys/param.h>
-#include <sys/linker.h>
-#include <sys/module.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -48,37 +51,140 @@ __FBSDID("$FreeBSD$");
 
 #include "cpupdate.h"
 #include "intel.h"
+#include "scan.h"
+#include "aload.h"
+#include "devio.h"
+#include "unpack.h"
+#include "owrite.h"
+#include "export.h"
+#include "gen.h"
+#include "pack.h"
+#include "report.h"
+#include "serve.h"
+#include "watch.h"
 
-// extern, set in cpu_getCoreNum() and used by the 
-// vendor-specific funcs to walk through cores
-int		verbosity = 10;
-int		vendormode = -1;
-int		numCores = 0;
-
-#define VENDOR_INDEX_INTEL 0
-#define VENDOR_INDEX_AMD   1
-#define VENDOR_INDEX_VIA   2
+static int	vendormode = -1;
 
 static struct	vendor_funcs   *handler;
 static struct	cpupdate_params	cpupbuf;
 
-char *pgmn = "cpupdate";			// program name for messages in case programname() does not work
-static struct vendor_funcs *handlers[] = {
-	&intel_funcs
-  // other handlers, AMD, VIA here
+static const char *exportpath;		// --export textfile
+static int exportinterval;			// --export-interval seconds, 0 for a single poll
+static const char *servepath;		// --serve socket
+static int serveinterval = 5;		// --serve-interval seconds between repository change checks
+static const char *eventpath;		// --events file, NULL for the devd socket
+static const char *batchpath;		// --batch command file, "-" for stdin
+static const char *recordpath;		// --record trace of the device calls
+static const char *replaypath;		// --replay trace answering the device calls
+static const char *reportpath;		// --report rows of -i, -f, -c and -d, "-" for stdout
+static int reportformat;			// --report-format, see report.h
+static int generations;				// bool: --generations, -CX, --prune and --sync publish new generations
+static int gengrace;				// --gen-grace seconds a retired generation is kept
+
+#define BATCH_MAXARGS	64			// arguments per batch command line
+
+/* --batch: the commands of a batch run in this process one after the other. the
+ * probed core table and the repository files loaded by -u are kept for the next
+ * commands, instead of loading cpuctl, counting and probing the cores again
+ */
+static int inbatch;
+static struct {
+	int		vendor;					// index of the probed handler, -1 if not probed yet
+	void   *coreinfop;
+	int		numcores;
+	void   *ucodeinfop;				// loaded and validated repository files, NULL if none
+	char	repokey[ 3 * MAXPATHLEN];	// primdir, secdir and packpath they were loaded from
+} shared = { .vendor = -1 };
+
+static char *pgmn = "cpupdate";		// program name for messages in case programname() does not work
+
+// long-only options get values beyond the char range
+enum {
+	OPT_BATCH = 256,
+	OPT_BATCHSIZE,
+	OPT_BATCHPAUSE,
+	OPT_CPU,
+	OPT_EARLYCPIO,
+	OPT_EXPORT,
+	OPT_EVENTS,
+	OPT_EXPORTINTERVAL,
+	OPT_GENERATIONS,
+	OPT_GENGRACE,
+	OPT_KEEP,
+	OPT_LASTCORES,
+	OPT_LOGJSON,
+	OPT_MATCH,
+	OPT_PACK,
+	OPT_PACKCOMPRESS,
+	OPT_PIN,
+	OPT_PRUNE,
+	OPT_RECORD,
+	OPT_REPLAY,
+	OPT_REPORT,
+	OPT_REPORTFORMAT,
+	OPT_SCANIMAGE,
+	OPT_SERVE,
+	OPT_SERVEINTERVAL,
+	OPT_SYNC,
+	OPT_USEPACK,
+	OPT_VERIFY,
+	OPT_VERIFYSTATE,
+	OPT_WATCH
+};
+
+static struct option longopts[] = {
+	{ "batch",			required_argument,	NULL,	OPT_BATCH },
+	{ "batch-size",		required_argument,	NULL,	OPT_BATCHSIZE },
+	{ "batch-pause",	required_argument,	NULL,	OPT_BATCHPAUSE },
+	{ "cpu",			required_argument,	NULL,	OPT_CPU },
+	{ "early-cpio",		required_argument,	NULL,	OPT_EARLYCPIO },
+	{ "events",			required_argument,	NULL,	OPT_EVENTS },
+	{ "export",			required_argument,	NULL,	OPT_EXPORT },
+	{ "export-interval",required_argument,	NULL,	OPT_EXPORTINTERVAL },
+	{ "generations",		no_argument,		NULL,	OPT_GENERATIONS },
+	{ "gen-grace",		required_argument,	NULL,	OPT_GENGRACE },
+	{ "keep",			required_argument,	NULL,	OPT_KEEP },
+	{ "last-cores",		required_argument,	NULL,	OPT_LASTCORES },
+	{ "log-json",		no_argument,		NULL,	OPT_LOGJSON },
+	{ "match",			required_argument,	NULL,	OPT_MATCH },
+	{ "pack",			required_argument,	NULL,	OPT_PACK },
+	{ "pack-compress",	no_argument,		NULL,	OPT_PACKCOMPRESS },
+	{ "pin",			required_argument,	NULL,	OPT_PIN },
+	{ "prune",			required_argument,	NULL,	OPT_PRUNE },
+	{ "record",			required_argument,	NULL,	OPT_RECORD },
+	{ "replay",			required_argument,	NULL,	OPT_REPLAY },
+	{ "report",			required_argument,	NULL,	OPT_REPORT },
+	{ "report-format",	required_argument,	NULL,	OPT_REPORTFORMAT },
+	{ "scan-image",		required_argument,	NULL,	OPT_SCANIMAGE },
+	{ "serve",			required_argument,	NULL,	OPT_SERVE },
+	{ "serve-interval",	required_argument,	NULL,	OPT_SERVEINTERVAL },
+	{ "sync",			no_argument,		NULL,	OPT_SYNC },
+	{ "use-pack",		required_argument,	NULL,	OPT_USEPACK },
+	{ "verify",			required_argument,	NULL,	OPT_VERIFY },
+	{ "verify-state",	required_argument,	NULL,	OPT_VERIFYSTATE },
+	{ "watch",			no_argument,		NULL,	OPT_WATCH },
+	{ NULL,				0,					NULL,	0 }
 };
 
-static void usage( void);
-static int modload( const char *name);
-static int cpu_getCoreNum( void);
+static int usage( void);
+static int numopt( const char *what, const char *arg, int min, int max, int *val);
+static int getcorenum( void);
 static int cpu_setHandler( void);
-// leave the switch in to make cpupdate work on older FreeBSD versions 
-// without Meltdown/Spectr mitigations, too
-#ifdef CPUCTL_EVAL_CPU_FEATURES
-static int do_eval_cpu_features( const char *dev);
-#endif
+static void setrepodefaults( const char *vendorname);
+static int export( void);
+static int scan_check( int dfd, const char *name, const char *path, void *arg);
+static int scan_convert( int dfd, const char *name, const char *path, void *arg);
+static int convert( int cmd);
+static int genindex( struct gen *g);
+static int generation( int cmd);
+static int loadrepo( void);
+static void unloadrepo( void);
+static void forgetrepo( void);
+static int splitline( char *line, char **av, int maxargs);
+static int batch( const char *path);
+static int run( int argc, char *argv[]);
 
-void 
+int 
 usage( void)
 {
   fprintf(stderr, "Usage: %s [-qwvvuiCXIAVh] [-<f|U> <microcodefile>] [-<cpsST> <datadir>]\n", pgmn);
@@ -86,13 +192,28 @@ usage( void)
   fprintf(stderr, "  -u   update microcode\n");
   fprintf(stderr, "  -U   update microcode using file <microcodefile>\n");
   fprintf(stderr, "  -w   write it: without this option cpupdate only simulates updating\n");
+  fprintf(stderr, "  --batch-size <n>       rolling update: update <n> cores per batch\n");
+  fprintf(stderr, "  --batch-pause <ms>     rolling update: pause <ms> milliseconds between batches\n");
+  fprintf(stderr, "  --last-cores <cpulist> rolling update: update these cores (e.g. 0-3,8) last\n");
+  fprintf(stderr, "  --export <file>        write per-core revisions as Prometheus textfile <file>\n");
+  fprintf(stderr, "  --export-interval <s>  with --export: keep polling every <s> seconds\n");
+  fprintf(stderr, "  --watch                update as -u, then reapply the update to cores going online and on resume (devd events)\n");
+  fprintf(stderr, "  --events <file>        with --watch: read devd event lines from <file> instead of the devd socket\n");
+  fprintf(stderr, "  --serve <socket>       answer best blob queries for the repository on UNIX socket <socket>\n");
+  fprintf(stderr, "  --serve-interval <s>   with --serve: check the repository for changes every <s> seconds (default 5)\n");
+  fprintf(stderr, "  --batch <file>         run the commands in <file> (one command line per line, - for stdin) in one process\n");
+  fprintf(stderr, "  --record <trace>       write all cpuctl device calls with their results and latencies to <trace>\n");
+  fprintf(stderr, "  --replay <trace>       answer the cpuctl device calls from <trace> instead of the devices\n");
   fprintf(stderr, "  -q   quiet mode\n");
   fprintf(stderr, "  -v   verbose mode, -vv very verbose\n");
+  fprintf(stderr, "  --log-json             print messages as JSON lines\n");
+  fprintf(stderr, "  --report <file>        with -ifcd: write a row per core group, blob and bad file to <file> (- for stdout)\n");
+  fprintf(stderr, "  --report-format <fmt>  with --report: json (JSON lines, default), csv or bin\n");
   fprintf(stderr, "  -p   use primary repo path <datadir>\n");
   fprintf(stderr, "  -s   use secondary repo path <datadir>\n");
   fprintf(stderr, "  -V   print version\n");
   fprintf(stderr, "  -h   show this help\n");
-  fprintf(stderr, "  -IAV for the options below: vendor mode must be set [atm only Intel (-I) implemented]\n");
+  fprintf(stderr, "  -IA  for the options below: vendor mode must be set, Intel (-I) or AMD (-A). -CX and the repository tools are Intel only\n");
   fprintf(stderr, "  -f   show version information of microcode file\n");
   fprintf(stderr, "  -c   Check integrity of microcode files in <datadir>\n");
   fprintf(stderr, "  -d   As -c, in addition print microcode file statistics\n");
@@ -100,46 +221,57 @@ usage( void)
   fprintf(stderr, "  -X   convert (extract) microcode files from multi-blob intel-ucode to legacy file format\n");
   fprintf(stderr, "  -S   source dir for converting\n");
   fprintf(stderr, "  -T   target dir for converting\n");
-  exit(EX_USAGE);
+  fprintf(stderr, "  --match <pattern>      with -cdCX: only use files whose names match <pattern>\n");
+  fprintf(stderr, "  --verify <tier>        with -cd: check the blobs only to tier header, struct or full (default)\n");
+  fprintf(stderr, "  --verify-state <file>  with -cd: skip files checked to the tier before and unchanged, record the tiers in <file>\n");
+  fprintf(stderr, "  --pack <file>          pack all microcode files in the source dir into container <file>\n");
+  fprintf(stderr, "  --pack-compress        with --pack: compress the blobs in the container\n");
+  fprintf(stderr, "  --use-pack <file>      look up microcode in container <file> before the repo paths\n");
+  fprintf(stderr, "                         without -p, -s and --use-pack, %s/<vendor>.pack is used the same way,\n", MICROCODE_REPO_PATH_PACK);
+  fprintf(stderr, "                         unless a default repo path has been modified after it\n");
+  fprintf(stderr, "  --prune <datadir>      remove superseded revisions from the microcode files in <datadir> (needs -w)\n");
+  fprintf(stderr, "  --keep <n>             with --prune: keep the <n> newest revisions per signature and flags\n");
+  fprintf(stderr, "  --pin <sig>:<rev>      with --prune: also keep this revision (hex), may be repeated\n");
+  fprintf(stderr, "  --sync                 update the multi-blob files in -T to the blobs in -S, writing only changed files (needs -w)\n");
+  fprintf(stderr, "  --generations          with -CX, --prune and --sync: build the target as new generation and switch it over atomically\n");
+  fprintf(stderr, "  --gen-grace <s>        with --generations: remove retired generations after <s> seconds (default %d)\n", GEN_GRACE);
+  fprintf(stderr, "  --scan-image <file>    list the microcode blobs embedded in firmware image <file>, with -T extract them there\n");
+  fprintf(stderr, "  --early-cpio <file>    write the microcode for the local CPUs as Linux early load cpio <file>\n");
+  fprintf(stderr, "  --cpu <sig>:<pfid>     with --early-cpio: use this signature (hex) and platform ID (0-7) instead\n");
+  // a bad command line in a batch only fails that command
+  if (!inbatch)
+	exit(EX_USAGE);
+  return EX_USAGE;
 }
 
 
+/* parses the decimal argument arg of an option into *val, which must lie in min..max.
+ * returns 1 with a message naming the option by what otherwise
+ */
 static int
-modload( const char *name)
+numopt( const char *what, const char *arg, int min, int max, int *val)
 {
-	if (modfind(name) < 0)
-		if (kldload(name) < 0 || modfind(name) < 0) {
-			warn("%s: module not found", name);
-			return 0;
-		}
-	return 1;
+	char *end;
+	long  n;
+
+	errno = 0;
+	n = strtol( arg, &end, 10);
+	if (end == arg || *end != '\0' || errno == ERANGE || n < min || n > max) {
+		INFO( 0, "ERROR: invalid %s %s, must be a number from %d to %d\n", what, arg, min, max);
+		return 1;
+	}
+	*val = n;
+	return 0;
 }
 
 
-static int 
-cpu_getCoreNum( void)
+// number of cores, counted once per batch
+static int
+getcorenum( void)
 {
-	struct dirent *direntry;
-	DIR *dirp = opendir("/dev");
-	int r = 0;
-	int high = 0;
-	
-	if (dirp == NULL) {
-		r = -1;
-	} else {
-		modload("cpuctl");
-		while ((direntry = readdir(dirp)) != NULL) {
-			if (direntry->d_namlen == 0)
-				continue;
-			if (!strncmp( direntry->d_name, "cpuctl", 6)) {
-				int x = atoi( direntry->d_name + 6);
-				if (x > high)
-					high = x;
-		}	}
-		r = closedir( dirp);
-	}
- 	r = (r) ? -1 : ++high;
-	return r;
+	if (inbatch && shared.vendor >= 0)
+		return shared.numcores;
+	return cpup_getcorenum();
 }
 
 
@@ -149,85 +281,478 @@ cpu_setHandler( void)
 	unsigned int i;
 	int          r = -1;
 	
-	for (i = 0; i < NHANDLERS; i++)
-		if (handlers[ i]->probe( &cpupbuf) == 0) {
+	// probed by an earlier command of the batch
+	if (inbatch && shared.vendor >= 0) {
+		handler = cpu_handlers[ shared.vendor];
+		cpupbuf.coreinfop = shared.coreinfop;
+		return shared.vendor;
+	}
+	for (i = 0; i < (unsigned int) cpu_nhandlers; i++)
+		if (cpu_handlers[ i]->probe( &cpupbuf) == 0) {
 			r = i;
 			break;
 		}
-	if (r >= 0 && i < NHANDLERS) {
-		handler = handlers[ i];
+	if (r >= 0 && i < (unsigned int) cpu_nhandlers) {
+		handler = cpu_handlers[ i];
 		r = i;
+		if (inbatch) {
+			shared.vendor = i;
+			shared.coreinfop = cpupbuf.coreinfop;
+			shared.numcores = cpupbuf.numcores;
+		}
 	} else
 		r = -1;
 	return r;
 }
 
 
-static int 
-isdir( const char *path)
+// completes the repository paths with the defaults and the vendor subdirectory
+static void
+setrepodefaults( const char *vendorname)
+{
+	struct stat	sp, sd;
+	int explicit = strlen( cpupbuf.primdir) || strlen( cpupbuf.secdir);
+
+	if (!strlen( cpupbuf.primdir))
+		strcpy( cpupbuf.primdir, MICROCODE_REPO_PATH_PRIM);
+	if (!strlen( cpupbuf.secdir))
+		strcpy( cpupbuf.secdir, MICROCODE_REPO_PATH_SEC);
+	strcat( cpupbuf.primdir, "/");
+	strcat( cpupbuf.secdir, "/");
+	strcat( cpupbuf.primdir, vendorname);
+	strcat( cpupbuf.secdir, vendorname);
+	/* the default container only stands in for the default repo paths, and only
+	 * while none of them has changed since it was built
+	 */
+	if (!strlen( cpupbuf.packpath) && !explicit) {
+		snprintf( cpupbuf.packpath, sizeof( cpupbuf.packpath), "%s/%s.pack", 
+				MICROCODE_REPO_PATH_PACK, vendorname);
+		if (stat( cpupbuf.packpath, &sp) || access( cpupbuf.packpath, R_OK)) {
+			cpupbuf.packpath[ 0] = '\0';
+		} else if ((!stat( cpupbuf.primdir, &sd) && sd.st_mtime > sp.st_mtime) ||
+				(!stat( cpupbuf.secdir, &sd) && sd.st_mtime > sp.st_mtime)) {
+			INFO( 1, "Notice: container %s is older than the repositories, not using it\n", cpupbuf.packpath);
+			cpupbuf.packpath[ 0] = '\0';
+		}
+	}
+}
+
+
+// --export: probe once through the library, then let the exporter poll
+static int
+export( void)
+{
+	struct cpup_ctx *ctx;
+	uint64_t t;
+	int		 r;
+
+	if ((ctx = cpup_open( vendormode, cpup_verbosity)) == NULL)
+		return 1;
+	t = cpu_nsecs();
+	r = cpup_probe( ctx);
+	t = cpu_nsecs() - t;
+	if (r) {
+		INFO( 10, "Sorry! This CPU brand is unsupported.\n");
+	} else {
+		setrepodefaults( cpup_vendorname( ctx));
+		r = cpup_setrepo( ctx, cpupbuf.primdir, cpupbuf.secdir, cpupbuf.packpath);
+	}
+	if (!r)
+		r = export_run( ctx, exportpath, exportinterval, t);
+	cpup_close( ctx);
+	return r;
+}
+
+
+// unpack_tree() callback for -c and -d: check a file, with -d also print its stats.
+// with --report, both write the rows of the blobs and of the files failing
+static int
+scan_check( int dfd, const char *name, const char *path, void *arg)
+{
+	int cmd = *(int *) arg;
+
+	strcpy( cpupbuf.filepath, path);
+	cpupbuf.filedirfd = dfd;
+	cpupbuf.filename = name;
+	if (handler->loadcheckmicrocode( &cpupbuf)) {
+		if (cpupbuf.report != NULL) {
+			struct report_rec rec = { .type = REPORT_BAD };
+
+			report_row( cpupbuf.report, &rec, path);
+		}
+	} else if (cmd == 'd' || cpupbuf.report != NULL)
+		handler->printmicrocodestats( &cpupbuf);
+	handler->freeucodeinfo( &cpupbuf);
+	cpupbuf.filename = NULL;
+	return 0;
+}
+
+
+// unpack_tree() callback for -C and -X: convert a file, stop the walk on write errors
+static int
+scan_convert( int dfd, const char *name, const char *path, void *arg)
+{
+	int cmd = *(int *) arg;
+	int r = 0;
+
+	strcpy( cpupbuf.filepath, path);
+	cpupbuf.filedirfd = dfd;
+	cpupbuf.filename = name;
+	if (handler->loadcheckmicrocode( &cpupbuf)) {
+		INFO( 0, "Error with microcode file %s, skipping that file\n", path);
+	} else if (cmd == 'X') {
+		if (handler->extractformat( &cpupbuf)) {
+			INFO( 0, "ERROR: Error while extracting microcode file %s\n", path);
+			r = 1;
+		}
+	} else {
+		// (cmd == 'C')
+		if (handler->compactformat( &cpupbuf)) {
+			INFO( 0, "ERROR: Error while compacting microcode file %s\n", path);
+			r = 1;
+		}
+	}
+	handler->freeucodeinfo( &cpupbuf);
+	cpupbuf.filename = NULL;
+	return r;
+}
+
+
+// -C and -X: convert all files of srcdir, the output files are written in batches
+static int
+convert( int cmd)
 {
+	struct owriter ow;
 	int r;
-	struct stat st;
-	
-	r = stat( path, &st);
-	if (r < 0)
-		INFO( 0, "stat(%s) failed\n", path);
-	return (r < 0) ? r : (st.st_mode & S_IFDIR);
+
+	owrite_init( &ow, cpupbuf.targetdir);
+	cpupbuf.out = &ow;
+	r = unpack_tree( &cpupbuf, cpupbuf.srcdir, cpupbuf.pattern, scan_convert, &cmd);
+	// what is left of the last batch
+	if (owrite_commit( &ow))
+		r = 1;
+	owrite_free( &ow);
+	cpupbuf.out = NULL;
+	return r;
 }
 
 
-#ifdef CPUCTL_EVAL_CPU_FEATURES
+// validates all files of the new generation and writes its index, see vstate.h
 static int
-do_eval_cpu_features( const char *dev)
+genindex( struct gen *g)
 {
-	int fd, error;
-	
-	assert(dev != NULL);
-	fd = open(dev, O_RDWR);
-	if (fd < 0) {
-		INFO(0, "register new CPU features: error opening %s for writing\n", dev);
-		return ( 1);
+	const char *pattern = cpupbuf.pattern;
+	struct report *report = cpupbuf.report;
+	char	srcdir[ MAXPATHLEN];
+	int		verify = cpupbuf.verify;
+	int		r;
+
+	strcpy( srcdir, cpupbuf.srcdir);
+	strcpy( cpupbuf.srcdir, g->path);
+	cpupbuf.pattern = NULL;
+	cpupbuf.report = NULL;
+	cpupbuf.verify = VERIFY_FULL;
+	cpupbuf.verifylist = 0;
+	cpupbuf.verifystate = g->index;
+	r = handler->verifytree( &cpupbuf);
+	strcpy( cpupbuf.srcdir, srcdir);
+	cpupbuf.pattern = pattern;
+	cpupbuf.report = report;
+	cpupbuf.verify = verify;
+	cpupbuf.verifystate = NULL;
+	return r;
+}
+
+
+/* --generations: runs -C, -X, --prune or --sync on a new generation of the repository
+ * they write, validates and indexes it, and publishes it if all went well
+ */
+static int
+generation( int cmd)
+{
+	char   *dir = (cmd == OPT_PRUNE) ? cpupbuf.srcdir : cpupbuf.targetdir;
+	char	repo[ MAXPATHLEN];
+	struct gen g;
+	int		r;
+
+	strcpy( repo, dir);
+	// -C and -X append to the files they write, so they start from an empty generation
+	if (gen_begin( &g, repo, cmd == OPT_PRUNE || cmd == OPT_SYNC))
+		return 1;
+	strcpy( dir, g.path);
+	switch (cmd) {
+		case OPT_PRUNE:	r = handler->prune( &cpupbuf);
+						break;
+		case OPT_SYNC:	r = handler->sync( &cpupbuf);
+						break;
+		default:		r = convert( cmd);
+						break;
 	}
-	error = ioctl( fd, CPUCTL_EVAL_CPU_FEATURES, NULL);
-	if (error < 0)
-		INFO(0, "Error with registering new CPU features on %s\n", dev);
-	close( fd);
-	return( error);
+	if (!r && (r = genindex( &g)))
+		INFO( 0, "Generation %s failed validation\n", g.path);
+	if (!r)
+		r = gen_publish( &g);
+	if (r)
+		gen_abort( &g);
+	else
+		gen_reclaim( &g, gengrace);
+	gen_end( &g);
+	strcpy( dir, repo);
+	return r;
+}
+
+
+// -u: loads and validates the repository files for the probed cores. in a batch the
+// files loaded before from the same repository are used again
+static int
+loadrepo( void)
+{
+	char key[ sizeof( shared.repokey)];
+	int  r;
+
+	// stay with the generations current now, whatever gets published meanwhile
+	if (gen_resolve( cpupbuf.primdir) || gen_resolve( cpupbuf.secdir))
+		return 1;
+	if (!inbatch)
+		return handler->loadcheckmicrocode( &cpupbuf);
+	snprintf( key, sizeof( key), "%s\n%s\n%s", cpupbuf.primdir, cpupbuf.secdir, cpupbuf.packpath);
+	if (shared.ucodeinfop != NULL && !strcmp( key, shared.repokey)) {
+		INFO( 11, "Using the repository files loaded before\n");
+		cpupbuf.ucodeinfop = shared.ucodeinfop;
+		return 0;
+	}
+	// another repository: drop the files kept so far
+	if (shared.ucodeinfop != NULL) {
+		cpupbuf.ucodeinfop = shared.ucodeinfop;
+		handler->freeucodeinfo( &cpupbuf);
+		shared.ucodeinfop = NULL;
+	}
+	r = handler->loadcheckmicrocode( &cpupbuf);
+	if (!r) {
+		shared.ucodeinfop = cpupbuf.ucodeinfop;
+		strcpy( shared.repokey, key);
+	}
+	return r;
+}
+
+
+// frees the files loaded for updating, unless they are kept for the next commands of the batch
+static void
+unloadrepo( void)
+{
+	if (cpupbuf.ucodeinfop != NULL && cpupbuf.ucodeinfop == shared.ucodeinfop)
+		cpupbuf.ucodeinfop = NULL;
+	else
+		handler->freeucodeinfo( &cpupbuf);
+}
+
+
+// drops the repository files kept for the batch, the next -u loads them again
+static void
+forgetrepo( void)
+{
+	void *ucodeinfop = cpupbuf.ucodeinfop;
+
+	if (shared.ucodeinfop == NULL)
+		return;
+	cpupbuf.ucodeinfop = shared.ucodeinfop;
+	cpu_handlers[ shared.vendor]->freeucodeinfo( &cpupbuf);
+	cpupbuf.ucodeinfop = ucodeinfop;
+	shared.ucodeinfop = NULL;
+	shared.repokey[ 0] = '\0';
+}
+
+
+/* splits a batch line into arguments at blanks, "..." quotes an argument containing blanks.
+ * the rest of the line after a # starting an argument is a comment.
+ * returns the number of arguments, -1 if there are more than maxargs or a quote is not closed
+ */
+static int
+splitline( char *line, char **av, int maxargs)
+{
+	char *p = line, *d;
+	int   n = 0, end;
+
+	for (;;) {
+		while (*p == ' ' || *p == '\t')
+			++p;
+		if (*p == '\0' || *p == '#')
+			return n;
+		if (n == maxargs)
+			return -1;
+		av[ n++] = d = p;
+		while (*p != '\0' && *p != ' ' && *p != '\t') {
+			if (*p == '"') {
+				for (++p; *p != '"'; ++p) {
+					if (*p == '\0')
+						return -1;
+					*d++ = *p;
+				}
+				++p;
+			} else
+				*d++ = *p++;
+		}
+		end = (*p == '\0');
+		*d = '\0';
+		if (end)
+			return n;
+		++p;
+	}
+}
+
+
+/* --batch: runs each line of path (stdin for "-") as a cpupdate command line, and prints
+ * one JSON record per command with line number, command line, exit status and duration.
+ * the options of a command do not carry over to the next one, the probed cores and the
+ * repository files loaded by -u do
+ */
+static int
+batch( const char *path)
+{
+	FILE   *fp;
+	char   *line = NULL, *esc = NULL, *av[ BATCH_MAXARGS + 1];
+	size_t	size = 0;
+	ssize_t len;
+	uint64_t t;
+	int		ac, lineno = 0, ncmds = 0, nfailed = 0, r;
+	int		verbosity = cpup_verbosity, sink = log_getsink();
+
+	if (!strcmp( path, "-"))
+		fp = stdin;
+	else if ((fp = fopen( path, "r")) == NULL) {
+		INFO( 0, "ERROR: could not open batch file %s\n", path);
+		return 1;
+	}
+	inbatch = 1;
+	while ((len = getline( &line, &size, fp)) != -1) {
+		++lineno;
+		if (len && line[ len - 1] == '\n')
+			line[ --len] = '\0';
+		free( esc);
+		if ((esc = malloc( 6 * len + 1)) == NULL) {
+			INFO( 0, "ERROR: out of memory\n");
+			nfailed = 1;
+			break;
+		}
+		esc[ log_jsonescape( esc, line, len)] = '\0';
+		t = cpu_nsecs();
+		if ((ac = splitline( line, av + 1, BATCH_MAXARGS - 1)) == 0)
+			continue;
+		if (ac < 0) {
+			INFO( 0, "ERROR: line %d: quote not closed or more than %d arguments\n", lineno, BATCH_MAXARGS - 1);
+			r = EX_USAGE;
+		} else {
+			av[ 0] = pgmn;
+			av[ ac + 1] = NULL;
+			r = run( ac + 1, av);
+		}
+		t = cpu_nsecs() - t;
+		cpup_verbosity = verbosity;
+		log_setsink( sink);
+		log_flushpending();
+		printf( "{\"line\":%d,\"cmd\":\"%s\",\"status\":%d,\"ms\":%.3f}\n", lineno, esc, r, t / 1e6);
+		fflush( stdout);
+		++ncmds;
+		if (r)
+			++nfailed;
+	}
+	if (ferror( fp)) {
+		INFO( 0, "ERROR: error reading batch file %s\n", path);
+		nfailed = 1;
+	}
+	free( esc);
+	free( line);
+	if (fp != stdin)
+		fclose( fp);
+	inbatch = 0;
+	// the state kept for the commands
+	if (shared.vendor >= 0) {
+		cpupbuf.ucodeinfop = shared.ucodeinfop;
+		cpu_handlers[ shared.vendor]->freeucodeinfo( &cpupbuf);
+		free( shared.coreinfop);
+		memset( &shared, 0, sizeof( shared));
+		shared.vendor = -1;
+	}
+	INFO( 10, "%d commands run, %d failed\n", ncmds, nfailed);
+	return nfailed ? 1 : 0;
 }
-#endif
 
 
 int 
 main( int argc, char *argv[])
 {
-	int   c, cmd, r = 0;
-	char *data;
-	int   ambigc = 0;
-	int   ambigv = 0;
 	const char *prgname;
 
 	if ((prgname = getprogname()) != NULL)
 		pgmn = (char *) prgname;
+	return run( argc, argv);
+}
+
+
+// parses a command line and runs its command, also for each command of a batch
+static int
+run( int argc, char *argv[])
+{
+	int   c, cmd = 0, r = 0;
+	char *data;
+	int   ambigc = 0;
+	int   ambigv = 0;
+	int   tracing = 0;		// bool: this command started recording or replay
+
 	memset( &cpupbuf, 0, sizeof( struct cpupdate_params));
+	cpupbuf.prunekeep = 1;
+	cpupbuf.verify = VERIFY_FULL;
+	vendormode = -1;
+	handler = NULL;
+	exportpath = servepath = eventpath = batchpath = recordpath = replaypath = reportpath = NULL;
+	reportformat = REPORT_JSON;
+	generations = 0;
+	gengrace = GEN_GRACE;
+	exportinterval = 0;
+	serveinterval = 5;
+	optreset = 1;
+	optind = 1;
 	
 	if (argc == 1)
-		usage();
-	while ((c = getopt( argc, argv, "U:c:f:d:uihIqvwp:s:S:T:CXV")) != -1) {
+		return usage();
+	while ((c = getopt_long( argc, argv, "U:c:f:d:uihIAqvwp:s:S:T:CXV", longopts, NULL)) != -1) {
 		switch (c) {
 			case 'U':
 			case 'c': 
 			case 'f':
-			case 'd': 	if (strlen( optarg) < MAXPATHLEN) {
-		  					if (c == 'f' || c == 'U') {
+			case 'd':
+			case OPT_PACK:
+			case OPT_PRUNE:
+			case OPT_EARLYCPIO:
+			case OPT_EXPORT:
+			case OPT_SERVE:
+			case OPT_BATCH:
+			case OPT_SCANIMAGE:
+						if (strlen( optarg) < MAXPATHLEN) {
+		  					if (c == 'f' || c == 'U' || c == OPT_SCANIMAGE) {
 								strcpy( (char *) &cpupbuf.filepath, optarg);
 							} else if (c == 'c' || c == 'd') {
 								data = optarg;
+							} else if (c == OPT_PACK) {
+								strcpy( cpupbuf.packpath, optarg);
+							} else if (c == OPT_PRUNE) {
+								strcpy( cpupbuf.srcdir, optarg);
+							} else if (c == OPT_EARLYCPIO) {
+								strcpy( cpupbuf.cpiopath, optarg);
+							} else if (c == OPT_SERVE) {
+								servepath = optarg;
+							} else if (c == OPT_BATCH) {
+								batchpath = optarg;
+							} else {
+								exportpath = optarg;
 							}
 						} else {
 							INFO( 0, "ERROR: Path too long\n");
 							r = 1;
 							break;
 						}
+			case OPT_SYNC:
+			case OPT_WATCH:
 			case 'C': 
 			case 'X': 
 			case 'V': 
@@ -249,7 +774,6 @@ main( int argc, char *argv[])
 						}
 						ambigv = 1;
 						break;
-#if 0
 			case 'A':	vendormode = VENDOR_INDEX_AMD;
 						if (ambigv) {
 							INFO( 0, "ERROR: only one vendor mode option allowed\n");
@@ -258,6 +782,7 @@ main( int argc, char *argv[])
 						}
 						ambigv = 1;
 						break;
+#if 0
 			case 'V':	vendormode = VENDOR_INDEX_VIA;
 						if (ambigv) {
 							INFO( 0, "ERROR: only one vendor mode option allowed\n");
@@ -267,9 +792,9 @@ main( int argc, char *argv[])
 						ambigv = 1;
 						break;
 #endif
-			case 'q':	verbosity -= 10;
+			case 'q':	cpup_verbosity -= 10;
 						break;
-			case 'v':	++verbosity;
+			case 'v':	++cpup_verbosity;
 						break;
 			case 'p': 	if (strlen( optarg) < MAXPATHLEN) {
 							strcpy( (char *) &cpupbuf.primdir, optarg);
@@ -301,15 +826,140 @@ main( int argc, char *argv[])
 						break;
 			case 'w':	++cpupbuf.writeit;
 						break;
-			default:	usage();
-						// NOTREACHED
+			case OPT_BATCHSIZE:
+						if (numopt( "batch size", optarg, 1, INT_MAX, &cpupbuf.batchsize))
+							r = usage();
+						break;
+			case OPT_BATCHPAUSE:
+						if (numopt( "batch pause", optarg, 0, INT_MAX, &cpupbuf.batchpause))
+							r = usage();
+						break;
+			case OPT_PACKCOMPRESS:
+						++cpupbuf.packcompress;
+						break;
+			case OPT_USEPACK:
+						if (strlen( optarg) < MAXPATHLEN) {
+							strcpy( cpupbuf.packpath, optarg);
+						} else {
+							INFO( 0, "ERROR: container path name too long\n");
+							r = 1;
+						}
+						break;
+			case OPT_GENERATIONS:
+						generations = 1;
+						break;
+			case OPT_GENGRACE:
+						if (numopt( "generation grace period", optarg, 0, INT_MAX, &gengrace))
+							r = usage();
+						break;
+			case OPT_KEEP:
+						if (numopt( "number of revisions to keep", optarg, 1, INT_MAX, &cpupbuf.prunekeep))
+							r = usage();
+						break;
+			case OPT_PIN: {
+						unsigned int sig, rev;
+						char trail;
+
+						if (cpupbuf.npins == MAXPINS) {
+							INFO( 0, "ERROR: at most %d pinned revisions\n", MAXPINS);
+							r = 1;
+						} else if (sscanf( optarg, "%x:%x%c", &sig, &rev, &trail) != 2) {
+							INFO( 0, "ERROR: invalid pin %s, use <signature>:<revision>\n", optarg);
+							r = 1;
+						} else {
+							cpupbuf.pinsig[ cpupbuf.npins] = sig;
+							cpupbuf.pinrev[ cpupbuf.npins++] = rev;
+						}
+						break;
+			}
+			case OPT_CPU: {
+						unsigned int sig, pfid;
+						char trail;
+
+						if (cpupbuf.ntargets == MAXCORES) {
+							INFO( 0, "ERROR: at most %d CPUs\n", MAXCORES);
+							r = 1;
+						} else if (sscanf( optarg, "%x:%u%c", &sig, &pfid, &trail) != 2 || pfid > 7) {
+							INFO( 0, "ERROR: invalid CPU %s, use <signature>:<platform ID>\n", optarg);
+							r = 1;
+						} else {
+							cpupbuf.targetsig[ cpupbuf.ntargets] = sig;
+							cpupbuf.targetflags[ cpupbuf.ntargets++] = 1 << pfid;
+						}
+						break;
+			}
+			case OPT_EXPORTINTERVAL:
+						if (numopt( "export interval", optarg, 0, INT_MAX, &exportinterval))
+							r = usage();
+						break;
+			case OPT_SERVEINTERVAL:
+						if (numopt( "serve interval", optarg, 1, INT_MAX, &serveinterval))
+							r = usage();
+						break;
+			case OPT_EVENTS:
+						eventpath = optarg;
+						break;
+			case OPT_RECORD:
+			case OPT_REPLAY:
+						if (recordpath != NULL || replaypath != NULL || devio_mode() != DEVIO_LIVE) {
+							INFO( 0, "ERROR: only one of --record and --replay possible\n");
+							r = 1;
+						} else if (c == OPT_RECORD)
+							recordpath = optarg;
+						else
+							replaypath = optarg;
+						break;
+			case OPT_REPORT:
+						reportpath = optarg;
+						break;
+			case OPT_REPORTFORMAT:
+						if ((reportformat = report_format( optarg)) < 0) {
+							INFO( 0, "ERROR: report format must be json, csv or bin\n");
+							r = 1;
+						}
+						break;
+			case OPT_LOGJSON:
+						log_setsink( LOG_SINK_JSON);
+						break;
+			case OPT_MATCH:
+						cpupbuf.pattern = optarg;
+						break;
+			case OPT_VERIFY:
+						if (!strcmp( optarg, "header"))
+							cpupbuf.verify = VERIFY_HEADER;
+						else if (!strcmp( optarg, "struct"))
+							cpupbuf.verify = VERIFY_STRUCT;
+						else if (!strcmp( optarg, "full"))
+							cpupbuf.verify = VERIFY_FULL;
+						else {
+							INFO( 0, "ERROR: verify tier must be header, struct or full\n");
+							r = 1;
+						}
+						break;
+			case OPT_VERIFYSTATE:
+						cpupbuf.verifystate = optarg;
+						break;
+			case OPT_LASTCORES:
+						if (cpu_parsecpulist( optarg, cpupbuf.lastcores)) {
+							INFO( 0, "ERROR: invalid cpu list %s\n", optarg);
+							r = 1;
+						}
+						break;
+			default:	r = usage();
+						break;
 		}
 	}
+	if (!r && (recordpath != NULL || replaypath != NULL)) {
+		r = (recordpath != NULL) ? devio_record( recordpath) : devio_replay( replaypath);
+		tracing = !r;
+	}
+	if (!r && reportpath != NULL && (cpupbuf.report = report_open( reportpath, reportformat)) == NULL)
+		r = 1;
 	if (!r) switch (cmd) {
 		case 'V':	INFO( 0, "%s Version %s\n", pgmn, CPUPDATE_VERSION);
 					break;
-		case 'i':	numCores = cpu_getCoreNum();
-					if (numCores < 1) {
+		case 'i':	cpupbuf.numcores = getcorenum();
+					if (cpupbuf.numcores < 1) {
 						INFO( 0, "Failed to determine number of cores. Did you do 'kldload cpuctl'?\n");
 						r = 1;
 						break;
@@ -329,46 +979,26 @@ main( int argc, char *argv[])
 							r = 1;
 							break;
 					}
-					handler = handlers[ vendormode];
+					handler = cpu_handlers[ vendormode];
 					if (cmd == 'f') {
+						if ((r = unpack_file( &cpupbuf)))
+							break;
 						handler->loadcheckmicrocode( &cpupbuf);
 						handler->printmicrocodestats( &cpupbuf);
+						handler->freeucodeinfo( &cpupbuf);
 						break;
 					} else if (cmd == 'c' || cmd == 'd') {
-						DIR *dirp;
-						struct dirent *direntry;
-						char fpath[ MAXPATHLEN];
-						
-						dirp = opendir( data);
-						if (dirp == NULL) {
-							INFO( 0, "Failed to access directory %s\n", data);
-						} else {
-							while ((direntry = readdir( dirp)) != NULL) {
-								if (direntry->d_namlen == 0 ||
-										strcmp( direntry->d_name, ".") == 0 ||
-										strcmp( direntry->d_name, "..") == 0)
-									continue;
-								if (snprintf( fpath, sizeof( fpath), "%s/%s", data, direntry->d_name) >= (signed int) sizeof( fpath)) {
-									INFO( 0, "skipping %s, filename buffer too short\n", direntry->d_name);
-									continue;
-								}
-								if (isdir( fpath) != 0) {
-									INFO( 0, "skipping %s: is a directory\n", fpath);
-									continue;
-								}
-								if (strlen( data) < MAXPATHLEN) {
-									strcpy( (char *) &cpupbuf.filepath, fpath);
-									handler->loadcheckmicrocode( &cpupbuf);
-									if (cmd == 'd') {
-										handler->printmicrocodestats( &cpupbuf);
-									}
-									handler->freeucodeinfo( &cpupbuf);
-//									handler->verifyUpdF( fpath, direntry->d_name);
-								} else {
-									INFO( 0, "ERROR: Path too long\n");
-								}
-							}
+						struct stat st;
+
+						// the tiers and the state apply to directory trees, archives are checked fully
+						if ((cpupbuf.verify == VERIFY_FULL && cpupbuf.verifystate == NULL) ||
+								stat( data, &st) < 0 || !S_ISDIR( st.st_mode)) {
+							unpack_tree( &cpupbuf, data, cpupbuf.pattern, scan_check, &cmd);
+							break;
 						}
+						strcpy( cpupbuf.srcdir, data);
+						cpupbuf.verifylist = (cmd == 'd');
+						r = handler->verifytree( &cpupbuf);
 					}
 					break;
 		case 'C':	// compact single-blobbed files to new multi-blobbed files or...
@@ -383,7 +1013,7 @@ main( int argc, char *argv[])
 						r = 1;
 						break;
 					}
-					handler = handlers[ vendormode];
+					handler = cpu_handlers[ vendormode];
 					// verify that source and target directories have been specified
 					if (!strlen( cpupbuf.srcdir) || !strlen( cpupbuf.targetdir)) {
 						INFO( 0, "Please specify both source and target directories!\n");
@@ -392,58 +1022,116 @@ main( int argc, char *argv[])
 					}
 					// walk thru all files in source dir, load every file, and if valid, 
 					// then write every blob contained to a files of ff-mm-ss-flags filename format
-					DIR *dirp;
-					struct dirent *direntry;
-					char fpath[ MAXPATHLEN];
-					
-					dirp = opendir( cpupbuf.srcdir);
-					if (dirp == NULL) {
-						INFO( 0, "Failed to access directory %s\n", cpupbuf.srcdir);
-					} else {
-						while ((direntry = readdir( dirp)) != NULL) {
-							if (direntry->d_namlen == 0 ||
-									strcmp( direntry->d_name, ".") == 0 ||
-									strcmp( direntry->d_name, "..") == 0)
-								continue;
-							if (snprintf( fpath, sizeof( fpath), "%s/%s", cpupbuf.srcdir, direntry->d_name) >= (signed int) sizeof( fpath)) {
-								INFO( 0, "skipping %s, filename buffer too short\n", direntry->d_name);
-								continue;
-							}
-							if (isdir( fpath) != 0) {
-								INFO( 0, "skipping %s: is a directory\n", fpath);
-								continue;
-							}
-							if (strlen( fpath) < MAXPATHLEN) {
-								strcpy( (char *) &cpupbuf.filepath, fpath);
-								r = handler->loadcheckmicrocode( &cpupbuf);
-								if (r) {
-									INFO( 0, "Error with microcode file %s, skipping that file\n", fpath);
-								} else {
-									if (cmd == 'X') {
-										if (handler->extractformat( &cpupbuf)) {
-											INFO( 0, "ERROR: Error while extracting microcode file %s\n", fpath);
-											r = 1;
-											break;
-										}
-									} else {
-									  // (cmd == 'C')
-										if (handler->compactformat( &cpupbuf)) {
-											INFO( 0, "ERROR: Error while compacting microcode file %s\n", fpath);
-											r = 1;
-											break;
-										}
-									}
-								}
-								handler->freeucodeinfo( &cpupbuf);
-							} else {
-								INFO( 0, "ERROR: Path too long\n");
-							}
+					gen_resolve( cpupbuf.srcdir);
+					r = generations ? generation( cmd) : convert( cmd);
+					break;
+		case OPT_PACK:
+					if (vendormode != VENDOR_INDEX_INTEL) {
+						INFO( 0, "Sorry, packing currently only supports Intel microcode files\n");
+						r = 1;
+						break;
+					}
+					handler = cpu_handlers[ vendormode];
+					if (!strlen( cpupbuf.srcdir)) {
+						INFO( 0, "Please specify the source directory!\n");
+						r = 1;
+						break;
+					}
+					r = handler->pack( &cpupbuf);
+					break;
+		case OPT_PRUNE:
+					if (vendormode != VENDOR_INDEX_INTEL) {
+						INFO( 0, "Sorry, pruning currently only supports Intel microcode files\n");
+						r = 1;
+						break;
+					}
+					handler = cpu_handlers[ vendormode];
+					if (generations && cpupbuf.writeit)
+						r = generation( cmd);
+					else {
+						gen_resolve( cpupbuf.srcdir);
+						r = handler->prune( &cpupbuf);
+					}
+					if (!cpupbuf.writeit)
+						INFO( 10, "ATTENTION NOTICE: -w option missing! Nothing removed, only dry run done!.\n");
+					break;
+		case OPT_SYNC:
+					if (vendormode != VENDOR_INDEX_INTEL) {
+						INFO( 0, "Sorry, syncing currently only supports Intel multi-blobbed format\n");
+						r = 1;
+						break;
+					}
+					handler = cpu_handlers[ vendormode];
+					if (!strlen( cpupbuf.srcdir) || !strlen( cpupbuf.targetdir)) {
+						INFO( 0, "Please specify both source and target directories!\n");
+						r = 1;
+						break;
+					}
+					gen_resolve( cpupbuf.srcdir);
+					if (generations && cpupbuf.writeit)
+						r = generation( cmd);
+					else {
+						gen_resolve( cpupbuf.targetdir);
+						r = handler->sync( &cpupbuf);
+					}
+					if (!cpupbuf.writeit)
+						INFO( 10, "ATTENTION NOTICE: -w option missing! Nothing written, only dry run done!.\n");
+					break;
+		case OPT_SCANIMAGE:
+					if (vendormode != VENDOR_INDEX_INTEL) {
+						INFO( 0, "Sorry, scanning firmware images currently only supports Intel microcode\n");
+						r = 1;
+						break;
+					}
+					handler = cpu_handlers[ vendormode];
+					r = handler->scanimage( &cpupbuf);
+					break;
+		case OPT_EARLYCPIO:
+					if (cpupbuf.ntargets == 0) {
+						// the local CPUs
+						cpupbuf.numcores = getcorenum();
+						if (cpupbuf.numcores < 1) {
+							INFO( 0, "Failed to determine number of cores. Did you do 'kldload cpuctl'?\n");
+							r = 1;
+							break;
 						}
+						if (cpu_setHandler() < 0) {
+							INFO( 10, "Sorry! This CPU brand is unsupported.\n");
+							r = 1;
+							break;
+						}
+					} else if (vendormode < 0) {
+						INFO( 0, "ERROR: vendor mode option missing\n");
+						r = 1;
+						break;
+					} else
+						handler = cpu_handlers[ vendormode];
+					if (handler != cpu_handlers[ VENDOR_INDEX_INTEL]) {
+						INFO( 0, "Sorry, early load archives currently only support Intel microcode\n");
+						r = 1;
+						break;
 					}
+					setrepodefaults( handler->getvendorname());
+					r = handler->earlycpio( &cpupbuf);
+					break;
+		case OPT_EXPORT:
+					r = export();
+					break;
+		case OPT_SERVE:
+					if (vendormode != VENDOR_INDEX_INTEL) {
+						INFO( 0, "Sorry, serving currently only supports Intel microcode files\n");
+						r = 1;
+						break;
+					}
+					handler = cpu_handlers[ vendormode];
+					setrepodefaults( handler->getvendorname());
+					r = serve_run( handler, &cpupbuf, servepath, serveinterval);
 					break;
 		case 'U':	
-		case 'u': 	numCores = cpu_getCoreNum();
-					if (numCores < 1) {
+		case 'u': 	
+		case OPT_WATCH:
+					cpupbuf.numcores = getcorenum();
+					if (cpupbuf.numcores < 1) {
 						INFO( 0, "Failed to determine number of cores. Did you do 'kldload cpuctl'?\n");
 						r = -1;
 						break;
@@ -454,53 +1142,62 @@ main( int argc, char *argv[])
 						break;
 					}
 					INFO( 10, "Found CPU(s) from %s\n", handler->getvendorname());
-					if (cmd == 'u') {
-						if (!strlen( cpupbuf.primdir))
-							strcpy( cpupbuf.primdir, MICROCODE_REPO_PATH_PRIM);
-						if (!strlen( cpupbuf.secdir))
-							strcpy( cpupbuf.secdir, MICROCODE_REPO_PATH_SEC);
-						strcat( cpupbuf.primdir, "/");
-						strcat( cpupbuf.secdir, "/");
-						strcat( cpupbuf.primdir, handler->getvendorname());
-						strcat( cpupbuf.secdir, handler->getvendorname());
+					if (cmd == 'u' || cmd == OPT_WATCH) {
+						setrepodefaults( handler->getvendorname());
+						r = loadrepo();
+					} else if (!(r = unpack_file( &cpupbuf))) {
+						// -U: the given file for all cores
 						r = handler->loadcheckmicrocode( &cpupbuf);
-					} 
-					if (!r)
+					}
+					if (!r) {
 						r = handler->update( &cpupbuf);
+						cpu_printupdtimes( &cpupbuf);
+					}
 	// this #ifdef is for updating microcode on older FreeBSD versions
 	// which do not have the CPUCTL_EVAL_CPU_FEATURES feature
 #ifdef CPUCTL_EVAL_CPU_FEATURES
 					if (!r) {
-						INFO( 10, "No updating error. Registering CPU features\n");
-						for ( int i = 0; i < numCores; ++i) {
-							char cpupath[ MAXPATHLEN];
-							sprintf( cpupath, "/dev/cpuctl%d", i);
-							r = do_eval_cpu_features( cpupath);
-							r = (r < 0) ? 1 : 0;   // error if negative
-							if (r) {
-								INFO( 0, "Failed to register core %d features\n", i);
-								r = -1;
-								break;
-							}
+						if (cpupbuf.nchanged == 0) {
+							INFO( 10, "No updating error. No core changed its revision, CPU features unchanged\n");
+						} else {
+							INFO( 10, "No updating error. Registering CPU features of %d updated cores\n", cpupbuf.nchanged);
+							r = cpu_evalfeatures( &cpupbuf);
+							if (!r)
+								INFO( 10, "Successfully registered new CPU features\n");
 						}
-						if (!r)
-							INFO( 10, "Successfully registered new CPU features\n");
-						handler->freeucodeinfo( &cpupbuf);
 					}
 #else
 					if (!r) {
 						INFO( 10, "No updating error.\n");
 						INFO( 10, "NOTICE: This FreeBSD version does not support registering new CPU features!\n");
-						handler->freeucodeinfo( &cpupbuf);
 					}
 #endif
+					// keep the loaded files for reapplying them on events
+					if (!r && cmd == OPT_WATCH)
+						r = watch_run( handler, &cpupbuf, eventpath);
+					unloadrepo();
 					if (!cpupbuf.writeit) {
 						INFO( 10, "ATTENTION NOTICE: -w option missing! No actual update, only dry run done!.\n");
 					}
 					break;
+		case OPT_BATCH:
+					if (inbatch) {
+						INFO( 0, "ERROR: --batch is not possible within a batch\n");
+						r = 1;
+						break;
+					}
+					r = batch( batchpath);
+					break;
 		case 'h': 
-		default :	usage();
-					// NOTREACHED
+		default :	r = usage();
+					break;
 	}
+	// repository files kept for the batch may be stale once a repository has been written
+	if (cmd == 'C' || cmd == 'X' || cmd == OPT_PACK || cmd == OPT_PRUNE || cmd == OPT_SYNC || cmd == OPT_SCANIMAGE)
+		forgetrepo();
+	if (tracing && devio_finish())
+		r = 1;
+	if (report_close( cpupbuf.report))
+		r = 1;
 	return r;
 }
@@ -29,14 +29,41 @@
 #define	CPUPDATE_H
 #define CPUPDATE_VERSION ("1.0.0")
 
+#include "libcpupdate.h"
+#include "log.h"
+
+#define MAXVENDORNAMELEN 100
+#define MAXCORES 257
+#define MAXHEADERS 8
+/* 8 chars for yyyy/mm/dd + \0 */
+#define DATELEN 11
+#define MAXPINS 64
+
+// validation tiers of the blobs checked by -c and -d, each includes the ones before
+#define VERIFY_HEADER	1		// header only: versions, blob within the file
+#define VERIFY_STRUCT	2		// sizes and extended signature table, the payload is not read
+#define VERIFY_FULL		3		// checksums, the whole blob is read
+
+struct owriter;
+struct report;
+
 // parameter structure with vender-unspecific parameters
 struct cpupdate_params {
 	// pointer to vendor-specific cpusinfo structs array, set to NULL if not there/not inited
 	void   *coreinfop;
 	// pointer to vendor-specific ucode file struct, set to NULL if not there/not inited
 	void   *ucodeinfop;
+	int		numcores;				// number of present cores, set before probing
 	// set by commandline. used for loadcheckmicrocodefile, else use file_data::fname created by vendor_probe
 	char 	filepath[  MAXPATHLEN];
+	// if filename is set, the file is opened as filename relative to the directory descriptor
+	// filedirfd (set by the repository scanner), filepath is used for messages only then
+	int		filedirfd;
+	const char *filename;
+	// if fileimage is set, it is the content of filepath, already read (by the batched loader).
+	// loadcheckmicrocode takes the malloc()ed buffer over and sets fileimage to NULL
+	void   *fileimage;
+	size_t	fileimagesize;
 	// used for loadcheckmicrocodefile, primary path (user supplied microcodes from vendor library)
 	char 	primdir[   MAXPATHLEN];
 	// used for primary path (OS supplied microcodes from platomav collection)
@@ -44,11 +71,57 @@ struct cpupdate_params {
 	// used for generate, checkstats
 	char 	srcdir[    MAXPATHLEN];
 	char 	targetdir[ MAXPATHLEN]; // used for  generate
+	// output writer of extractformat and compactformat, see owrite.h. if NULL, each file is written at once
+	struct owriter *out;
+	// packed repository container: written by pack, used by loadcheckmicrocode before prim/secdir if set
+	char	packpath[  MAXPATHLEN];
+	int		packcompress;			// bool flag: compress blobs when packing
+	const char *pattern;			// file name pattern for the repository scans, NULL for all files
+	// if set, printcpustats, printmicrocodestats and verifytree write rows to this report
+	// instead of the text messages, see report.h
+	struct report *report;
+	// verifytree: tier to validate the blobs of srcdir to, list them if verifylist is set, and
+	// the verification state file recording the tiers reached (NULL for none), see vstate.h
+	int		verify;
+	int		verifylist;
+	const char *verifystate;
+	// prune: number of newest revisions to keep per signature and flags, and pinned revisions to keep
+	int		prunekeep;
+	int		npins;
+	uint32_t pinsig[ MAXPINS];
+	int32_t	pinrev[ MAXPINS];
+	// early load archive: output path, and the signatures and platform flags to include.
+	// without targets, the probed cores are used
+	char	cpiopath[ MAXPATHLEN];
+	int		ntargets;
+	uint32_t targetsig[ MAXCORES];
+	uint32_t targetflags[ MAXCORES];
 	int		writeit;				// bool flag: if nonzero, do actual uploading and not simulate
+	// rolling update mode: update cores in batches of batchsize, pausing batchpause ms in between.
+	// batchsize 0 means all cores back to back (default)
+	int		batchsize;
+	int		batchpause;
+	char	lastcores[ MAXCORES];	// bool per core: core is in the exclusion set and gets updated last
+	// if nselcores is nonzero, update walks only the nselcores cores set in selcores
+	int		nselcores;
+	char	selcores[ MAXCORES];
+	// durations of the CPUCTL_UPDATE calls done, in nanoseconds: in call order, and per core
+	int		nupdtimes;
+	uint64_t updtimes[ MAXCORES];
+	uint64_t updns[ MAXCORES];
+	// change set filled by update: bool per core, set if the core moved to a new revision
+	int		nchanged;
+	char	changed[ MAXCORES];
+	char	updfailed[ MAXCORES];	// bool per core, set by update if updating the core failed
+	// /dev/cpuctlN descriptors kept open for polling by refreshrevs, see cpu_opencorefds()
+	int		ncorefds;
+	int		corefds[ MAXCORES];
 };
 
 typedef int (*hnd_f)( struct cpupdate_params *);
 typedef const char * (*hnd_n)( void);
+typedef int (*hnd_c)( struct cpupdate_params *, struct cpup_coreinfo *, int);
+typedef int (*hnd_b)( struct cpupdate_params *, struct cpup_blobinfo *, int);
 
 struct vendor_funcs {
 	hnd_f	probe,					// gets cpus stats, inits data structure if matches
@@ -58,8 +131,17 @@ struct vendor_funcs {
 			update,					// updates processor(s). probe and loadcheckmicrocode must have been done before
 			freeucodeinfo,			// frees ucode info (for loading another microcode file)
 			extractformat,			// extract multi-blobbed files to single blobs
-			compactformat;			// convert/compact single blobs to multi-blobbed files
+			compactformat,			// convert/compact single blobs to multi-blobbed files
+			pack;					// write all blobs found in srcdir to the container params->packpath
 	hnd_n	getvendorname;			// return VENDORNAME string (see macros below)
+	hnd_c	getcores;				// fills up to max core infos, returns their number. probe must have been done before
+	hnd_b	getblobs;				// fills up to max blob infos of the loaded file(s), returns the number of blobs
+	hnd_f	refreshrevs;			// re-reads only the cores' microcode revisions. probe must have been done before
+	hnd_f	prune;					// removes superseded blobs from the repository in srcdir
+	hnd_f	earlycpio;				// writes the blobs for the targets as early load cpio to cpiopath
+	hnd_f	sync;					// brings the multi-blobbed repository in targetdir up to the blobs in srcdir
+	hnd_f	scanimage;				// lists the blobs embedded in the firmware image filepath, extracts them to targetdir if set
+	hnd_f	verifytree;				// validates the blobs of the files in srcdir to the tier verify
 };
 
 // the vendor names are also used as directory paths for microcode subdirectories
@@ -68,19 +150,27 @@ struct vendor_funcs {
 #define VENDORNAME_VIA ("VIA")
 #define MICROCODE_REPO_PATH_PRIM ("/usr/local/share/cpupdate/CPUMicrocodes/primary")
 #define MICROCODE_REPO_PATH_SEC ("/usr/local/share/cpupdate/CPUMicrocodes/secondary")
+// default container, <path>/<vendorname>.pack
+#define MICROCODE_REPO_PATH_PACK ("/usr/local/share/cpupdate/CPUMicrocodes/packed")
 
-extern int  vendormode;
-extern int	verbosity;				// spamminess level
-extern int	numCores;				// number of present cores
-extern char *pgmn;			// program name for messages
+#define VENDOR_INDEX_INTEL CPUP_VENDOR_INTEL
+#define VENDOR_INDEX_AMD   CPUP_VENDOR_AMD
+#define VENDOR_INDEX_VIA   CPUP_VENDOR_VIA
 
-#define INFO(level, ...) if ((level) <= verbosity) printf(__VA_ARGS__); 
-#define NHANDLERS (sizeof(handlers) / sizeof(*handlers))
+// vendor handlers, indexed by VENDOR_INDEX_*
+extern struct vendor_funcs *const cpu_handlers[];
+extern const int cpu_nhandlers;
 
-#define MAXVENDORNAMELEN 100
-#define MAXCORES 257
-#define MAXHEADERS 8
-/* 8 chars for yyyy/mm/dd + \0 */
-#define DATELEN 11
+// vendor-unspecific helpers, see libcpupdate.c
+int		 cpu_parsecpulist( const char *list, char *set);
+int		 cpu_updateorder( struct cpupdate_params *params, int *order);
+uint64_t cpu_nsecs( void);
+void	 cpu_addupdtime( struct cpupdate_params *params, int core, uint64_t ns);
+void	 cpu_batchpause( struct cpupdate_params *params, int updated, int more);
+void	 cpu_printupdtimes( struct cpupdate_params *params);
+void	 cpu_setchanged( struct cpupdate_params *params, int core);
+int		 cpu_evalfeatures( struct cpupdate_params *params);
+int		 cpu_opencorefds( struct cpupdate_params *params);
+void	 cpu_closecorefds( struct cpupdate_params *params);
 
 #endif /* !CPUPDATE_H */
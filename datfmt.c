@@ -0,0 +1,181 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/param.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "cpupdate.h"
+#include "datfmt.h"
+
+static int hexval( int c);
+static int dat_hex8( const char *p, uint32_t *out);
+
+
+static int
+hexval( int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+
+/* decodes the 8 hex digits at p into *out.
+ * returns 0, or -1 if any of the 8 chars is no hex digit
+ */
+#if defined(__SSE2__)
+static int
+dat_hex8( const char *p, uint32_t *out)
+{
+	__m128i c = _mm_loadl_epi64( (const __m128i *) p);
+	__m128i l = _mm_or_si128( c, _mm_set1_epi8( 0x20));		// letters folded to lower case
+	__m128i isdig = _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( '0' - 1)),
+								   _mm_cmplt_epi8( c, _mm_set1_epi8( '9' + 1)));
+	__m128i isalp = _mm_and_si128( _mm_cmpgt_epi8( l, _mm_set1_epi8( 'a' - 1)),
+								   _mm_cmplt_epi8( l, _mm_set1_epi8( 'f' + 1)));
+	__m128i v, w;
+
+	if ((_mm_movemask_epi8( _mm_or_si128( isdig, isalp)) & 0xff) != 0xff)
+		return -1;
+	// nibble values 0..15 per byte
+	v = _mm_or_si128( _mm_and_si128( isdig, _mm_sub_epi8( c, _mm_set1_epi8( '0'))),
+					  _mm_and_si128( isalp, _mm_sub_epi8( l, _mm_set1_epi8( 'a' - 10))));
+	// each 16 bit lane holds a digit pair, the more significant digit in the low byte
+	w = _mm_or_si128( _mm_slli_epi16( _mm_and_si128( v, _mm_set1_epi16( 0x00ff)), 4),
+					  _mm_srli_epi16( v, 8));
+	w = _mm_packus_epi16( w, w);
+	// the first byte is the most significant one
+	*out = __builtin_bswap32( (uint32_t) _mm_cvtsi128_si32( w));
+	return 0;
+}
+#else
+static int
+dat_hex8( const char *p, uint32_t *out)
+{
+	uint32_t v = 0;
+	int d;
+
+	for (int i = 0; i < 8; ++i) {
+		if ((d = hexval( p[ i])) < 0)
+			return -1;
+		v = (v << 4) | d;
+	}
+	*out = v;
+	return 0;
+}
+#endif
+
+
+// a file is taken as text format if it starts with a hex number or comment
+int
+dat_istext( const void *image, size_t size)
+{
+	const char *p = image, *end = p + size;
+
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		++p;
+	if (end - p < 2)
+		return 0;
+	return (p[ 0] == '0' && (p[ 1] | 0x20) == 'x') || (p[ 0] == '/' && (p[ 1] == '*' || p[ 1] == '/'));
+}
+
+
+/* decodes the text into a malloc'ed array of dwords.
+ * the common case of exactly 8 digits per number goes thru dat_hex8(), anything else
+ * is decoded one digit at a time
+ */
+int
+dat_decode( const char *text, size_t len, uint32_t **words, size_t *nwords, const char *filename)
+{
+	const char *p = text, *end = text + len;
+	uint32_t   *w;
+	size_t		n = 0, max;
+	int			line = 1;
+	uint64_t	t0 = cpu_nsecs();
+
+	// every number takes at least "0x0," 
+	max = len / 4 + 1;
+	if ((w = malloc( max * sizeof( *w))) == NULL) {
+		INFO( 0, "Buffer allocation of %zu bytes failed\n", max * sizeof( *w));
+		return 1;
+	}
+	while (p < end) {
+		if (*p == '\n') {
+			++line;
+			++p;
+		} else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == ',') {
+			++p;
+		} else if (end - p >= 2 && p[ 0] == '/' && p[ 1] == '*') {
+			for (p += 2; end - p >= 2 && !(p[ 0] == '*' && p[ 1] == '/'); ++p)
+				if (*p == '\n')
+					++line;
+			if (end - p < 2)
+				break;		// unterminated comment at EOF
+			p += 2;
+		} else if (end - p >= 2 && p[ 0] == '/' && p[ 1] == '/') {
+			while (p < end && *p != '\n')
+				++p;
+		} else if (end - p >= 3 && p[ 0] == '0' && (p[ 1] | 0x20) == 'x' && hexval( p[ 2]) >= 0) {
+			p += 2;
+			// the 8 byte load of dat_hex8() must stay within the buffer
+			if (end - p >= 9 && dat_hex8( p, &w[ n]) == 0 && hexval( p[ 8]) < 0) {
+				p += 8;
+			} else {
+				uint32_t v = 0;
+				int d, digits = 0;
+				for ( ; p < end && (d = hexval( *p)) >= 0; ++p, ++digits)
+					v = (v << 4) | d;
+				if (digits > 8) {
+					INFO( 0, "File %s line %d: number exceeds 32 bits\n", filename, line);
+					free( w);
+					return 1;
+				}
+				w[ n] = v;
+			}
+			++n;
+		} else {
+			INFO( 0, "File %s line %d: unexpected character '%c' in text format file\n", filename, line, *p);
+			free( w);
+			return 1;
+		}
+	}
+	*words = w;
+	*nwords = n;
+	INFO( 12, "File %s: decoded %zu dwords in %ju us\n", filename, n, (uintmax_t) (cpu_nsecs() - t0) / 1000);
+	return 0;
+}
@@ -0,0 +1,347 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <errno.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <sys/ioccom.h>
+#include <sys/stat.h>
+#include <sys/cpuctl.h>
+
+#include "cpupdate.h"
+#include "devio.h"
+
+static size_t devio_argsize( unsigned long req);
+static void devio_put( struct devio_rec *rec, const void *arg);
+static int devio_take( int dev, uint32_t req, struct devio_rec *rec, const uint8_t **arg);
+static void devio_wait( uint64_t ns);
+
+static pthread_mutex_t devio_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int		devio_curmode = DEVIO_LIVE;
+static const char *devio_path;		// of the trace
+static uint64_t	devio_t0;			// start of the recording
+static int		devio_ncalls;		// recorded or replayed
+static int		devio_fddev[ DEVIO_MAXFDS];	// core + 1 of the device open on a descriptor, 0 if none
+// recording
+static FILE	   *devio_out;
+// replay: the trace, and per core (MAXCORES for DEVIO_NODEV) the offset to look for its next record at
+static uint8_t *devio_trace;
+static size_t	devio_tracesize;
+static size_t	devio_next[ MAXCORES + 1];
+static int		devio_nrecs;
+
+
+// the argument data an ioctl returns. updates only pass a pointer to the microcode in
+static size_t
+devio_argsize( unsigned long req)
+{
+	if (!(req & IOC_OUT) || req == CPUCTL_UPDATE)
+		return 0;
+	return IOCPARM_LEN( req);
+}
+
+
+static void
+devio_put( struct devio_rec *rec, const void *arg)
+{
+	pthread_mutex_lock( &devio_mtx);
+	rec->start -= devio_t0;
+	fwrite( rec, sizeof( *rec), 1, devio_out);
+	if (rec->argsize)
+		fwrite( arg, rec->argsize, 1, devio_out);
+	++devio_ncalls;
+	pthread_mutex_unlock( &devio_mtx);
+}
+
+
+/* takes the next record of the trace for core dev, which must be a call of req.
+ * returns 0, or 1 if the trace does not match
+ */
+static int
+devio_take( int dev, uint32_t req, struct devio_rec *rec, const uint8_t **arg)
+{
+	int		slot;
+	size_t	off;
+
+	if (dev < 0 || dev >= MAXCORES)
+		dev = DEVIO_NODEV;
+	slot = (dev == DEVIO_NODEV) ? MAXCORES : dev;
+	pthread_mutex_lock( &devio_mtx);
+	for (off = devio_next[ slot]; off < devio_tracesize; off += sizeof( *rec) + rec->argsize) {
+		memcpy( rec, devio_trace + off, sizeof( *rec));
+		if (rec->dev == dev)
+			break;
+	}
+	if (off >= devio_tracesize) {
+		pthread_mutex_unlock( &devio_mtx);
+		INFO( 0, "Replay: trace %s has no more calls for core %d\n", devio_path, dev);
+		return 1;
+	}
+	if (rec->req != req) {
+		pthread_mutex_unlock( &devio_mtx);
+		INFO( 0, "Replay: call %08x for core %d, but trace %s has %08x next\n", req, dev, devio_path, rec->req);
+		return 1;
+	}
+	*arg = devio_trace + off + sizeof( *rec);
+	devio_next[ slot] = off + sizeof( *rec) + rec->argsize;
+	++devio_ncalls;
+	pthread_mutex_unlock( &devio_mtx);
+	return 0;
+}
+
+
+// takes the recorded latency of a call
+static void
+devio_wait( uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	while (nanosleep( &ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+
+// starts writing the device calls to the trace file path
+int
+devio_record( const char *path)
+{
+	struct devio_hdr hdr = { DEVIO_MAGIC, DEVIO_VERSION };
+
+	if ((devio_out = fopen( path, "w")) == NULL) {
+		INFO( 0, "could not open trace %s for writing\n", path);
+		return 1;
+	}
+	fwrite( &hdr, sizeof( hdr), 1, devio_out);
+	devio_path = path;
+	devio_ncalls = 0;
+	devio_t0 = cpu_nsecs();
+	devio_curmode = DEVIO_RECORD;
+	return 0;
+}
+
+
+// reads the trace file path, the device calls are answered from it from now on
+int
+devio_replay( const char *path)
+{
+	struct devio_hdr hdr;
+	struct devio_rec rec;
+	struct stat st;
+	size_t	off;
+	int		fd, r = 0;
+
+	if ((fd = open( path, O_RDONLY | O_CLOEXEC)) < 0) {
+		INFO( 0, "could not open trace %s\n", path);
+		return 1;
+	}
+	if (fstat( fd, &st) < 0 || (size_t) st.st_size < sizeof( hdr)) {
+		INFO( 0, "Trace %s is too short\n", path);
+		r = 1;
+	} else if ((devio_trace = malloc( st.st_size)) == NULL) {
+		INFO( 0, "Buffer allocation of %ld bytes failed\n", (long) st.st_size);
+		r = 1;
+	} else if (read( fd, devio_trace, st.st_size) != st.st_size) {
+		INFO( 0, "Reading trace %s failed\n", path);
+		r = 1;
+	}
+	close( fd);
+	if (!r) {
+		memcpy( &hdr, devio_trace, sizeof( hdr));
+		if (hdr.magic != DEVIO_MAGIC || hdr.version != DEVIO_VERSION) {
+			INFO( 0, "File %s is no trace of version %d\n", path, DEVIO_VERSION);
+			r = 1;
+		}
+	}
+	// the records must fill the file exactly
+	devio_nrecs = 0;
+	for (off = sizeof( hdr); !r && off < (size_t) st.st_size; off += sizeof( rec) + rec.argsize, ++devio_nrecs)
+		if (off + sizeof( rec) > (size_t) st.st_size || 
+				(memcpy( &rec, devio_trace + off, sizeof( rec)), off + sizeof( rec) + rec.argsize > (size_t) st.st_size)) {
+			INFO( 0, "Trace %s is truncated\n", path);
+			r = 1;
+		}
+	if (r) {
+		free( devio_trace);
+		devio_trace = NULL;
+		return r;
+	}
+	devio_tracesize = st.st_size;
+	for (int i = 0; i <= MAXCORES; ++i)
+		devio_next[ i] = sizeof( hdr);
+	INFO( 11, "Replaying %d device calls from %s\n", devio_nrecs, path);
+	devio_path = path;
+	devio_ncalls = 0;
+	devio_curmode = DEVIO_REPLAY;
+	return 0;
+}
+
+
+// ends recording or replay
+int
+devio_finish( void)
+{
+	int r = 0;
+
+	if (devio_curmode == DEVIO_RECORD) {
+		if (fclose( devio_out) != 0) {
+			INFO( 0, "error writing trace %s\n", devio_path);
+			r = 1;
+		} else
+			INFO( 11, "Recorded %d device calls to %s\n", devio_ncalls, devio_path);
+		devio_out = NULL;
+	} else if (devio_curmode == DEVIO_REPLAY) {
+		INFO( 11, "Replayed %d of the %d device calls of %s\n", devio_ncalls, devio_nrecs, devio_path);
+		free( devio_trace);
+		devio_trace = NULL;
+	}
+	devio_curmode = DEVIO_LIVE;
+	return r;
+}
+
+
+int
+devio_mode( void)
+{
+	return devio_curmode;
+}
+
+
+// records the number of cores n, or returns the recorded one when replaying
+int
+devio_corenum( int n)
+{
+	struct devio_rec rec;
+	const uint8_t *arg;
+
+	if (devio_curmode == DEVIO_REPLAY)
+		return devio_take( DEVIO_NODEV, DEVIO_CORENUM, &rec, &arg) ? -1 : rec.result;
+	if (devio_curmode == DEVIO_RECORD) {
+		memset( &rec, 0, sizeof( rec));
+		rec.req = DEVIO_CORENUM;
+		rec.result = n;
+		rec.dev = DEVIO_NODEV;
+		rec.start = cpu_nsecs();
+		devio_put( &rec, NULL);
+	}
+	return n;
+}
+
+
+// opens /dev/cpuctl<core>
+int
+devio_open( int core, int flags)
+{
+	struct devio_rec rec;
+	const uint8_t *arg;
+	char	dev[ 32];
+	int		fd, err;
+
+	if (devio_curmode == DEVIO_REPLAY) {
+		if (devio_take( core, DEVIO_OPEN, &rec, &arg)) {
+			errno = EIO;
+			return -1;
+		}
+		devio_wait( rec.ns);
+		if (rec.result < 0) {
+			errno = rec.err;
+			return -1;
+		}
+		// a descriptor of our own, to be closed as usual
+		fd = open( _PATH_DEVNULL, O_RDONLY | O_CLOEXEC);
+	} else {
+		snprintf( dev, sizeof( dev), "/dev/cpuctl%d", core);
+		memset( &rec, 0, sizeof( rec));
+		rec.start = cpu_nsecs();
+		fd = open( dev, flags);
+		if (devio_curmode == DEVIO_RECORD) {
+			err = errno;
+			rec.ns = cpu_nsecs() - rec.start;
+			rec.req = DEVIO_OPEN;
+			rec.result = (fd < 0) ? -1 : 0;
+			rec.err = (fd < 0) ? err : 0;
+			rec.dev = core;
+			devio_put( &rec, NULL);
+			errno = err;
+		}
+	}
+	if (fd >= 0 && fd < DEVIO_MAXFDS)
+		devio_fddev[ fd] = core + 1;
+	return fd;
+}
+
+
+// ioctl on a descriptor from devio_open()
+int
+devio_ioctl( int fd, unsigned long req, void *arg)
+{
+	struct devio_rec rec;
+	const uint8_t *data;
+	size_t	argsize;
+	int		dev, r, err;
+
+	if (devio_curmode == DEVIO_LIVE)
+		return ioctl( fd, req, arg);
+	dev = (fd >= 0 && fd < DEVIO_MAXFDS && devio_fddev[ fd]) ? devio_fddev[ fd] - 1 : DEVIO_NODEV;
+	argsize = devio_argsize( req);
+	if (devio_curmode == DEVIO_REPLAY) {
+		if (devio_take( dev, req, &rec, &data)) {
+			errno = EIO;
+			return -1;
+		}
+		devio_wait( rec.ns);
+		if (argsize && rec.argsize == argsize)
+			memcpy( arg, data, argsize);
+		if (rec.result < 0)
+			errno = rec.err;
+		return rec.result;
+	}
+	memset( &rec, 0, sizeof( rec));
+	rec.start = cpu_nsecs();
+	r = ioctl( fd, req, arg);
+	err = errno;
+	rec.ns = cpu_nsecs() - rec.start;
+	rec.req = req;
+	rec.result = r;
+	rec.err = (r < 0) ? err : 0;
+	rec.dev = dev;
+	rec.argsize = (r < 0) ? 0 : argsize;
+	devio_put( &rec, arg);
+	errno = err;
+	return r;
+}
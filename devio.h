@@ -0,0 +1,76 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DEVIO_H
+#define	DEVIO_H
+
+/* Access to the cpuctl devices, with recording and replay.
+ * All opens of /dev/cpuctlN and all ioctls on them go through devio_open() and
+ * devio_ioctl(). Normally these are just open() and ioctl(). After devio_record(),
+ * every call is also written to a trace: request, argument data returned, result,
+ * errno, start time and latency. After devio_replay() the devices are not touched at
+ * all, the calls are answered from a trace instead, each after its recorded latency.
+ * Calls are matched per core in order, so traces of threaded code replay as well.
+ */
+
+#define DEVIO_MAGIC		0x54434344		// "DCCT"
+#define DEVIO_VERSION	1
+
+// pseudo requests
+#define DEVIO_OPEN		0				// opening the device, result is 0 or -1
+#define DEVIO_CORENUM	1				// number of cores, result is the number
+
+#define DEVIO_NODEV		0xffff			// dev of records not for a core
+#define DEVIO_MAXFDS	1024			// descriptors mapped to their core
+
+// the modes
+#define DEVIO_LIVE		0
+#define DEVIO_RECORD	1
+#define DEVIO_REPLAY	2
+
+// trace file: struct devio_hdr, then the records, each followed by argsize bytes
+struct devio_hdr {
+	uint32_t	magic;
+	uint32_t	version;
+};
+
+struct devio_rec {
+	uint32_t	req;			// ioctl request, or a pseudo request
+	int32_t		result;
+	int32_t		err;			// errno if result < 0
+	uint16_t	dev;			// core number
+	uint16_t	argsize;		// argument data after the call, for requests returning data
+	uint64_t	start;			// ns since the trace was started
+	uint64_t	ns;				// latency
+};
+
+int  devio_record( const char *path);
+int  devio_replay( const char *path);
+int  devio_finish( void);
+int  devio_mode( void);
+int  devio_corenum( int n);
+int  devio_open( int core, int flags);
+int  devio_ioctl( int fd, unsigned long req, void *arg);
+
+#endif /* !DEVIO_H */
@@ -0,0 +1,193 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "cpupdate.h"
+#include "export.h"
+
+// latencies of the last poll, in nanoseconds
+struct export_times {
+	uint64_t	probe;			// full probe, done once
+	uint64_t	refresh;		// revision refresh
+	uint64_t	repo;			// repository lookup
+};
+
+static uint32_t export_bestrev( struct cpup_coreinfo *core, struct cpup_blobinfo *blobs, int nblobs);
+static int export_write( const char *path, const char *vendor, struct cpup_coreinfo *cores, int ncores,
+			struct cpup_blobinfo *blobs, int nblobs, struct export_times *times);
+
+
+// the newest revision in blobs applying to core, 0 if none
+static uint32_t
+export_bestrev( struct cpup_coreinfo *core, struct cpup_blobinfo *blobs, int nblobs)
+{
+	uint32_t best = 0;
+
+	for (int i = 0; i < nblobs; ++i)
+		if (blobs[ i].signature == core->signature && (blobs[ i].flags & core->platformflags) &&
+				(uint32_t) blobs[ i].revision > best)
+			best = blobs[ i].revision;
+	return best;
+}
+
+
+/* writes the metrics to a temporary file next to path and renames it over path,
+ * so the collector never sees a partial file. the temporary name does not end in
+ * .prom, so the collector ignores it
+ */
+static int
+export_write( const char *path, const char *vendor, struct cpup_coreinfo *cores, int ncores,
+			struct cpup_blobinfo *blobs, int nblobs, struct export_times *times)
+{
+	char	tmppath[ MAXPATHLEN];
+	FILE   *f;
+	int		fd, i, r = 0;
+
+	if (snprintf( tmppath, sizeof( tmppath), "%s.XXXXXX", path) >= sizeof( tmppath)) {
+		INFO( 0, "ERROR: Path too long\n");
+		return 1;
+	}
+	if ((fd = mkstemp( tmppath)) < 0) {
+		INFO( 0, "Could not create %s\n", tmppath);
+		return 1;
+	}
+	fchmod( fd, 0644);
+	if ((f = fdopen( fd, "w")) == NULL) {
+		close( fd);
+		unlink( tmppath);
+		return 1;
+	}
+	fprintf( f, "# HELP cpupdate_microcode_revision Microcode revision loaded on the core.\n"
+				"# TYPE cpupdate_microcode_revision gauge\n");
+	for (i = 0; i < ncores; ++i)
+		fprintf( f, "cpupdate_microcode_revision{core=\"%d\",vendor=\"%s\",signature=\"0x%08x\",platform=\"0x%02x\"} %u\n",
+				cores[ i].core, vendor, cores[ i].signature, cores[ i].platformflags, (uint32_t) cores[ i].revision);
+	fprintf( f, "# HELP cpupdate_repo_revision Newest microcode revision for the core in the repository, 0 if none.\n"
+				"# TYPE cpupdate_repo_revision gauge\n");
+	for (i = 0; i < ncores; ++i)
+		fprintf( f, "cpupdate_repo_revision{core=\"%d\"} %u\n",
+				cores[ i].core, export_bestrev( &cores[ i], blobs, nblobs));
+	fprintf( f, "# HELP cpupdate_update_available Whether the repository has a newer revision for the core.\n"
+				"# TYPE cpupdate_update_available gauge\n");
+	for (i = 0; i < ncores; ++i)
+		fprintf( f, "cpupdate_update_available{core=\"%d\"} %d\n",
+				cores[ i].core, export_bestrev( &cores[ i], blobs, nblobs) > (uint32_t) cores[ i].revision);
+	fprintf( f, "# HELP cpupdate_probe_duration_seconds Duration of the phases of the last poll.\n"
+				"# TYPE cpupdate_probe_duration_seconds gauge\n"
+				"cpupdate_probe_duration_seconds{phase=\"probe\"} %.9f\n"
+				"cpupdate_probe_duration_seconds{phase=\"refresh\"} %.9f\n"
+				"cpupdate_probe_duration_seconds{phase=\"repo\"} %.9f\n",
+				times->probe / 1e9, times->refresh / 1e9, times->repo / 1e9);
+	fprintf( f, "# HELP cpupdate_last_poll_timestamp_seconds Time of the last poll.\n"
+				"# TYPE cpupdate_last_poll_timestamp_seconds gauge\n"
+				"cpupdate_last_poll_timestamp_seconds %jd\n", (intmax_t) time( NULL));
+	if (fflush( f) || ferror( f)) {
+		INFO( 0, "Error writing %s\n", tmppath);
+		r = 1;
+	}
+	fclose( f);
+	if (!r && rename( tmppath, path)) {
+		INFO( 0, "Could not rename %s to %s\n", tmppath, path);
+		r = 1;
+	}
+	if (r)
+		unlink( tmppath);
+	return r;
+}
+
+
+/* polls the cores of ctx and writes the textfile path, every interval seconds,
+ * or only once if interval is 0. ctx must have been probed (taking probens) and
+ * have its repository set
+ */
+int
+export_run( struct cpup_ctx *ctx, const char *path, int interval, uint64_t probens)
+{
+	struct cpup_coreinfo *cores = NULL;
+	struct cpup_blobinfo  blobs[ EXPORT_MAXBLOBS];
+	struct export_times	  times = { probens, 0, 0 };
+	uint64_t t;
+	int		 ncores, nblobs, probed = 1, fresh = 1, r = 0;
+
+	if ((ncores = cpup_getcores( ctx, NULL, 0)) < 1 ||
+			(cores = calloc( ncores, sizeof( *cores))) == NULL) {
+		INFO( 0, "Could not allocate core infos!\n");
+		return 1;
+	}
+	for (;;) {
+		t = cpu_nsecs();
+		if (!probed) {
+			// static data: signature and platform flags, read once
+			r = cpup_probe( ctx);
+			times.probe = cpu_nsecs() - t;
+			times.refresh = 0;
+			if (!r) {
+				struct cpup_coreinfo *nc = NULL;
+
+				if ((ncores = cpup_getcores( ctx, NULL, 0)) < 1 ||
+						(nc = reallocarray( cores, ncores, sizeof( *cores))) == NULL) {
+					INFO( 0, "Could not allocate core infos!\n");
+					r = 1;
+				} else
+					cores = nc;
+			}
+			probed = !r;
+		} else if (!fresh) {
+			r = cpup_refresh( ctx);
+			times.refresh = cpu_nsecs() - t;
+			// a core went away or such, start over
+			probed = !r;
+		}
+		fresh = 0;
+		if (!r) {
+			cpup_getcores( ctx, cores, ncores);
+			t = cpu_nsecs();
+			if ((nblobs = cpup_queryrepo( ctx, blobs, EXPORT_MAXBLOBS)) < 0)
+				nblobs = 0;
+			else if (nblobs > EXPORT_MAXBLOBS)
+				nblobs = EXPORT_MAXBLOBS;
+			times.repo = cpu_nsecs() - t;
+			r = export_write( path, cpup_vendorname( ctx), cores, ncores, blobs, nblobs, &times);
+			INFO( 11, "Wrote %s: %d cores, %d repository blobs\n", path, ncores, nblobs);
+		}
+		if (interval <= 0)
+			break;
+		log_flush();
+		sleep( interval);
+	}
+	free( cores);
+	return r;
+}
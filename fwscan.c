@@ -0,0 +1,103 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include <sys/param.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "fwscan.h"
+
+
+/* returns the first dword offset from off on where the dword at the offset and the dword
+ * delta bytes further are both val, or size if there is none
+ */
+size_t
+fwscan_find( const uint8_t *image, size_t size, size_t off, uint32_t val, size_t delta)
+{
+	uint32_t a, b;
+
+	off = roundup2( off, sizeof( uint32_t));
+	if (size < delta + sizeof( uint32_t))
+		return size;
+#ifdef __SSE2__
+	{
+		__m128i v = _mm_set1_epi32( val);
+
+		// four offsets per step, as long as both loads stay within the image
+		for ( ; off + delta + sizeof( __m128i) <= size; off += sizeof( __m128i)) {
+			__m128i x = _mm_loadu_si128( (const __m128i *) (image + off));
+			__m128i y = _mm_loadu_si128( (const __m128i *) (image + off + delta));
+			int m = _mm_movemask_epi8( _mm_and_si128( _mm_cmpeq_epi32( x, v), _mm_cmpeq_epi32( y, v)));
+
+			// a matching dword sets its four mask bits, so the first set bit is its offset
+			if (m)
+				return off + ffs( m) - 1;
+		}
+	}
+#endif
+	for ( ; off + delta + sizeof( uint32_t) <= size; off += sizeof( uint32_t)) {
+		memcpy( &a, image + off, sizeof( a));
+		memcpy( &b, image + off + delta, sizeof( b));
+		if (a == val && b == val)
+			return off;
+	}
+	return size;
+}
+
+
+// sum of the ndwords dwords at p, as for the microcode checksums
+uint32_t
+fwscan_sum( const uint8_t *p, size_t ndwords)
+{
+	uint32_t sum = 0, d;
+	size_t	 i = 0;
+
+#ifdef __SSE2__
+	{
+		__m128i acc = _mm_setzero_si128();
+		uint32_t part[ 4];
+
+		for ( ; i + 4 <= ndwords; i += 4)
+			acc = _mm_add_epi32( acc, _mm_loadu_si128( (const __m128i *) (p + i * sizeof( uint32_t))));
+		_mm_storeu_si128( (__m128i *) part, acc);
+		sum = part[ 0] + part[ 1] + part[ 2] + part[ 3];
+	}
+#endif
+	for ( ; i < ndwords; ++i) {
+		memcpy( &d, p + i * sizeof( uint32_t), sizeof( d));
+		sum += d;
+	}
+	return sum;
+}
@@ -0,0 +1,367 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/param.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "cpupdate.h"
+#include "gen.h"
+
+static int gen_parse( const char *name, unsigned *num);
+static int gen_clone( int sfd, int dfd, const char *path, int depth);
+static int gen_remove( int dfd, const char *name, int depth);
+
+
+// returns nonzero if name is a generation gNNNNNN, its number in num
+static int
+gen_parse( const char *name, unsigned *num)
+{
+	size_t len = strlen( name);
+
+	if (len < 2 || name[ 0] != 'g' || strspn( name + 1, "0123456789") != len - 1)
+		return 0;
+	*num = strtoul( name + 1, NULL, 10);
+	return 1;
+}
+
+
+// hard links the tree of the directory sfd into the directory dfd
+static int
+gen_clone( int sfd, int dfd, const char *path, int depth)
+{
+	DIR			  *dirp;
+	struct dirent *direntry;
+	struct stat	   sb;
+	int			   sub, dsub, r = 0;
+
+	if ((sfd = dup( sfd)) < 0 || (dirp = fdopendir( sfd)) == NULL) {
+		INFO( 0, "Failed to access directory %s\n", path);
+		if (sfd >= 0)
+			close( sfd);
+		return 1;
+	}
+	while (!r && (direntry = readdir( dirp)) != NULL) {
+		if (!strcmp( direntry->d_name, ".") || !strcmp( direntry->d_name, ".."))
+			continue;
+		if (fstatat( dirfd( dirp), direntry->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+			INFO( 0, "stat(%s/%s) failed\n", path, direntry->d_name);
+			r = 1;
+		} else if (S_ISREG( sb.st_mode)) {
+			if (linkat( dirfd( dirp), direntry->d_name, dfd, direntry->d_name, 0) < 0) {
+				INFO( 0, "Could not link %s/%s: %s\n", path, direntry->d_name, strerror( errno));
+				r = 1;
+			}
+		} else if (S_ISDIR( sb.st_mode)) {
+			if (depth >= GEN_MAXDEPTH) {
+				INFO( 0, "Directory %s/%s nested too deep\n", path, direntry->d_name);
+				r = 1;
+			} else if (mkdirat( dfd, direntry->d_name, sb.st_mode & 07777) < 0 ||
+					(sub = openat( dirfd( dirp), direntry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+				INFO( 0, "Could not clone directory %s/%s\n", path, direntry->d_name);
+				r = 1;
+			} else {
+				if ((dsub = openat( dfd, direntry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+					INFO( 0, "Could not clone directory %s/%s\n", path, direntry->d_name);
+					r = 1;
+				} else {
+					r = gen_clone( sub, dsub, path, depth + 1);
+					close( dsub);
+				}
+				close( sub);
+			}
+		} else
+			INFO( 11, "Not cloning %s/%s, neither file nor directory\n", path, direntry->d_name);
+	}
+	closedir( dirp);
+	return r;
+}
+
+
+// removes name, with all it holds, from the directory dfd
+static int
+gen_remove( int dfd, const char *name, int depth)
+{
+	DIR			  *dirp;
+	struct dirent *direntry;
+	int			   fd, r = 0;
+
+	if (!unlinkat( dfd, name, 0))
+		return 0;
+	if (errno != EISDIR && errno != EPERM)
+		return 1;
+	if (depth > GEN_MAXDEPTH ||
+			(fd = openat( dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0)
+		return 1;
+	if ((dirp = fdopendir( fd)) == NULL) {
+		close( fd);
+		return 1;
+	}
+	while ((direntry = readdir( dirp)) != NULL)
+		if (strcmp( direntry->d_name, ".") && strcmp( direntry->d_name, ".."))
+			r |= gen_remove( dirfd( dirp), direntry->d_name, depth + 1);
+	closedir( dirp);
+	if (!r && unlinkat( dfd, name, AT_REMOVEDIR) < 0)
+		r = 1;
+	return r;
+}
+
+
+/* locks the generations of repo and creates the next one, with clone set as clone of the
+ * current one, else empty. the tools then work on g->path instead of repo
+ */
+int
+gen_begin( struct gen *g, const char *repo, int clone)
+{
+	char	target[ MAXPATHLEN];
+	const char *base;
+	struct stat sb;
+	DIR	   *dirp;
+	struct dirent *direntry;
+	unsigned num, max = 0;
+	ssize_t	n;
+	int		fd, dfd, r = 0;
+
+	memset( g, 0, sizeof( *g));
+	g->lockfd = -1;
+	if (strlen( repo) >= sizeof( g->link)) {
+		INFO( 0, "filename buffer too short for %s\n", repo);
+		return 1;
+	}
+	strcpy( g->link, repo);
+	for (size_t len = strlen( g->link); len > 1 && g->link[ len - 1] == '/'; )
+		g->link[ --len] = '\0';
+	if (snprintf( g->dir, sizeof( g->dir), "%s%s", g->link, GEN_SUFFIX) >= sizeof( g->dir)) {
+		INFO( 0, "filename buffer too short for %s\n", g->link);
+		return 1;
+	}
+	// what repo is now
+	if ((n = readlink( g->link, target, sizeof( target) - 1)) >= 0) {
+		target[ n] = '\0';
+		base = strrchr( target, '/');
+		if (!gen_parse( base ? base + 1 : target, &g->cur)) {
+			INFO( 0, "%s is a symlink not managed in generations\n", g->link);
+			return 1;
+		}
+		g->hascur = 1;
+	} else if (errno == EINVAL && stat( g->link, &sb) == 0 && S_ISDIR( sb.st_mode))
+		g->plain = 1;
+	else if (errno != ENOENT) {
+		INFO( 0, "Could not access %s: %s\n", g->link, strerror( errno));
+		return 1;
+	}
+	if (mkdir( g->dir, 0755) < 0 && errno != EEXIST) {
+		INFO( 0, "Could not create %s: %s\n", g->dir, strerror( errno));
+		return 1;
+	}
+	if ((g->lockfd = open( g->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 ||
+			flock( g->lockfd, LOCK_EX | LOCK_NB) < 0) {
+		INFO( 0, "Could not lock %s, is another generation being built?\n", g->dir);
+		gen_end( g);
+		return 1;
+	}
+	// the next number is beyond all generations there, also those of failed runs
+	if ((fd = dup( g->lockfd)) < 0 || (dirp = fdopendir( fd)) == NULL) {
+		INFO( 0, "Failed to access directory %s\n", g->dir);
+		if (fd >= 0)
+			close( fd);
+		gen_end( g);
+		return 1;
+	}
+	while ((direntry = readdir( dirp)) != NULL)
+		if (gen_parse( direntry->d_name, &num) && num > max)
+			max = num;
+	closedir( dirp);
+	g->num = MAX( max, g->cur) + 1;
+	if (snprintf( g->path, sizeof( g->path), "%s/g%06u", g->dir, g->num) >= sizeof( g->path) ||
+			snprintf( g->index, sizeof( g->index), "%s.index", g->path) >= sizeof( g->index)) {
+		INFO( 0, "filename buffer too short for %s\n", g->dir);
+		gen_end( g);
+		return 1;
+	}
+	if (mkdir( g->path, 0755) < 0) {
+		INFO( 0, "Could not create %s: %s\n", g->path, strerror( errno));
+		gen_end( g);
+		return 1;
+	}
+	if (clone && (g->hascur || g->plain)) {
+		if ((fd = open( g->link, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 ||
+				(dfd = open( g->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+			INFO( 0, "Failed to access directory %s\n", g->link);
+			r = 1;
+		} else {
+			r = gen_clone( fd, dfd, g->link, 0);
+			close( dfd);
+		}
+		if (fd >= 0)
+			close( fd);
+	}
+	if (r) {
+		gen_abort( g);
+		gen_end( g);
+		return 1;
+	}
+	INFO( 11, "Building generation %s\n", g->path);
+	return 0;
+}
+
+
+// makes the new generation the current one
+int
+gen_publish( struct gen *g)
+{
+	char	tmppath[ MAXPATHLEN], target[ MAXPATHLEN], retired[ MAXPATHLEN];
+	const char *base = strrchr( g->link, '/');
+
+	base = base ? base + 1 : g->link;
+	if (snprintf( tmppath, sizeof( tmppath), "%s/.publish", g->dir) >= sizeof( tmppath) ||
+			snprintf( target, sizeof( target), "%s%s/g%06u", base, GEN_SUFFIX, g->num) >= sizeof( target)) {
+		INFO( 0, "filename buffer too short for %s\n", g->dir);
+		return 1;
+	}
+	if (g->plain) {
+		// the plain directory is the first retired generation
+		snprintf( retired, sizeof( retired), "%s/g%06u", g->dir, 0);
+		if (rename( g->link, retired) < 0) {
+			INFO( 0, "Could not move %s to %s: %s\n", g->link, retired, strerror( errno));
+			return 1;
+		}
+		g->plain = 0;
+		g->hascur = 1;
+		g->cur = 0;
+	} else if (g->hascur)
+		snprintf( retired, sizeof( retired), "%s/g%06u", g->dir, g->cur);
+	unlink( tmppath);
+	if (symlink( target, tmppath) < 0 || rename( tmppath, g->link) < 0) {
+		INFO( 0, "Could not publish %s as %s: %s\n", g->path, g->link, strerror( errno));
+		unlink( tmppath);
+		return 1;
+	}
+	// the grace period of the previous generation starts now
+	if (g->hascur && utimensat( AT_FDCWD, retired, NULL, 0) < 0)
+		INFO( 0, "Could not mark %s retired: %s\n", retired, strerror( errno));
+	INFO( 10, "Published generation %s as %s\n", g->path, g->link);
+	g->cur = g->num;
+	g->hascur = 1;
+	return 0;
+}
+
+
+// removes the new generation after a failure
+void
+gen_abort( struct gen *g)
+{
+	int dfd;
+
+	if ((dfd = open( g->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return;
+	if (gen_remove( dfd, strrchr( g->path, '/') + 1, 0))
+		INFO( 0, "Could not remove %s\n", g->path);
+	unlink( g->index);
+	close( dfd);
+	INFO( 10, "Generation %s dropped, %s left unchanged\n", g->path, g->link);
+}
+
+
+// removes the generations other than the current one retired more than grace seconds ago
+int
+gen_reclaim( struct gen *g, int grace)
+{
+	struct dirent *direntry;
+	struct stat sb;
+	char	index[ MAXPATHLEN];
+	DIR	   *dirp;
+	time_t	now = time( NULL);
+	unsigned num;
+	int		fd, r = 0;
+
+	if ((fd = dup( g->lockfd)) < 0 || (dirp = fdopendir( fd)) == NULL) {
+		INFO( 0, "Failed to access directory %s\n", g->dir);
+		if (fd >= 0)
+			close( fd);
+		return 1;
+	}
+	// the descriptor shares the offset with the lock one, gen_begin() read it to the end
+	rewinddir( dirp);
+	while ((direntry = readdir( dirp)) != NULL) {
+		if (!gen_parse( direntry->d_name, &num) || (g->hascur && num == g->cur))
+			continue;
+		if (fstatat( dirfd( dirp), direntry->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0 ||
+				sb.st_mtime + grace > now)
+			continue;
+		if (gen_remove( dirfd( dirp), direntry->d_name, 0)) {
+			INFO( 0, "Could not remove generation %s/%s\n", g->dir, direntry->d_name);
+			r = 1;
+			continue;
+		}
+		snprintf( index, sizeof( index), "%s.index", direntry->d_name);
+		unlinkat( dirfd( dirp), index, 0);
+		INFO( 11, "Removed generation %s/%s\n", g->dir, direntry->d_name);
+	}
+	closedir( dirp);
+	return r;
+}
+
+
+void
+gen_end( struct gen *g)
+{
+	if (g->lockfd >= 0)
+		close( g->lockfd);
+	g->lockfd = -1;
+}
+
+
+/* replaces the repository path by the generation it currently points to, so a reader
+ * keeps seeing that generation when a new one gets published meanwhile.
+ * plain directories and paths that do not exist are left as they are
+ */
+int
+gen_resolve( char *path)
+{
+	char	resolved[ PATH_MAX];
+	struct stat sb;
+
+	if (lstat( path, &sb) < 0 || !S_ISLNK( sb.st_mode))
+		return 0;
+	if (realpath( path, resolved) == NULL || strlen( resolved) >= MAXPATHLEN) {
+		INFO( 0, "Could not resolve %s\n", path);
+		return 1;
+	}
+	strcpy( path, resolved);
+	return 0;
+}
@@ -0,0 +1,64 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GEN_H
+#define	GEN_H
+
+/* Repository generations.
+ * A repository directory managed in generations is a symlink repo -> repo.gens/gNNNNNN.
+ * A writer builds a new generation next to the current one, either empty or starting from
+ * a hard link clone of it (the repository tools replace files by rename and never write
+ * into them), validates and indexes it, and publishes it by renaming a new symlink over repo.
+ * Readers resolve repo once with gen_resolve() and keep using that generation without
+ * locks. The previous generation is marked retired at the switch and removed by
+ * gen_reclaim() once it is retired longer than the grace period. Writers of one
+ * repository are serialized by a lock on repo.gens.
+ * The first publish of a plain directory moves it to repo.gens/g000000 and puts the
+ * symlink in its place, between the two renames repo does not exist.
+ */
+
+#define GEN_SUFFIX		".gens"
+#define GEN_GRACE		3600			// s a retired generation is kept by default
+#define GEN_MAXDEPTH	8				// of the directories cloned
+
+struct gen {
+	char		link[ MAXPATHLEN];		// the repository path
+	char		dir[ MAXPATHLEN];		// link GEN_SUFFIX, holding the generations
+	char		path[ MAXPATHLEN];		// the new generation
+	char		index[ MAXPATHLEN];		// its index, the verification state of its blobs
+	unsigned	num;					// of the new generation
+	unsigned	cur;					// of the current one
+	int			hascur;					// bool: link is a generation symlink
+	int			plain;					// bool: link is a plain directory yet
+	int			lockfd;
+};
+
+int  gen_begin( struct gen *g, const char *repo, int clone);
+int  gen_publish( struct gen *g);
+void gen_abort( struct gen *g);
+int  gen_reclaim( struct gen *g, int grace);
+void gen_end( struct gen *g);
+int  gen_resolve( char *path);
+
+#endif /* !GEN_H */
@@ -36,6 +36,7 @@ __FBSDID("$FreeBSD$");
 #include <err.h>
 #include <errno.h>
 #include <dirent.h>
+#include <stddef.h>
 
 #include <sys/types.h>
 #include <sys/param.h>
@@ -51,6 +52,18 @@ __FBSDID("$FreeBSD$");
 
 #include "cpupdate.h"
 #include "intel.h"
+#include "owrite.h"
+#include "datfmt.h"
+#include "coretab.h"
+#include "devio.h"
+#include "cpio.h"
+#include "pack.h"
+#include "prune.h"
+#include "scan.h"
+#include "report.h"
+#include "sync.h"
+#include "vstate.h"
+#include "fwscan.h"
 
 int intel_probe( struct cpupdate_params *);
 int intel_loadcheckmicrocode( struct cpupdate_params *);
@@ -60,7 +73,16 @@ int intel_update( struct cpupdate_params *);
 int intel_freeucodeinfo( struct cpupdate_params *params);
 int intel_extractformat( struct cpupdate_params *params);
 int intel_compactformat( struct cpupdate_params *params);
+int intel_pack( struct cpupdate_params *params);
 const char *intel_getvendorname( struct cpupdate_params *);
+int intel_getcores( struct cpupdate_params *params, struct cpup_coreinfo *cores, int max);
+int intel_getblobs( struct cpupdate_params *params, struct cpup_blobinfo *blobs, int max);
+int intel_refreshrevs( struct cpupdate_params *params);
+int intel_prune( struct cpupdate_params *params);
+int intel_earlycpio( struct cpupdate_params *params);
+int intel_sync( struct cpupdate_params *params);
+int intel_scanimage( struct cpupdate_params *params);
+int intel_verifytree( struct cpupdate_params *params);
 
 struct vendor_funcs intel_funcs = {
 	(hnd_f)	&intel_probe,
@@ -71,17 +93,54 @@ struct vendor_funcs intel_funcs = {
 	(hnd_f)	&intel_freeucodeinfo,
 	(hnd_f)	&intel_extractformat,
 	(hnd_f)	&intel_compactformat,
-	(hnd_n)	&intel_getvendorname
+	(hnd_f)	&intel_pack,
+	(hnd_n)	&intel_getvendorname,
+	(hnd_c)	&intel_getcores,
+	(hnd_b)	&intel_getblobs,
+	(hnd_f)	&intel_refreshrevs,
+	(hnd_f)	&intel_prune,
+	(hnd_f)	&intel_earlycpio,
+	(hnd_f)	&intel_sync,
+	(hnd_f)	&intel_scanimage,
+	(hnd_f)	&intel_verifytree
 };
 
 static uint32_t intel_getFamily( uint32_t *sig);
 static uint32_t intel_getModel( uint32_t *sig);
 static int intel_getCoreInfo( struct intel_ProcessorInfo *coreinfo, int core);
-static int intel_getCoresInfo( struct intel_ProcessorInfo *coreinfos);
-static void printcpustats( struct intel_ProcessorInfo *info, int s, int e);
-static int readucfile( void *ucodeinfop, char *upfilepath);
+static int intel_getCoresInfo( struct cpupdate_params *params);
+static void printcpustats( struct intel_ProcessorInfo *info, const char *cpulist);
+static int readucfile( void *ucodeinfop, int dirfd, const char *relpath, const char *upfilepath);
+static int readpack( struct intel_ucinfo *ucinfo, const char *packpath, uint32_t signature);
 static int intel_getHdrInfo( struct intel_hdrhdr_t *hdr, const char *filename);
-static char *getdatestr( uint32_t datefield);
+static int intel_packfile( int dfd, const char *name, const char *path, void *arg);
+static int intel_blobfits( const uint8_t *blob, size_t left);
+static int intel_foreachblobof( struct cpupdate_params *params, struct intel_ucinfo *ucinfo, intel_blob_cb cb, void *arg);
+static int intel_foreachblob( struct cpupdate_params *params, intel_blob_cb cb, void *arg);
+static int intel_checkucfile( struct cpupdate_params *params, struct intel_ucinfo *ucinfo);
+static int intel_findrepofile( struct cpupdate_params *params, struct intel_ucinfo *ucinfo, uint32_t signature);
+static struct intel_ucinfo *intel_findgroup( struct cpupdate_params *params, uint32_t signature);
+static int intel_printblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg);
+static int intel_output( struct cpupdate_params *params, const char *opath, const void *data, size_t size, int append);
+static int intel_extractblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg);
+static int intel_compactblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg);
+static int intel_packblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg);
+static int intel_infoblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg);
+static int intel_pruneblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg);
+static int intel_prunefile( int dfd, const char *name, const char *path, void *arg);
+static int intel_cmphdrhdr( const void *a, const void *b);
+static int intel_rewritefile( struct cpupdate_params *params, struct prune_set *set, int f);
+static int intel_earlyblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg);
+static int intel_syncblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg);
+static int intel_syncfile( int dfd, const char *name, const char *path, void *arg);
+static int intel_syncputblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg);
+static int intel_syncwrite( struct cpupdate_params *params, struct sync_tree *src, int first, int n, const char *opath);
+static int intel_signame( uint32_t signature, char *buf, size_t size);
+static struct intel_scanblob *intel_scanadd( struct intel_scanblob **found, int *nfound, int *maxfound, 
+			const struct intel_uc_header_t *hdr);
+static int intel_scantarget( struct cpupdate_params *params, const char *opath, 
+			struct intel_scanblob **found, int *nfound, int *maxfound);
+static char *getdatestr( uint32_t datefield, char *datestr);
 static void intel_printSignatInfo( uint32_t *sig_p, const char *ind);
 static void intel_printExtSignatInfo( void *sig_p, const char *ind);
 static void intel_printHeadersInfo( struct intel_hdrhdr_t *hdrhdr);
@@ -126,7 +185,7 @@ intel_getCoreInfo( struct intel_ProcessorInfo *coreinfo, int core)
 	};
 
 	sprintf( cpudev, "/dev/cpuctl%d", core);
-	cpufd = open( cpudev, O_RDWR);
+	cpufd = devio_open( core, O_RDWR);
 	if (cpufd < 0) {
 		INFO( 0, "could not open %s for writing\n", cpudev);
 		r = 1;
@@ -134,7 +193,7 @@ intel_getCoreInfo( struct intel_ProcessorInfo *coreinfo, int core)
 	if (!r) {
 		/* Read Platform ID, see Intel Manual Vol. 3A, section 9.11.04, pg 9-32+33 */
 		msrargs.msr = MSR_IA32_PLATFORM_ID;
-		if (ioctl( cpufd, CPUCTL_RDMSR, &msrargs) < 0) {
+		if (devio_ioctl( cpufd, CPUCTL_RDMSR, &msrargs) < 0) {
 			INFO( 0, "Reading platform ID for %s failed\n", cpudev);
 			r = 1;
 		} else {
@@ -149,12 +208,12 @@ intel_getCoreInfo( struct intel_ProcessorInfo *coreinfo, int core)
 		 */
 		msrargs.msr = MSR_BIOS_SIGN;
 		msrargs.data = 0;
-		if (ioctl( cpufd, CPUCTL_WRMSR, &msrargs) < 0) {
+		if (devio_ioctl( cpufd, CPUCTL_WRMSR, &msrargs) < 0) {
 			INFO( 0, "Initialization for CPUID for %s failed\n", cpudev);
 			r = 1;
 		}
 	}
-	if (!r && ioctl( cpufd, CPUCTL_CPUID, &idargs) < 0) {
+	if (!r && devio_ioctl( cpufd, CPUCTL_CPUID, &idargs) < 0) {
 		INFO( 0, "%s CPUID failed\n", cpudev);
 		r = 1;
 
@@ -163,14 +222,14 @@ intel_getCoreInfo( struct intel_ProcessorInfo *coreinfo, int core)
 		coreinfo->sig.sigInt = idargs.data[0];
 // 		coreinfo->esig.sigS.cpu_flags = idargs.data[1];
 // 		coreinfo->esig.sigS.checksum  = idargs.data[2];
-		if (ioctl( cpufd, CPUCTL_RDMSR, &msrargs) < 0) {
+		if (devio_ioctl( cpufd, CPUCTL_RDMSR, &msrargs) < 0) {
 			INFO( 0, "%s MSR read failed\n", cpudev);
 			r = 1;
 		}
 	} 
 	if (!r) {
 		msrargs.msr = MSR_BIOS_SIGN;
-		if (ioctl( cpufd, CPUCTL_RDMSR, &msrargs) < 0) {
+		if (devio_ioctl( cpufd, CPUCTL_RDMSR, &msrargs) < 0) {
 			INFO( 0, "%s signature read failed\n", cpudev);
 			r = 1;
 		}
@@ -186,15 +245,15 @@ intel_getCoreInfo( struct intel_ProcessorInfo *coreinfo, int core)
 
 
 static int
-intel_getCoresInfo( struct intel_ProcessorInfo *coreinfos)
+intel_getCoresInfo( struct cpupdate_params *params)
 {
 	int			core, r = 0;
 	struct intel_ProcessorInfo 
 				*coreinfo;
 	
-	assert( numCores);
-	for( core = 0; core < numCores; ++core){
-		coreinfo = coreinfos + core;
+	assert( params->numcores);
+	for( core = 0; core < params->numcores; ++core){
+		coreinfo = (struct intel_ProcessorInfo *) params->coreinfop + core;
 		r = intel_getCoreInfo( coreinfo, core);
 		if (r) 
 			break;
@@ -203,6 +262,38 @@ intel_getCoresInfo( struct intel_ProcessorInfo *coreinfos)
 }
 
 
+/* re-reads only the microcode revisions, for polling. signature and platform flags
+ * are static and kept from the probe. the cpuctl devices stay open between calls
+ */
+int
+intel_refreshrevs( struct cpupdate_params *params)
+{
+	struct intel_ProcessorInfo *coreinfo = (struct intel_ProcessorInfo *) params->coreinfop;
+	cpuctl_msr_args_t   msrargs;
+	cpuctl_cpuid_args_t idargs;
+	int					core, fd, r = 0;
+
+	assert( coreinfo != NULL);
+	if (cpu_opencorefds( params))
+		return 1;
+	for (core = 0; !r && core < params->numcores; ++core, ++coreinfo) {
+		fd = params->corefds[ core];
+		// the revision is only valid after clearing the MSR and executing CPUID, as in intel_getCoreInfo()
+		msrargs.msr = MSR_BIOS_SIGN;
+		msrargs.data = 0;
+		idargs.level = 1;
+		if (devio_ioctl( fd, CPUCTL_WRMSR, &msrargs) < 0 ||
+				devio_ioctl( fd, CPUCTL_CPUID, &idargs) < 0 ||
+				devio_ioctl( fd, CPUCTL_RDMSR, &msrargs) < 0) {
+			INFO( 0, "Reading the microcode revision of core %d failed\n", core);
+			r = 1;
+		} else
+			coreinfo->ucoderev = msrargs.data >> 32;
+	}
+	return r;
+}
+
+
 int 
 intel_probe( struct cpupdate_params *params)
 {
@@ -218,12 +309,12 @@ intel_probe( struct cpupdate_params *params)
 	const char *cpudev = "/dev/cpuctl0";
 	int cpufd, r = 0;
   
-	cpufd = open( cpudev, O_RDONLY);
+	cpufd = devio_open( 0, O_RDONLY);
 	if (cpufd < 0) {
 		INFO( 0, "error opening %s for reading\n", cpudev);
 		r = -1;
 	}
-	if (!r && ioctl( cpufd, CPUCTL_CPUID, &idargs) < 0) {
+	if (!r && devio_ioctl( cpufd, CPUCTL_CPUID, &idargs) < 0) {
 		INFO( 0, "ioctl( CPUCTL_CPUID) failed\n");
 		r = -1;
 	}
@@ -235,33 +326,33 @@ intel_probe( struct cpupdate_params *params)
 		r = (strncmp( vendor, INTEL_VENDOR_ID, sizeof( INTEL_VENDOR_ID))) ? 1 : 0;
 		// r is 0 now if Intel cpu
 	}
+	if (cpufd >= 0)
+		close( cpufd);
 	if (!r) {
-		if ((params->coreinfop = calloc( numCores, sizeof( struct intel_ProcessorInfo))) == NULL) {
+		if ((params->coreinfop = calloc( params->numcores, sizeof( struct intel_ProcessorInfo))) == NULL) {
 			INFO( 0, "Failed to allocate memory for coreinfos structures\n");
 			r = 1;
 		}
 	}
 	if (!r) {
-		r = intel_getCoresInfo( params->coreinfop);
+		r = intel_getCoresInfo( params);
 	}
 	return r;
 }
 
 
 static void
-printcpustats( struct intel_ProcessorInfo *info, int s, int e)
+printcpustats( struct intel_ProcessorInfo *info, const char *cpulist)
 {
-	INFO( 11, "Core %d to %d: Type %01d  FamID %01x  ModID %01x  ExtFam %02x  ExtMod %01x\n", 
-				s, 
-				e,
+	INFO( 11, "Cores %s: Type %01d  FamID %01x  ModID %01x  ExtFam %02x  ExtMod %01x\n", 
+				cpulist,
 				info->sig.sigBitF.ProcessorType,
 				info->sig.sigBitF.FamilyID,
 				info->sig.sigBitF.Model,
 				info->sig.sigBitF.ExtendedFamilyID,
 				info->sig.sigBitF.ExtendedModelID);
-	INFO( 10, "Core %d to %d: CPUID: %x  Fam %02x  Mod %02x  Step %02x  Flag %02x uCode %08x\n", 
-				s, 
-				e,
+	INFO( 10, "Cores %s: CPUID: %x  Fam %02x  Mod %02x  Step %02x  Flag %02x uCode %08x\n", 
+				cpulist,
 				info->sig.sigInt,
 				intel_getFamily( &info->sig.sigInt),
 				intel_getModel( &info->sig.sigInt),
@@ -275,44 +366,43 @@ int
 intel_printcpustats( struct cpupdate_params *params)
 {
 	struct intel_ProcessorInfo *coreinfo = (struct intel_ProcessorInfo *) params->coreinfop;
+	struct coretab ct;
+	char	cpulist[ CORETAB_LISTMAX];
 
-	// as there might be multiple processors of different ucoderevs etc,
-	// walk all cores and determine ranges of equal cores.
-	// either when all cores are walked, or a core with different stats 
-	// has been found, print out stats
-	int startcore = 0;
-	int ncore = 1;
-	struct intel_ProcessorInfo
-			*ncoreinfo,
-			*startcoreinfo = coreinfo;
-	
-	for ( ; ncore < numCores ; ++ncore) {
-	 	ncoreinfo = coreinfo + ncore;
-    	if (	ncoreinfo->sig.sigBitF.SteppingID		!= startcoreinfo->sig.sigBitF.SteppingID 		||
-    			ncoreinfo->sig.sigBitF.Model			!= startcoreinfo->sig.sigBitF.Model 			||
-    			ncoreinfo->sig.sigBitF.FamilyID			!= startcoreinfo->sig.sigBitF.FamilyID 			||
-    			ncoreinfo->sig.sigBitF.ProcessorType	!= startcoreinfo->sig.sigBitF.ProcessorType		||
-    			ncoreinfo->sig.sigBitF.Model			!= startcoreinfo->sig.sigBitF.Model 			||
-    			ncoreinfo->sig.sigBitF.ExtendedModelID	!= startcoreinfo->sig.sigBitF.ExtendedModelID	||
-    			ncoreinfo->sig.sigBitF.ExtendedFamilyID	!= startcoreinfo->sig.sigBitF.ExtendedFamilyID	||
-				ncoreinfo->flags						!= startcoreinfo->flags							||
-				ncoreinfo->ucoderev						!= startcoreinfo->ucoderev) {
-	 		// core #ncore is different than core #startcore..#(ncore-1).
-			// Print core info for that block
-			printcpustats( startcoreinfo, startcore, ncore - 1);
-			startcore = ncore;
-			startcoreinfo = ncoreinfo;
-		}
-	}
-	// make sure also the last block of identical cores are shown
-	if (startcore < ncore)
-		printcpustats( startcoreinfo, startcore, ncore - 1);
+	// as there might be multiple processors of different ucoderevs etc, possibly
+	// interleaved, group equal cores by their raw key and print each group once
+	if (coretab_init( &ct, params->numcores))
+		return 1;
+	for (int core = 0; core < params->numcores; ++core)
+		coretab_set( &ct, core, coreinfo[ core].sig.sigInt, coreinfo[ core].flags, coreinfo[ core].ucoderev);
+	if (coretab_group( &ct) < 0) {
+		coretab_free( &ct);
+		return 1;
+	}
+	for (int g = 0; g < ct.ngroups; ++g) {
+		coretab_cpulist( &ct, g, cpulist, sizeof( cpulist));
+		if (params->report != NULL) {
+			struct intel_ProcessorInfo *info = &coreinfo[ ct.gfirst[ g]];
+			struct report_rec rec = { .type = REPORT_CORES };
+
+			rec.signature = info->sig.sigInt;
+			rec.flags = info->flags;
+			rec.revision = info->ucoderev;
+			rec.count = ct.gcount[ g];
+			report_row( params->report, &rec, cpulist);
+		} else
+			printcpustats( &coreinfo[ ct.gfirst[ g]], cpulist);
+	}
+	coretab_free( &ct);
 	return 0;
 }
 
 
+/* reads the file relpath, relative to directory descriptor dirfd (or AT_FDCWD).
+ * upfilepath is the name used for messages
+ */
 static int
-readucfile( void *ucodeinfop, char *upfilepath)
+readucfile( void *ucodeinfop, int dirfd, const char *relpath, const char *upfilepath)
 {
 	struct intel_ucinfo 
 			   *ucinfo;
@@ -321,7 +411,7 @@ readucfile( void *ucodeinfop, char *upfilepath)
 	struct stat	st;
 
 	ucinfo = (struct intel_ucinfo *) ucodeinfop;
-	updfd = open( upfilepath, O_RDONLY, 0);
+	updfd = openat( dirfd, relpath, O_RDONLY | O_CLOEXEC);
 	if (updfd < 0) {
 		INFO( 12, "Failed to open %s file\n", upfilepath);
 		r = 1;
@@ -352,6 +442,57 @@ readucfile( void *ucodeinfop, char *upfilepath)
 }
 
 
+/* looks up the blobs for signature in the container at packpath and puts the newest
+ * revision for each set of platform flags into ucinfo's image, like a multi-blobbed file
+ */
+static int
+readpack( struct intel_ucinfo *ucinfo, const char *packpath, uint32_t signature)
+{
+	struct pack_map pm;
+	int		first, count, nsel = 0, r = 0;
+	int		sel[ MAXHEADERS];
+	size_t	total = 0;
+
+	if (pack_open( &pm, packpath))
+		return 1;
+	count = pack_find( &pm, signature, &first);
+	// entries are sorted by flags, then revision: the last one of each flags run is the newest
+	for (int i = first; i < first + count; ++i) {
+		if (i + 1 < first + count && pm.table[ i + 1].flags == pm.table[ i].flags)
+			continue;
+		if (nsel == MAXHEADERS) {
+			INFO( 0, "Container %s: More than %d blobs for signature %08x, ignoring the rest\n",
+					packpath, MAXHEADERS, signature);
+			break;
+		}
+		sel[ nsel++] = i;
+		total += pm.table[ i].size;
+	}
+	if (nsel == 0) {
+		INFO( 12, "Container %s has no blob for signature %08x\n", packpath, signature);
+		r = 1;
+	}
+	if (!r && (ucinfo->image = malloc( total)) == NULL) {
+		INFO( 0, "Buffer allocation of %zu bytes failed\n", total);
+		r = 1;
+	}
+	if (!r) {
+		uint8_t *p = ucinfo->image;
+		for (int i = 0; !r && i < nsel; ++i) {
+			r = pack_getblob( &pm, &pm.table[ sel[ i]], p);
+			p += pm.table[ sel[ i]].size;
+		}
+		if (r) {
+			free( ucinfo->image);
+			ucinfo->image = NULL;
+		} else
+			ucinfo->imagesize = total;
+	}
+	pack_close( &pm);
+	return r;
+}
+
+
 /* populates the hdrhdr structure while validating the blob.
  * hdr-> image must be preset to point at the blob start address,
  * this saves us an argument
@@ -475,186 +616,325 @@ intel_getHdrInfo( struct intel_hdrhdr_t *hdr, const char *filename)
 }
   
 
-int 
-intel_loadcheckmicrocode( struct cpupdate_params *params)
+// checks that the blob starting at blob, as far as its header tells, lies within left bytes
+static int
+intel_blobfits( const uint8_t *blob, size_t left)
 {
-	char upfilepath[ MAXPATHLEN];
-	char upfilename[ MAXPATHLEN];
-	struct intel_ProcessorInfo *info;
-	struct intel_ucinfo *ucinfo;
+	const struct intel_uc_header_t *hdr = (const struct intel_uc_header_t *) blob;
+	size_t total;
+
+	if (left < sizeof( *hdr))
+		return 0;
+	total = (hdr->data_size == 0 && hdr->total_size == 0) ? 2000 + sizeof( *hdr) : hdr->total_size;
+	return total >= sizeof( *hdr) && total <= left;
+}
+
+
+/* calls cb for each blob of the loaded file ucinfo, stops at the first nonzero return.
+ * blobs of text format files are walked and validated here, as they are not kept in hdrhdrs.
+ * with cb == NULL, only the blobs of a text format file get validated and counted
+ */
+static int
+intel_foreachblobof( struct cpupdate_params *params, struct intel_ucinfo *ucinfo, intel_blob_cb cb, void *arg)
+{
+	struct intel_hdrhdr_t hdrhdr;
+	uint8_t *p, *end;
+	int n, r = 0;
+
+	if (!ucinfo->istext) {
+		for (n = 0; cb != NULL && !r && n < ucinfo->blobcount; ++n)
+			r = cb( params, &ucinfo->hdrhdrs[ n], n, ucinfo->blobcount, arg);
+		return r;
+	}
+	p = ucinfo->image;
+	end = p + ucinfo->imagesize;
+	for (n = 0; !r && p < end; ++n) {
+		memset( &hdrhdr, 0, sizeof( hdrhdr));
+		hdrhdr.image = p;
+		if (!intel_blobfits( p, end - p)) {
+			INFO( 0, "File %s: Blob %d goes past EOF!\n", ucinfo->path, n);
+			r = 1;
+		} else if (intel_getHdrInfo( &hdrhdr, ucinfo->path)) {
+			INFO( 0, "File %s: Header/Blob %d seems to be inconsistent!\n", ucinfo->path, n);
+			r = 1;
+		} else if (cb != NULL) {
+			r = cb( params, &hdrhdr, n, ucinfo->textblobs, arg);
+		}
+		p += hdrhdr.total_size;
+	}
+	if (!r && cb == NULL)
+		ucinfo->textblobs = n;
+	return r;
+}
+
+
+// as intel_foreachblobof(), for the (first) loaded file
+static int
+intel_foreachblob( struct cpupdate_params *params, intel_blob_cb cb, void *arg)
+{
+	return intel_foreachblobof( params, (struct intel_ucinfo *) params->ucodeinfop, cb, arg);
+}
+
+
+/* validates the file read into ucinfo and builds the pointers to its blobs.
+ * files in Intel's legacy text format get decoded first
+ */
+static int
+intel_checkucfile( struct cpupdate_params *params, struct intel_ucinfo *ucinfo)
+{
+	const char *upfilepath = ucinfo->path;
 	int r = 0;
-	int nodir = 1;				// bool: microcode directory given?
-	int gotfile = 0;			// bool: got microcode file?
 
-	if ((params->ucodeinfop = calloc( 1, sizeof( struct intel_ucinfo))) == NULL) {
-		INFO( 0, "Could not allocate ucodeinfo struct!\n");
-		return 1;
+	if (dat_istext( ucinfo->image, ucinfo->imagesize)) {
+		// Intel's legacy text format: decode it, then validate blob by blob
+		uint32_t *words;
+		size_t nwords;
+
+		INFO( 11, "Update file %s has been read, it is in text format.\n", upfilepath);
+		r = dat_decode( ucinfo->image, ucinfo->imagesize, &words, &nwords, upfilepath);
+		if (!r) {
+			free( ucinfo->image);
+			ucinfo->image = words;
+			ucinfo->imagesize = nwords * sizeof( uint32_t);
+			ucinfo->istext = 1;
+			r = intel_foreachblobof( params, ucinfo, NULL, NULL);
+		}
+		if (!r)
+			INFO( 12, "File %s contains %d update blobs\n", upfilepath, ucinfo->textblobs);
+		return r;
 	}
-	ucinfo = params->ucodeinfop;
-	// if filepath has been preset, use this
-	if (strlen( params->filepath)) {
-		strcpy( upfilepath, params->filepath);
-		r = readucfile( ucinfo, upfilepath);
-		if (r) {
-			INFO( 0, "File %s: Does not exist or could not be read!\n", upfilepath);
-		} else
-			gotfile = 1;
-	} else {
-		// first construct filename from cpu info
-		assert( params->coreinfop != NULL);
-		info = (struct intel_ProcessorInfo *) params->coreinfop;
-		/* construct family-model-stepping filename for microcode binary */
-		if (snprintf( upfilename, sizeof( upfilename), "%02x-%02x-%02x",
-					intel_getFamily( &info->sig.sigInt),
-					intel_getModel( &info->sig.sigInt),
-					info->sig.sigBitF.SteppingID) >= sizeof( upfilename)) {
-			INFO( 0, "filename buffer for %s too short\n", upfilename);
-			exit( 1);
-		}
-		// then check primary, then secondary ucodes directory for file
-		if (strlen( params->primdir)) {
-			nodir = 0;
-			if (snprintf( upfilepath, sizeof( upfilepath), "%s/%s", params->primdir, 
-						upfilename) >= sizeof( upfilepath)) {
-				INFO( 0, "filename buffer for primdir %s too short\n", upfilepath);
-				exit( 1);
+	INFO( 11, "Update file %s has been read.\n", upfilepath);
+	// now we have the file, check its validity
+	// and build the pointers to its structures
+	
+	/* get first header to get the file's basic information */  
+	ucinfo->hdrhdrs[ 0].image = ucinfo->image;
+	if (!intel_blobfits( ucinfo->image, ucinfo->imagesize) || 
+			intel_getHdrInfo( &ucinfo->hdrhdrs[ 0], upfilepath)) {
+		INFO( 0, "File %s: Error in [first] header\n", upfilepath);
+		r = 1;
+	}
+	
+	if (!r && ucinfo->hdrhdrs[ 0].has_ext_table) {
+		// extended headers support dropped because Intel seems to have dropped them 
+		// in favor of new file format
+		// but warn when found, to avoid possible surprises
+		INFO( 11, "File %s: Blob %d has extended header!\n - extended header NOT verified and not used by cpupdate!!\n", 
+			  upfilepath, 0);
+	} 
+
+	ucinfo->blobcount = 1;
+	if (!r) {
+		// check how many updates the file contains [usually each for different processor flags, up to 8]
+		// now we have to walk through all headers like a linked list
+		uint32_t tsiz = ucinfo->hdrhdrs[ 0].total_size;
+
+		while (tsiz < ucinfo->imagesize) {
+			struct intel_hdrhdr_t *prev = &ucinfo->hdrhdrs[ ucinfo->blobcount - 1];
+			struct intel_hdrhdr_t *cur;
+
+			if (ucinfo->blobcount == MAXHEADERS) {
+				INFO( 0, "File %s: Contains more than %d headers, but only %d are supported!\n", 
+							upfilepath, MAXHEADERS, MAXHEADERS);
+				r = 1;
+				break;
 			}
-			r = readucfile( ucinfo, upfilepath);
-			if (!r) {
-				gotfile = 1;
-				strcpy( params->filepath, upfilepath);
+			// as the blobs are concatennated, use the hdrhdr.total_size field as pointer offset
+			cur = &ucinfo->hdrhdrs[ ucinfo->blobcount];
+			cur->image = prev->image + prev->total_size;
+			if (!intel_blobfits( cur->image, ucinfo->imagesize - tsiz)) {
+				INFO( 0, "File %s: Blob %d goes past EOF!\n", upfilepath, ucinfo->blobcount);
+				r = 1;
+				break;
 			}
+			if (intel_getHdrInfo( cur, upfilepath)) {
+				INFO( 0, "File %s: Header/Blob %d seems to be inconsistent!\n", upfilepath, 
+						ucinfo->blobcount);
+				r = 1;
+				break;
+			} 
+			if (cur->has_ext_table) {
+				// extended headers support dropped because Intel seems to have dropped them 
+				// in favor of new file format
+				// but warn when found, to avoid possible surprises
+				INFO( 11, "File %s: Blob %d has extended header - extended header NOT checked!!\n", 
+					  upfilepath, ucinfo->blobcount);
+			} 
+			// we are finished when the blob's end is at EOF
+			tsiz += cur->total_size;
+			++ucinfo->blobcount;
 		}
-		if ((!gotfile) && strlen( params->secdir)) {
-			nodir = 0;
-			if (snprintf( upfilepath, sizeof( upfilepath), "%s/%s", params->secdir, 
-					upfilename) >= sizeof( upfilepath)) {
-				INFO( 0, "filename buffer for secdir %s too short\n", upfilepath);
-				exit( 1);
-			}
-			r = readucfile( ucinfo, upfilepath);
-			if (!r) {
-				gotfile = 1;
-				strcpy( params->filepath, upfilepath);
+	}
+	if (!r && ucinfo->blobcount > 1) {
+		INFO( 12, "File %s contains %d update blobs\n", upfilepath, ucinfo->blobcount);
+	} else {
+		INFO( 12, "File %s is single-blobbed\n", upfilepath);
+	}
+	/* verify that there is no conflicting/ambiguous situation that makes matching correct update impossible
+	 *    -headers should all have same cpuid but different flags
+	 *    -if there are overlapping flags, the revision ids must be different to remove ambiguity TODO XXX
+	 */
+	if (!r && ucinfo->blobcount > 1) {
+		/* only if multiple blobs present: check the ones beyond the beginning one */
+		uint32_t cpu_flags_hit = ((struct intel_uc_header_t *) (ucinfo->hdrhdrs[ 0].image))->cpu_flags;
+		union intel_SignatUnion *signat0 = (union intel_SignatUnion *) 
+						&((struct intel_uc_header_t *) (ucinfo->hdrhdrs[ 0].image))->cpu_signature;
+		for (int n = 1; n < ucinfo->blobcount; ++n) {
+			struct intel_hdrhdr_t *thdrhdr = &ucinfo->hdrhdrs[ n];
+			
+			union intel_SignatUnion *signatN = (union intel_SignatUnion *) 
+			&((struct intel_uc_header_t *) (thdrhdr->image))->cpu_signature;
+			uint32_t           flagsN  = ((struct intel_uc_header_t *) (thdrhdr->image))->cpu_flags;
+			if (signat0->sigBitF.SteppingID       != signatN->sigBitF.SteppingID ||
+					signat0->sigBitF.Model            != signatN->sigBitF.Model ||
+					signat0->sigBitF.FamilyID         != signatN->sigBitF.FamilyID ||
+					signat0->sigBitF.ProcessorType    != signatN->sigBitF.ProcessorType ||
+					signat0->sigBitF.Model            != signatN->sigBitF.Model ||
+					signat0->sigBitF.ExtendedModelID  != signatN->sigBitF.ExtendedModelID ||
+					signat0->sigBitF.ExtendedFamilyID != signatN->sigBitF.ExtendedFamilyID ) {
+				INFO( 0, "File %s: Blob 0 and %d have different cpu signatures!!\n", upfilepath, n + 1);
+				r = -1;
+				break;
 			}
+			if (cpu_flags_hit & flagsN) {
+				// this warning indicates that here ucode rev or date will decide what blob to use
+				INFO( 11, "Notice: Blob %d's cpu flags overlap with those of earlier ones!!\n", n + 1);
+			} 
+			cpu_flags_hit |= flagsN;
 		}
-		if (nodir) {
-			INFO( 0, "No file and no directories specified!\n");
-			r = 1;
-		} else if (r) {
-			INFO( 0, "File %s: Read error!\n", upfilepath);
-			r = 1;
+	}
+	return r;
+}
+
+
+// the multi-blobbed file name for signature, family-model-stepping
+static int
+intel_signame( uint32_t signature, char *buf, size_t size)
+{
+	return snprintf( buf, size, "%02x-%02x-%02x",
+				intel_getFamily( &signature),
+				intel_getModel( &signature),
+				((union intel_SignatUnion *) &signature)->sigBitF.SteppingID);
+}
+
+
+/* reads the repository file for cores of signature into ucinfo, looking in the
+ * container, then the primary, then the secondary directory.
+ * returns 0 if found, 1 if not, -1 on other errors
+ */
+static int
+intel_findrepofile( struct cpupdate_params *params, struct intel_ucinfo *ucinfo, uint32_t signature)
+{
+	char upfilename[ MAXPATHLEN];
+	const char *dirs[ 2] = { params->primdir, params->secdir };
+
+	/* construct family-model-stepping filename for microcode binary */
+	intel_signame( signature, upfilename, sizeof( upfilename));
+	if (strlen( params->packpath) && readpack( ucinfo, params->packpath, signature) == 0) {
+		snprintf( ucinfo->path, sizeof( ucinfo->path), "%s:%s", params->packpath, upfilename);
+		return 0;
+	}
+	for (int i = 0; i < 2; ++i) {
+		if (!strlen( dirs[ i]))
+			continue;
+		if (snprintf( ucinfo->path, sizeof( ucinfo->path), "%s/%s", dirs[ i], 
+					upfilename) >= sizeof( ucinfo->path)) {
+			INFO( 0, "filename buffer for %s too short\n", ucinfo->path);
+			return -1;
 		}
+		if (readucfile( ucinfo, AT_FDCWD, ucinfo->path, ucinfo->path) == 0)
+			return 0;
 	}
-	if (!r && gotfile) {
-		INFO( 11, "Update file %s has been read.\n", upfilepath);
-		// now we have the file, check its validity
-		// and build the pointers to its structures
-		
-		/* get first header to get the file's basic information */  
-		ucinfo->hdrhdrs[ 0].image = ucinfo->image;
-		if (!r && intel_getHdrInfo( &ucinfo->hdrhdrs[ 0], upfilepath)) {
-			INFO( 0, "File %s: Error in [first] header\n", upfilepath);
-			r = 1;
+	return 1;
+}
+
+
+// the loaded file to update cores of signature from, NULL if none
+static struct intel_ucinfo *
+intel_findgroup( struct cpupdate_params *params, uint32_t signature)
+{
+	struct intel_ucinfo *ucinfo;
+
+	for (ucinfo = params->ucodeinfop; ucinfo != NULL; ucinfo = ucinfo->next)
+		if (!ucinfo->grouped || ucinfo->signature == signature)
+			return ucinfo;
+	return NULL;
+}
+
+
+int 
+intel_loadcheckmicrocode( struct cpupdate_params *params)
+{
+	struct intel_ProcessorInfo *info;
+	struct intel_ucinfo *ucinfo, **tail;
+	int r = 0;
+	int nfound = 0;				// number of signature groups a file was found for
+
+	// if filepath has been preset, use this for all cores
+	if (strlen( params->filepath)) {
+		if ((params->ucodeinfop = calloc( 1, sizeof( struct intel_ucinfo))) == NULL) {
+			INFO( 0, "Could not allocate ucodeinfo struct!\n");
+			return 1;
 		}
-		
-		if (!r && ucinfo->hdrhdrs[ 0].has_ext_table) {
-			// extended headers support dropped because Intel seems to have dropped them 
-			// in favor of new file format
-			// but warn when found, to avoid possible surprises
-			INFO( 11, "File %s: Blob %d has extended header!\n - extended header NOT verified and not used by cpupdate!!\n", 
-				  upfilepath, ucinfo->blobcount);
-		} 
-
-		ucinfo->blobcount = 1;
-		if (!r && ucinfo->hdrhdrs[ 0].total_size != ucinfo->imagesize) {
-			// check how many updates the file contains [usually each for different processor flags, up to 8]
-			// now we have to walk through all headers like a linked list
-			uint32_t tsiz = ucinfo->hdrhdrs[ 0].total_size;
-
-			for ( ; ucinfo->blobcount <= MAXHEADERS; ++ucinfo->blobcount) {
-				if ( ucinfo->blobcount > MAXHEADERS) {
-					INFO( 0, "File %s: Contains at least %d headers, but only %d are supported!\n", 
-								upfilepath, ucinfo->blobcount, MAXHEADERS);
-					r = 1;
-					break;
-				}
-				// as the blobs are concatennated, use the hdrhdr.total_size field as pointer offset
-				ucinfo->hdrhdrs[ ucinfo->blobcount].image = 
-								ucinfo->hdrhdrs[ ucinfo->blobcount - 1].image + 
-								ucinfo->hdrhdrs[ ucinfo->blobcount - 1].total_size;
-								
-				r = intel_getHdrInfo( &ucinfo->hdrhdrs[ ucinfo->blobcount], upfilepath);
-				if (r) {
-					INFO( 0, "File %s: Header/Blob %d seems to be inconsistent!\n", upfilepath, 
-							ucinfo->blobcount);
-					break;
-				} 
-				if (ucinfo->hdrhdrs[ ucinfo->blobcount].has_ext_table) {
-					// extended headers support dropped because Intel seems to have dropped them 
-					// in favor of new file format
-					// but warn when found, to avoid possible surprises
-					INFO( 11, "File %s: Blob %d has extended header - extended header NOT checked!!\n", 
-						  upfilepath, ucinfo->blobcount);
-				} 
-				// we are finished when the blob's end is at EOF
-				tsiz += ucinfo->hdrhdrs[ ucinfo->blobcount].total_size;
-				if (ucinfo->imagesize == tsiz) {
-					break;
-				} else if (ucinfo->imagesize < tsiz) {
-					INFO( 0, "File %s: Blob %d goes past EOF!\n", upfilepath, ucinfo->blobcount);
-					r = 1;
-					break;
-				}
-			}
+		ucinfo = params->ucodeinfop;
+		strcpy( ucinfo->path, params->filepath);
+		if (params->fileimage != NULL) {
+			ucinfo->image = params->fileimage;
+			ucinfo->imagesize = params->fileimagesize;
+			params->fileimage = NULL;
+			r = 0;
+		} else if (params->filename != NULL)
+			r = readucfile( ucinfo, params->filedirfd, params->filename, ucinfo->path);
+		else
+			r = readucfile( ucinfo, AT_FDCWD, ucinfo->path, ucinfo->path);
+		if (r) {
+			INFO( 0, "File %s: Does not exist or could not be read!\n", ucinfo->path);
+			return r;
 		}
-		if (!r && ucinfo->blobcount > 1) {
-			INFO( 12, "File %s contains %d update blobs\n", upfilepath, ucinfo->blobcount);
-		} else {
-			INFO( 12, "File %s is single-blobbed\n", upfilepath);
+		return intel_checkucfile( params, ucinfo);
+	}
+	if (!strlen( params->packpath) && !strlen( params->primdir) && !strlen( params->secdir)) {
+		INFO( 0, "No file and no directories specified!\n");
+		return 1;
+	}
+	/* else look up the repository for each signature group, as hosts with mixed
+	 * steppings need different files. each is loaded and validated once, the blob
+	 * for the platform flags of a core is picked by update
+	 */
+	assert( params->coreinfop != NULL);
+	tail = (struct intel_ucinfo **) &params->ucodeinfop;
+	for (int core = 0; !r && core < params->numcores; ++core) {
+		info = (struct intel_ProcessorInfo *) params->coreinfop + core;
+		if (intel_findgroup( params, info->sig.sigInt) != NULL)
+			continue;
+		if ((ucinfo = calloc( 1, sizeof( struct intel_ucinfo))) == NULL) {
+			INFO( 0, "Could not allocate ucodeinfo struct!\n");
+			r = 1;
+			break;
 		}
-		/* verify that there is no conflicting/ambiguous situation that makes matching correct update impossible
-		 *    -headers should all have same cpuid but different flags
-		 *    -if there are overlapping flags, the revision ids must be different to remove ambiguity TODO XXX
-		 */
-		if (!r && ucinfo->blobcount > 1) {
-			/* only if multiple blobs present: check the ones beyond the beginning one */
-			uint32_t cpu_flags_hit = ((struct intel_uc_header_t *) (ucinfo->hdrhdrs[ 0].image))->cpu_flags;
-			union intel_SignatUnion *signat0 = (union intel_SignatUnion *) 
-							&((struct intel_uc_header_t *) (ucinfo->hdrhdrs[ 0].image))->cpu_signature;
-			for (int n = 1; n < ucinfo->blobcount; ++n) {
-				struct intel_hdrhdr_t *thdrhdr = &ucinfo->hdrhdrs[ n];
-				
-				union intel_SignatUnion *signatN = (union intel_SignatUnion *) 
-				&((struct intel_uc_header_t *) (thdrhdr->image))->cpu_signature;
-				uint32_t           flagsN  = ((struct intel_uc_header_t *) (thdrhdr->image))->cpu_flags;
-				if (signat0->sigBitF.SteppingID       != signatN->sigBitF.SteppingID ||
-						signat0->sigBitF.Model            != signatN->sigBitF.Model ||
-						signat0->sigBitF.FamilyID         != signatN->sigBitF.FamilyID ||
-						signat0->sigBitF.ProcessorType    != signatN->sigBitF.ProcessorType ||
-						signat0->sigBitF.Model            != signatN->sigBitF.Model ||
-						signat0->sigBitF.ExtendedModelID  != signatN->sigBitF.ExtendedModelID ||
-						signat0->sigBitF.ExtendedFamilyID != signatN->sigBitF.ExtendedFamilyID ) {
-					INFO( 0, "File %s: Blob 0 and %d have different cpu signatures!!\n", upfilepath, n + 1);
-					r = -1;
-					break;
-				}
-				if (cpu_flags_hit & flagsN) {
-					// this warning indicates that here ucode rev or date will decide what blob to use
-					INFO( 11, "Notice: Blob %d's cpu flags overlap with those of earlier ones!!\n", n + 1);
-				} 
-				cpu_flags_hit |= flagsN;
-			}
+		ucinfo->grouped = 1;
+		ucinfo->signature = info->sig.sigInt;
+		*tail = ucinfo;
+		tail = &ucinfo->next;
+		r = intel_findrepofile( params, ucinfo, ucinfo->signature);
+		if (r > 0) {
+			INFO( 0, "No microcode file found for cores with signature %08x\n", ucinfo->signature);
+			r = 0;
+		} else if (!r) {
+			++nfound;
+			r = intel_checkucfile( params, ucinfo);
 		}
 	}
+	if (!r && nfound == 0)
+		r = 1;
 	return r;
 }
 
 
+// formats the date into datestr, which must hold DATELEN chars
 static char *
-getdatestr( uint32_t datefield)
+getdatestr( uint32_t datefield, char *datestr)
 {
-	static char datestr[ 11];
 	/* create internal update file date, re-form from mmddyyyy to yyyymmdd */
 	int m = datefield >> 24;
 	int d = (datefield >> 16) & 0xff;
@@ -697,8 +977,10 @@ static void
 intel_printHeadersInfo( struct intel_hdrhdr_t *hdrhdr)
 {
 	struct intel_uc_header_t *hdr = (struct intel_uc_header_t *) hdrhdr->image;
+	char datestr[ DATELEN];
+
 	intel_printSignatInfo( &(hdr->cpu_signature), INDENT_0);
-	INFO( 11, "%sDate %s\n", INDENT_0, getdatestr( hdr->date));
+	INFO( 11, "%sDate %s\n", INDENT_0, getdatestr( hdr->date, datestr));
 	INFO( 10, "%sucode rev  0x%08x\n", INDENT_0, hdr->revision);
 	INFO( 12, "%sHeader ver 0x%08x\n", INDENT_0, hdr->header_version);
 	INFO( 12, "%sLoader rev 0x%08x\n", INDENT_0, hdr->loader_revision);
@@ -723,54 +1005,87 @@ intel_printHeadersInfo( struct intel_hdrhdr_t *hdrhdr)
 } 
 
 
-int
-intel_printmicrocodestats( struct cpupdate_params *params)
+static int
+intel_printblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg)
 {
-	struct intel_ucinfo *ucinfo;
-    struct intel_hdrhdr_t *thdrhdr;
+	if (params->report != NULL) {
+		struct intel_ucinfo *ucinfo = (struct intel_ucinfo *) params->ucodeinfop;
+		struct intel_uc_header_t *hdr = (struct intel_uc_header_t *) hdrhdr->image;
+		struct report_rec rec = { .type = REPORT_BLOB };
 
-	ucinfo = params->ucodeinfop;
-    for (int n = 0; n < ucinfo->blobcount; ++n) {
-    	thdrhdr = &ucinfo->hdrhdrs[ n];
-    	INFO( 10, "Blob %d of %d headers info:\n", n + 1, ucinfo->blobcount);
-    	intel_printHeadersInfo( thdrhdr);
+		rec.signature = hdr->cpu_signature;
+		rec.flags = hdr->cpu_flags;
+		rec.revision = hdr->revision;
+		rec.date = hdr->date;
+		rec.datasize = hdrhdr->data_size;
+		rec.totalsize = hdrhdr->total_size;
+		rec.count = hdrhdr->has_ext_table ? hdrhdr->ext_header->sig_count : 0;
+		rec.offset = hdrhdr->image - (uint8_t *) ucinfo->image;
+		report_row( params->report, &rec, ucinfo->path);
+		return 0;
 	}
+	INFO( 10, "Blob %d of %d headers info:\n", n + 1, count);
+	intel_printHeadersInfo( hdrhdr);
 	return 0;
 }
 
 
+int
+intel_printmicrocodestats( struct cpupdate_params *params)
+{
+	return intel_foreachblob( params, intel_printblob, NULL);
+}
+
+
 int
 intel_update( struct cpupdate_params *params)
 {
 	struct intel_ProcessorInfo *pcoreinfo = (struct intel_ProcessorInfo *) params->coreinfop;
-	struct intel_ucinfo *ucinfo = (struct intel_ucinfo *) params->ucodeinfop;
+	struct intel_ucinfo *ucinfo;
 	struct intel_ProcessorInfo *coreinfo;
 	char cpupath[ MAXPATHLEN];
-	int core = 0;
+	int order[ MAXCORES];
+	int updated = 0;			// number of cores updated so far, for the rolling mode batches
+	int core, n, ncores;
 	int r = 0;
 
 	assert( pcoreinfo != NULL);
-	assert( ucinfo != NULL);
+	assert( params->ucodeinfop != NULL);
 	
-	// walk each core and check update file for optimum blob
-	for ( ; core < numCores ; ++core) {
+	for (ucinfo = params->ucodeinfop; ucinfo != NULL; ucinfo = ucinfo->next)
+		if (ucinfo->istext) {
+			INFO( 0, "File %s is in text format, please convert it with -C first\n", ucinfo->path);
+			return 1;
+		}
+	memset( params->changed, 0, sizeof( params->changed));
+	memset( params->updfailed, 0, sizeof( params->updfailed));
+	params->nchanged = 0;
+	// walk each core (the exclusion set ones last) and check update file for optimum blob
+	ncores = cpu_updateorder( params, order);
+	for (n = 0; n < ncores; ++n) {
 //		struct intel_flagmatch        flagmatch;
 //		flagmatch.headerindex = -1;
 		struct intel_flagmatch        match;
 //		flagmatch.headerindex = -1;
 
+		core = order[ n];
 		coreinfo = pcoreinfo + core;
 		
 		// reload the core information, in case we have a faked core
 		r = intel_getCoreInfo( coreinfo, core);
 //			match.headerindex = -1;
 		match.blobindex = -1;
+		// the file loaded for the core's signature group
+		if ((ucinfo = intel_findgroup( params, coreinfo->sig.sigInt)) == NULL || ucinfo->image == NULL) {
+			INFO( 11, "No microcode file for core %d. Not updated.\n", core);
+			continue;
+		}
 		
 		// If more than one blob matches the cpu flags, use the latest one
 //		uint32_t cpu_flags_hit = ((struct intel_uc_header_t *) &ucinfo->hdrhdrs[ 0])->cpu_flags;
 		struct intel_hdrhdr_t *thdrhdr;
-		for (int n = 0; n < ucinfo->blobcount; ++n, ++thdrhdr) {
-			thdrhdr = &ucinfo->hdrhdrs[ n];
+		for (int b = 0; b < ucinfo->blobcount; ++b) {
+			thdrhdr = &ucinfo->hdrhdrs[ b];
 			struct intel_uc_header_t *thdr = (struct intel_uc_header_t *) thdrhdr->image;
 			if (coreinfo->flags & thdr->cpu_flags) {
 				/* flags match. in case there were previous matches, 
@@ -779,13 +1094,13 @@ intel_update( struct cpupdate_params *params)
 				if (match.blobindex < 0) {
 					/* first match */
 /*					match.headerindex = 0;			/ *  apparently not used yet by Intel */
-					match.blobindex = n;
+					match.blobindex = b;
 					match.bestrev = thdr->revision;
 				} else {
 					/* second or higher match: check whether this match is more recent rev than previous one(s) */
 					if ( match.bestrev < thdr->revision) {
 /*						match.headerindex = 0;		/ *  apparently not used yet by Intel */
-						match.blobindex = n;
+						match.blobindex = b;
 						match.bestrev = thdr->revision;
 					}
 				}
@@ -808,7 +1123,7 @@ intel_update( struct cpupdate_params *params)
 			struct cpuinfoBitF *ucf_sig = (struct cpuinfoBitF *) &(hdr->cpu_signature);
 			// family, model and stepping must be identical, and the microcode revision 
 			// of the update file must be higher than that of the processor
-			int cpufd;
+			int cpufd = -1;
 			
 			sprintf( cpupath, "/dev/cpuctl%d", core);
 	    	if (	coreinfo->sig.sigBitF.SteppingID		!= ucf_sig->SteppingID 			||
@@ -817,7 +1132,7 @@ intel_update( struct cpupdate_params *params)
 	    			coreinfo->sig.sigBitF.ProcessorType		!= ucf_sig->ProcessorType		||
 	    			coreinfo->sig.sigBitF.ExtendedModelID	!= ucf_sig->ExtendedModelID		||
 	    			coreinfo->sig.sigBitF.ExtendedFamilyID	!= ucf_sig->ExtendedFamilyID ) {
-				INFO( 0, "Umm... update file %s should match, but somehow doesn't. Not updated.\n", params->filepath);
+				INFO( 0, "Umm... update file %s should match, but somehow doesn't. Not updated.\n", ucinfo->path);
 				r = -1;
 			} else if (coreinfo->ucoderev >= hdr->revision) {
 				INFO( 11, "Core %d is up-to-date. Not updated.\n", core);
@@ -827,7 +1142,7 @@ intel_update( struct cpupdate_params *params)
 			} else if (!(hdr->cpu_flags & 0xff & coreinfo->flags)) {
 				INFO( 0, "Processor flags do not match, cannot apply update.\n");
 				r = -1;
-			} else if ((cpufd = open( cpupath, O_RDWR)) < 0) {
+			} else if ((cpufd = devio_open( core, O_RDWR)) < 0) {
 				INFO( 0, "Failed to open %s for writing\n", cpupath);
 				r = 1;
 			} else {
@@ -836,18 +1151,29 @@ intel_update( struct cpupdate_params *params)
 				args.data = hdr + 1;
 				args.size = hdrhdr->data_size;
 				if (params->writeit) {
-					r = ioctl( cpufd, CPUCTL_UPDATE, &args);
+					uint64_t t0 = cpu_nsecs();
+					r = devio_ioctl( cpufd, CPUCTL_UPDATE, &args);
+					cpu_addupdtime( params, core, cpu_nsecs() - t0);
 				} else {
 					INFO( 12, "(Simulated only!) ");
 					r = 0;
 				}
 				if (!r) {
+					int32_t oldrev = coreinfo->ucoderev;
+
 					INFO( 11, "Updated core %d from microcode revision 0x%04x to 0x%04x\n", 
 							core, coreinfo->ucoderev, hdr->revision);
+					// re-read the revision to record whether the core actually moved
+					if (params->writeit && intel_getCoreInfo( coreinfo, core) == 0 && 
+							coreinfo->ucoderev != oldrev)
+						cpu_setchanged( params, core);
+					cpu_batchpause( params, ++updated, n + 1 < ncores);
 				} else {
 					INFO( 0, "Updating core %d failed!\n", core);
 				}
 			}
+			if (r)
+				params->updfailed[ core] = 1;
 			if (cpufd >= 0)
 				close( cpufd);
 		}
@@ -860,60 +1186,89 @@ int
 intel_freeucodeinfo( struct cpupdate_params *params)
 {
 	struct intel_ucinfo 
-			*ucinfo = (struct intel_ucinfo *) params->ucodeinfop;
+			*ucinfo = (struct intel_ucinfo *) params->ucodeinfop,
+			*next;
 	
-	if (ucinfo != NULL) {
+	for ( ; ucinfo != NULL; ucinfo = next) {
+		next = ucinfo->next;
 		if (ucinfo->image != NULL)
 			free( ucinfo->image);
 		free( ucinfo);
-		params->ucodeinfop = NULL;
 	}
+	params->ucodeinfop = NULL;
 	return 0;
 }
 
 
+// adds data to the output file opath, through the batch of params->out if there is one
+static int
+intel_output( struct cpupdate_params *params, const char *opath, const void *data, size_t size, int append)
+{
+	struct owriter ow;
+	int r;
+
+	if (params->out != NULL)
+		return owrite_put( params->out, opath, data, size, append);
+	owrite_init( &ow, params->targetdir);
+	if (!(r = owrite_put( &ow, opath, data, size, append)))
+		r = owrite_commit( &ow);
+	owrite_free( &ow);
+	return r;
+}
+
+
+// writes the blob to its own ff-mm-ss-flags file
+static int
+intel_extractblob( struct cpupdate_params *params, struct intel_hdrhdr_t *thdrhdr, int n, int count, void *arg)
+{
+	struct intel_uc_header_t *hdr = (struct intel_uc_header_t *) thdrhdr->image;
+	union intel_SignatUnion  sig;
+	char 					 opath[ MAXPATHLEN];
+	int 					 r = 0;
+
+	sig.sigInt = hdr->cpu_signature;
+	if (snprintf( opath, sizeof( opath), "%s/%02x-%02x-%02x-%x", params->targetdir, 
+			 intel_getFamily( &hdr->cpu_signature),
+			 intel_getModel( &hdr->cpu_signature),
+			 sig.sigBitF.SteppingID,
+			 hdr->cpu_flags) >= sizeof( opath)) {
+		INFO( 0, "filename buffer too short for %s\n", opath);
+		r = 1;
+	} else {
+		INFO( 10, "Writing output file %s from blob %d of %d\n", opath, n, count);
+		r = intel_output( params, opath, thdrhdr->image, thdrhdr->total_size, 0);
+	}
+	return r;
+}
+
+
 int
 intel_extractformat( struct cpupdate_params *params)
 {
-	struct intel_ucinfo 
-			*ucinfo = (struct intel_ucinfo *) params->ucodeinfop;
-	struct intel_uc_header_t *hdr;
-    struct intel_hdrhdr_t 	*thdrhdr;
+	assert( params->ucodeinfop != NULL);
+	return intel_foreachblob( params, intel_extractblob, NULL);
+}
+
+
+// appends the blob to the multi-blobbed ff-mm-ss file
+static int
+intel_compactblob( struct cpupdate_params *params, struct intel_hdrhdr_t *thdrhdr, int n, int count, void *arg)
+{
+	struct intel_uc_header_t *hdr = (struct intel_uc_header_t *) thdrhdr->image;
 	union intel_SignatUnion  sig;
 	char 					 opath[ MAXPATHLEN];
-	int 					 blob = 0;
 	int 					 r = 0;
-	FILE					*ofp;
-	assert( ucinfo != NULL);
-	
-	for ( ; r == 0 && blob < ucinfo->blobcount; ++blob) {
-    	thdrhdr = &ucinfo->hdrhdrs[ blob];
-		hdr = (struct intel_uc_header_t *) thdrhdr->image;
-		sig.sigInt = hdr->cpu_signature;
-		if (snprintf( opath, sizeof( opath), "%s/%02x-%02x-%02x-%x", params->targetdir, 
-				 intel_getFamily( &hdr->cpu_signature),
-				 intel_getModel( &hdr->cpu_signature),
-				 sig.sigBitF.SteppingID,
-				 hdr->cpu_flags) >= sizeof( opath)) {
-			INFO( 0, "filename buffer too short for %s\n", opath);
-			r = 1;
-		} else {
-			INFO( 10, "Writing output file %s from blob %d of %d\n", opath, blob, ucinfo->blobcount);
-			ofp = fopen( opath, "w");
-			if (ofp == NULL) {
-				INFO( 0, "error opening output file %s\n", opath);
-				r = 1;
-			} else {
-				if (fwrite( thdrhdr->image, thdrhdr->total_size, 1, ofp) < 1) {
-					INFO( 0, "error writing to file %s\n", opath);
-					r = 1;
-				}
-				if (fclose( ofp)) {
-					INFO( 0, "error closing file %s\n", opath);
-					r = 1;
-				}
-			}
-		}
+
+	sig.sigInt = hdr->cpu_signature;
+	if (snprintf( opath, sizeof( opath), "%s/%02x-%02x-%02x", params->targetdir, 
+			 intel_getFamily( &hdr->cpu_signature),
+			 intel_getModel( &hdr->cpu_signature),
+			 sig.sigBitF.SteppingID) >= sizeof( opath)) {
+		INFO( 0, "filename buffer too short for %s\n", opath);
+		r = 1;
+	} else {
+		INFO( 10, "Appending blob %d of %s\n...to output file %s\n", n, params->filepath, opath);
+		r = intel_output( params, opath, thdrhdr->image, thdrhdr->total_size, 1);
 	}
 	return r;
 }
@@ -924,49 +1279,1177 @@ intel_compactformat( struct cpupdate_params *params)
 {
 	struct intel_ucinfo 
 			*ucinfo = (struct intel_ucinfo *) params->ucodeinfop;
-	struct intel_uc_header_t *hdr;
-    struct intel_hdrhdr_t 	*thdrhdr;
-	union intel_SignatUnion  sig;
-	char 					 opath[ MAXPATHLEN];
-	int 					 blob = 0;
-	int 					 r = 0;
-	FILE					*ofp;
 	assert( ucinfo != NULL);
 	
-	if (ucinfo->blobcount > 1) {
+	// text format files get split up, other multi-blobbed files are already compact
+	if (!ucinfo->istext && ucinfo->blobcount > 1) {
 		INFO( 10, "The file %s has more than 1 blob, skipped!\n", params->filepath);
+		return 0;
+	}
+	return intel_foreachblob( params, intel_compactblob, NULL);
+}
+
+
+struct intel_packstate {
+	struct cpupdate_params
+			   *params;
+	struct pack_writer
+				pw;
+	int			nfiles,
+				nbad;
+};
+
+
+static int
+intel_packblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg)
+{
+	struct intel_packstate *ps = arg;
+	struct intel_uc_header_t *hdr = (struct intel_uc_header_t *) hdrhdr->image;
+
+	return pack_add( &ps->pw, hdr->cpu_signature, hdr->cpu_flags, hdr->revision, hdr->date,
+				hdr, hdrhdr->total_size);
+}
+
+
+// scan_tree() callback for intel_pack: adds all blobs of a valid file to the container
+static int
+intel_packfile( int dfd, const char *name, const char *path, void *arg)
+{
+	struct intel_packstate *ps = arg;
+	struct cpupdate_params *params = ps->params;
+	int r = 0;
+
+	strcpy( params->filepath, path);
+	params->filedirfd = dfd;
+	params->filename = name;
+	if (intel_loadcheckmicrocode( params)) {
+		INFO( 0, "Error with microcode file %s, skipping that file\n", path);
+		++ps->nbad;
 	} else {
-		thdrhdr = &ucinfo->hdrhdrs[ 0];
-		hdr = (struct intel_uc_header_t *) thdrhdr->image;
-		sig.sigInt = hdr->cpu_signature;
-		if (snprintf( opath, sizeof( opath), "%s/%02x-%02x-%02x", params->targetdir, 
-				 intel_getFamily( &hdr->cpu_signature),
-				 intel_getModel( &hdr->cpu_signature),
-				 sig.sigBitF.SteppingID) >= sizeof( opath)) {
-			INFO( 0, "filename buffer too short for %s\n", opath);
-			r = 1;
-		} else {
-			INFO( 10, "Appending blob %s\n...to output file %s\n", params->filepath, opath);
-			ofp = fopen( opath, "ab");
-			if (ofp == NULL) {
-				INFO( 0, "error opening output file %s\n", opath);
-				r = 1;
-			} else {
-				if (fwrite( thdrhdr->image, thdrhdr->total_size, 1, ofp) < 1) {
-					INFO( 0, "error writing to file %s\n", opath);
-					r = 1;
-				}
-				if (fclose( ofp)) {
-					INFO( 0, "error closing file %s\n", opath);
-					r = 1;
-				}
-			}
-		}
+		++ps->nfiles;
+		r = intel_foreachblob( params, intel_packblob, ps);
 	}
+	intel_freeucodeinfo( params);
+	params->filename = NULL;
+	return r;
+}
+
+
+int
+intel_pack( struct cpupdate_params *params)
+{
+	struct intel_packstate ps;
+	int r;
+
+	memset( &ps, 0, sizeof( ps));
+	ps.params = params;
+	ps.pw.compress = params->packcompress;
+	r = scan_tree( params->srcdir, params->pattern, intel_packfile, &ps);
+	INFO( 10, "%d files packed, %d files skipped\n", ps.nfiles, ps.nbad);
+	if (!r)
+		r = pack_write( &ps.pw, params->packpath);
+	pack_freewriter( &ps.pw);
 	return r;
 }
 
 
+struct intel_prunestate {
+	struct cpupdate_params
+			   *params;
+	struct prune_set
+				set;
+	int			file;		// index of the file being scanned
+	int			nbad,
+				ntext;
+};
+
+
+// orders blobs by flags, then revision
+static int
+intel_cmphdrhdr( const void *a, const void *b)
+{
+	const struct intel_uc_header_t *ha = (const struct intel_uc_header_t *) ((const struct intel_hdrhdr_t *) a)->image;
+	const struct intel_uc_header_t *hb = (const struct intel_uc_header_t *) ((const struct intel_hdrhdr_t *) b)->image;
+
+	if (ha->cpu_flags != hb->cpu_flags)
+		return (ha->cpu_flags < hb->cpu_flags) ? -1 : 1;
+	if (ha->revision != hb->revision)
+		return ((uint32_t) ha->revision < (uint32_t) hb->revision) ? -1 : 1;
+	return 0;
+}
+
+
+static int
+intel_pruneblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg)
+{
+	struct intel_prunestate *ps = arg;
+	struct intel_uc_header_t *hdr = (struct intel_uc_header_t *) hdrhdr->image;
+
+	return prune_addrec( &ps->set, ps->file, n, hdr->cpu_signature, hdr->cpu_flags, hdr->revision,
+				hdrhdr->total_size);
+}
+
+
+// scan_tree() callback for intel_prune: records all blobs of a valid file
+static int
+intel_prunefile( int dfd, const char *name, const char *path, void *arg)
+{
+	struct intel_prunestate *ps = arg;
+	struct cpupdate_params *params = ps->params;
+	struct intel_ucinfo *ucinfo;
+	int sorted = 1, r = 0;
+
+	strcpy( params->filepath, path);
+	params->filedirfd = dfd;
+	params->filename = name;
+	if (intel_loadcheckmicrocode( params)) {
+		INFO( 0, "Error with microcode file %s, skipping that file\n", path);
+		++ps->nbad;
+	} else if ((ucinfo = params->ucodeinfop)->istext) {
+		// text files are not rewritten, convert them with -C first
+		INFO( 11, "File %s is in text format, skipping that file\n", path);
+		++ps->ntext;
+	} else {
+		for (int n = 1; n < ucinfo->blobcount; ++n)
+			if (intel_cmphdrhdr( &ucinfo->hdrhdrs[ n - 1], &ucinfo->hdrhdrs[ n]) > 0)
+				sorted = 0;
+		if ((ps->file = prune_addfile( &ps->set, path, ucinfo->imagesize, ucinfo->blobcount, sorted)) < 0)
+			r = 1;
+		else
+			r = intel_foreachblob( params, intel_pruneblob, ps);
+	}
+	intel_freeucodeinfo( params);
+	params->filename = NULL;
+	return r;
+}
+
+
+/* rewrites file f of set with its kept blobs only, sorted, through a temporary file
+ * renamed over it. the file is loaded again and must still hold the blobs scanned
+ */
+static int
+intel_rewritefile( struct cpupdate_params *params, struct prune_set *set, int f)
+{
+	struct prune_file *pf = &set->files[ f];
+	struct intel_ucinfo *ucinfo;
+	struct intel_hdrhdr_t kept[ MAXHEADERS];
+	char	tmppath[ MAXPATHLEN];
+	int		nkept = 0, fd, r = 0;
+
+	strcpy( params->filepath, pf->path);
+	if (intel_loadcheckmicrocode( params) || (ucinfo = params->ucodeinfop)->blobcount != pf->nblobs) {
+		INFO( 0, "File %s changed while pruning, skipping that file\n", pf->path);
+		intel_freeucodeinfo( params);
+		params->filepath[ 0] = '\0';
+		return 1;
+	}
+	for (int i = 0; i < set->nrecs; ++i)
+		if (set->recs[ i].file == f && set->recs[ i].keep)
+			kept[ nkept++] = ucinfo->hdrhdrs[ set->recs[ i].blob];
+	qsort( kept, nkept, sizeof( kept[ 0]), intel_cmphdrhdr);
+	if (snprintf( tmppath, sizeof( tmppath), "%s.XXXXXX", pf->path) >= sizeof( tmppath)) {
+		INFO( 0, "filename buffer too short for %s\n", tmppath);
+		r = 1;
+	} else if ((fd = mkstemp( tmppath)) < 0) {
+		INFO( 0, "error opening output file %s\n", tmppath);
+		r = 1;
+	} else {
+		fchmod( fd, 0644);
+		for (int i = 0; !r && i < nkept; ++i)
+			if (write( fd, kept[ i].image, kept[ i].total_size) != (ssize_t) kept[ i].total_size)
+				r = 1;
+		if (!r && fsync( fd) < 0)
+			r = 1;
+		if (close( fd) < 0)
+			r = 1;
+		if (!r && rename( tmppath, pf->path) < 0)
+			r = 1;
+		if (r) {
+			INFO( 0, "error writing file %s\n", pf->path);
+			unlink( tmppath);
+		}
+	}
+	intel_freeucodeinfo( params);
+	params->filepath[ 0] = '\0';
+	return r;
+}
+
+
+/* keeps only the newest params->prunekeep revisions per signature and flags, plus the
+ * pinned ones, of the repository in srcdir. files left without blobs are removed, the
+ * others rewritten if blobs went away or were out of order. without writeit only reports
+ */
+int
+intel_prune( struct cpupdate_params *params)
+{
+	struct intel_prunestate ps;
+	struct prune_file *pf;
+	off_t	newsize, reclaimed = 0;
+	int		nremoved = 0, nrewritten = 0, r;
+
+	memset( &ps, 0, sizeof( ps));
+	ps.params = params;
+	r = scan_tree( params->srcdir, params->pattern, intel_prunefile, &ps);
+	INFO( 10, "%d files with %d blobs scanned, %d invalid and %d text format files skipped\n", 
+			ps.set.nfiles, ps.set.nrecs, ps.nbad, ps.ntext);
+	if (!r)
+		prune_select( &ps.set, params->prunekeep, params->pinsig, params->pinrev, params->npins);
+	for (int f = 0; !r && f < ps.set.nfiles; ++f) {
+		pf = &ps.set.files[ f];
+		if (pf->nkept == 0) {
+			INFO( 11, "%s %s: all %d blobs superseded\n", params->writeit ? "Removing" : "Would remove", 
+					pf->path, pf->nblobs);
+			if (params->writeit && unlink( pf->path) < 0) {
+				INFO( 0, "error removing file %s\n", pf->path);
+				continue;
+			}
+			reclaimed += pf->size;
+			++nremoved;
+		} else if (pf->nkept < pf->nblobs || !pf->sorted) {
+			INFO( 11, "%s %s: keeping %d of %d blobs\n", params->writeit ? "Rewriting" : "Would rewrite",
+					pf->path, pf->nkept, pf->nblobs);
+			if (params->writeit && intel_rewritefile( params, &ps.set, f))
+				continue;
+			newsize = 0;
+			for (int i = 0; i < ps.set.nrecs; ++i)
+				if (ps.set.recs[ i].file == f && ps.set.recs[ i].keep)
+					newsize += ps.set.recs[ i].size;
+			reclaimed += pf->size - newsize;
+			++nrewritten;
+		}
+	}
+	INFO( 10, "%s%d files removed, %d files rewritten, %jd bytes reclaimed\n", 
+			params->writeit ? "" : "(Simulated only!) ", nremoved, nrewritten, (intmax_t) reclaimed);
+	prune_free( &ps.set);
+	return r;
+}
+
+
+// the early load archive's microcode bundle, the kernel looks for this name
+#define EARLY_BUNDLE_DIRS	{ "kernel", "kernel/x86", "kernel/x86/microcode" }
+#define EARLY_BUNDLE_NAME	("kernel/x86/microcode/GenuineIntel.bin")
+
+struct intel_earlystate {
+	uint32_t	signature;		// of the file walked
+	uint32_t   *tflags;			// platform flags of the targets
+	struct intel_hdrhdr_t
+			   *best;			// per target: newest matching blob found
+	int			ntargets;
+};
+
+
+// for each target of the walked file's signature, keeps the newest blob matching its platform flags
+static int
+intel_earlyblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg)
+{
+	struct intel_earlystate *es = arg;
+	struct intel_uc_header_t *hdr = (struct intel_uc_header_t *) hdrhdr->image;
+
+	if (hdr->cpu_signature != es->signature)
+		return 0;
+	for (int t = 0; t < es->ntargets; ++t)
+		if ((hdr->cpu_flags & es->tflags[ t]) && (es->best[ t].image == NULL ||
+				(uint32_t) hdr->revision > (uint32_t) ((struct intel_uc_header_t *) es->best[ t].image)->revision))
+			es->best[ t] = *hdrhdr;
+	return 0;
+}
+
+
+/* writes an uncompressed early load cpio to params->cpiopath, holding only the blobs
+ * for the targets: the signature and platform flags pairs given, or the probed cores.
+ * the blobs are looked up in the repository and selected as for updating
+ */
+int
+intel_earlycpio( struct cpupdate_params *params)
+{
+	static const char *dirs[] = EARLY_BUNDLE_DIRS;
+	uint32_t	sig[ MAXCORES], flags[ MAXCORES];
+	struct intel_hdrhdr_t best[ MAXCORES];
+	struct intel_earlystate es;
+	struct intel_ucinfo ucinfo;
+	struct cpio_writer cw;
+	uint8_t	   *bundle = NULL;
+	size_t		bsize = 0;
+	int			ntargets = 0, nblobs = 0, i, t, r = 0;
+
+	// the distinct targets
+	if (params->ntargets == 0) {
+		struct intel_ProcessorInfo *info = (struct intel_ProcessorInfo *) params->coreinfop;
+
+		assert( info != NULL);
+		for (i = 0; i < params->numcores; ++i) {
+			params->targetsig[ i] = info[ i].sig.sigInt;
+			params->targetflags[ i] = info[ i].flags;
+		}
+		params->ntargets = params->numcores;
+	}
+	for (i = 0; i < params->ntargets; ++i) {
+		for (t = 0; t < ntargets; ++t)
+			if (sig[ t] == params->targetsig[ i] && flags[ t] == params->targetflags[ i])
+				break;
+		if (t == ntargets) {
+			sig[ ntargets] = params->targetsig[ i];
+			flags[ ntargets++] = params->targetflags[ i];
+		}
+	}
+	// one repository lookup per signature, then pick the blobs for all of its targets
+	for (i = 0; !r && i < ntargets; ++i) {
+		for (t = 0; t < i; ++t)
+			if (sig[ t] == sig[ i])
+				break;
+		if (t < i)
+			continue;			// signature done already
+		memset( &ucinfo, 0, sizeof( ucinfo));
+		if ((r = intel_findrepofile( params, &ucinfo, sig[ i])) > 0) {
+			INFO( 0, "No microcode file found for signature %08x\n", sig[ i]);
+			r = 0;
+			continue;
+		}
+		if (!r)
+			r = intel_checkucfile( params, &ucinfo);
+		if (!r) {
+			memset( best, 0, sizeof( best));
+			es.signature = sig[ i];
+			es.tflags = flags + i;
+			es.best = best;
+			es.ntargets = ntargets - i;
+			r = intel_foreachblobof( params, &ucinfo, intel_earlyblob, &es);
+		}
+		for (t = 0; !r && t < ntargets - i; ++t) {
+			struct intel_hdrhdr_t *b = &best[ t];
+			uint8_t *nb;
+			int		d;
+
+			if (sig[ i + t] != sig[ i])
+				continue;
+			if (b->image == NULL) {
+				INFO( 0, "No microcode for signature %08x and platform flags %02x in %s\n", 
+						sig[ i + t], flags[ i + t], ucinfo.path);
+				continue;
+			}
+			// targets differing in flags may share a blob
+			for (d = 0; d < t && best[ d].image != b->image; ++d)
+				;
+			if (d < t)
+				continue;
+			if ((nb = realloc( bundle, bsize + b->total_size)) == NULL) {
+				INFO( 0, "Buffer allocation of %zu bytes failed\n", bsize + b->total_size);
+				r = 1;
+				break;
+			}
+			bundle = nb;
+			memcpy( bundle + bsize, b->image, b->total_size);
+			bsize += b->total_size;
+			++nblobs;
+			INFO( 11, "Adding revision 0x%08x for signature %08x and platform flags %02x from %s\n", 
+					((struct intel_uc_header_t *) b->image)->revision, sig[ i + t], flags[ i + t], ucinfo.path);
+		}
+		free( ucinfo.image);
+	}
+	if (!r && nblobs == 0) {
+		INFO( 0, "No microcode found for any of the CPUs, nothing written\n");
+		r = 1;
+	}
+	if (!r && !(r = cpio_open( &cw, params->cpiopath))) {
+		for (i = 0; i < (int) nitems( dirs); ++i)
+			cpio_add( &cw, dirs[ i], CPIO_MODE_DIR, NULL, 0);
+		cpio_add( &cw, EARLY_BUNDLE_NAME, CPIO_MODE_FILE, bundle, bsize);
+		r = cpio_close( &cw);
+		if (!r)
+			INFO( 10, "Wrote %s: %d blobs, %zu bytes of microcode\n", params->cpiopath, nblobs, bsize);
+	}
+	free( bundle);
+	return r;
+}
+
+
+struct intel_syncstate {
+	struct cpupdate_params
+			   *params;
+	struct sync_tree
+			   *tree;
+	int			file;		// index of the file being scanned
+	int			skiptext;	// bool: ignore text format files (in the target tree)
+	int			nbad;
+};
+
+
+static int
+intel_syncblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg)
+{
+	struct intel_syncstate *ss = arg;
+	struct intel_uc_header_t *hdr = (struct intel_uc_header_t *) hdrhdr->image;
+
+	return sync_addrec( ss->tree, ss->file, n, hdr->cpu_signature, hdr->cpu_flags, hdr->revision,
+				hdrhdr->image, hdrhdr->total_size);
+}
+
+
+// scan_tree() callback for intel_sync: records all blobs of a valid file
+static int
+intel_syncfile( int dfd, const char *name, const char *path, void *arg)
+{
+	struct intel_syncstate *ss = arg;
+	struct cpupdate_params *params = ss->params;
+	int r = 0;
+
+	strcpy( params->filepath, path);
+	params->filedirfd = dfd;
+	params->filename = name;
+	if (intel_loadcheckmicrocode( params)) {
+		INFO( 0, "Error with microcode file %s, skipping that file\n", path);
+		++ss->nbad;
+	} else if (ss->skiptext && ((struct intel_ucinfo *) params->ucodeinfop)->istext) {
+		INFO( 11, "File %s is in text format, skipping that file\n", path);
+	} else if ((ss->file = sync_addfile( ss->tree, path)) < 0) {
+		r = 1;
+	} else
+		r = intel_foreachblob( params, intel_syncblob, ss);
+	intel_freeucodeinfo( params);
+	params->filename = NULL;
+	params->filepath[ 0] = '\0';
+	return r;
+}
+
+
+struct intel_syncout {
+	int			fd;
+	int			want;		// index of the blob to write
+	int			found;		// bool
+};
+
+
+static int
+intel_syncputblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg)
+{
+	struct intel_syncout *so = arg;
+
+	if (n != so->want)
+		return 0;
+	so->found = (write( so->fd, hdrhdr->image, hdrhdr->total_size) == (ssize_t) hdrhdr->total_size);
+	return 1;
+}
+
+
+/* writes the distinct blobs src->recs[ first..first+n), which are sorted, to opath through
+ * a temporary file. the blobs are read again from their source files
+ */
+static int
+intel_syncwrite( struct cpupdate_params *params, struct sync_tree *src, int first, int n, const char *opath)
+{
+	struct intel_syncout so;
+	char	tmppath[ MAXPATHLEN];
+	int		loaded = -1, r = 0;
+
+	if (snprintf( tmppath, sizeof( tmppath), "%s.XXXXXX", opath) >= sizeof( tmppath)) {
+		INFO( 0, "filename buffer too short for %s\n", tmppath);
+		return 1;
+	}
+	if ((so.fd = mkstemp( tmppath)) < 0) {
+		INFO( 0, "error opening output file %s\n", tmppath);
+		return 1;
+	}
+	fchmod( so.fd, 0644);
+	for (int i = first; !r && i < first + n; ++i) {
+		struct sync_rec *rec = &src->recs[ i];
+
+		if (i > first && !sync_cmpkey( rec - 1, rec))
+			continue;
+		// consecutive blobs mostly come from the same file, keep it loaded
+		if (rec->file != loaded) {
+			intel_freeucodeinfo( params);
+			strcpy( params->filepath, src->paths[ rec->file]);
+			if (intel_loadcheckmicrocode( params)) {
+				INFO( 0, "File %s changed while syncing\n", params->filepath);
+				r = 1;
+				break;
+			}
+			loaded = rec->file;
+		}
+		so.want = rec->blob;
+		so.found = 0;
+		intel_foreachblob( params, intel_syncputblob, &so);
+		if (!so.found) {
+			INFO( 0, "error writing file %s\n", tmppath);
+			r = 1;
+		}
+	}
+	intel_freeucodeinfo( params);
+	params->filepath[ 0] = '\0';
+	if (!r && fsync( so.fd) < 0)
+		r = 1;
+	if (close( so.fd) < 0)
+		r = 1;
+	if (!r && rename( tmppath, opath) < 0) {
+		INFO( 0, "error renaming %s to %s\n", tmppath, opath);
+		r = 1;
+	}
+	if (r)
+		unlink( tmppath);
+	return r;
+}
+
+
+/* compares the blobs of the trees in srcdir and targetdir by signature, flags, revision
+ * and content, and rewrites only the target files of the signatures that differ. the
+ * target is kept in multi-blobbed format, one family-model-stepping file per signature,
+ * as -C writes it. files of signatures gone from the source and files under other names
+ * are removed. without writeit only reports
+ */
+int
+intel_sync( struct cpupdate_params *params)
+{
+	struct intel_syncstate ss;
+	struct sync_tree src, tgt;
+	char	tdir[ MAXPATHLEN], opath[ MAXPATHLEN], name[ 16];
+	char   *keep = NULL, *mixed = NULL;
+	int		i = 0, j = 0, ns, nt, r;
+	int		nsame = 0, nwritten = 0, nremoved = 0, nadded = 0, ndropped = 0;
+
+	memset( &src, 0, sizeof( src));
+	memset( &tgt, 0, sizeof( tgt));
+	memset( &ss, 0, sizeof( ss));
+	ss.params = params;
+	ss.tree = &src;
+	r = scan_tree( params->srcdir, params->pattern, intel_syncfile, &ss);
+	if (!r) {
+		ss.tree = &tgt;
+		ss.skiptext = 1;
+		r = scan_tree( params->targetdir, NULL, intel_syncfile, &ss);
+	}
+	INFO( 11, "Source: %d files, %d blobs. Target: %d files, %d blobs\n", 
+			src.npaths, src.nrecs, tgt.npaths, tgt.nrecs);
+	// the paths of the target files as scan_tree() builds them
+	strcpy( tdir, params->targetdir);
+	while (strlen( tdir) > 1 && tdir[ strlen( tdir) - 1] == '/')
+		tdir[ strlen( tdir) - 1] = '\0';
+	if (!r && ((keep = calloc( tgt.npaths + 1, 1)) == NULL || (mixed = calloc( tgt.npaths + 1, 1)) == NULL)) {
+		INFO( 0, "Could not allocate file table!\n");
+		r = 1;
+	}
+	// a target file is only current if it holds exactly the blobs of the signature it is named for
+	for (int k = 0; !r && k < tgt.nrecs; ++k) {
+		intel_signame( tgt.recs[ k].signature, name, sizeof( name));
+		snprintf( opath, sizeof( opath), "%s/%s", tdir, name);
+		if (strcmp( opath, tgt.paths[ tgt.recs[ k].file]))
+			mixed[ tgt.recs[ k].file] = 1;
+	}
+	if (!r) {
+		sync_sort( &src);
+		sync_sort( &tgt);
+	}
+	while (!r && (i < src.nrecs || j < tgt.nrecs)) {
+		uint32_t sig;
+		int a, b, same = 1, canon = -1;
+
+		if (j >= tgt.nrecs || (i < src.nrecs && src.recs[ i].signature <= tgt.recs[ j].signature))
+			sig = src.recs[ i].signature;
+		else
+			sig = tgt.recs[ j].signature;
+		ns = (i < src.nrecs && src.recs[ i].signature == sig) ? sync_group( &src, i) : 0;
+		nt = (j < tgt.nrecs && tgt.recs[ j].signature == sig) ? sync_group( &tgt, j) : 0;
+		// merge the sorted blob lists: source duplicates are skipped, target duplicates are removals
+		for (a = i, b = j; a < i + ns || b < j + nt; ) {
+			int c = (a == i + ns) ? 1 : (b == j + nt) ? -1 : sync_cmpkey( &src.recs[ a], &tgt.recs[ b]);
+
+			if (c <= 0) {
+				if (c < 0) {
+					++nadded;
+					same = 0;
+				}
+				for (++a; a < i + ns && !sync_cmpkey( &src.recs[ a - 1], &src.recs[ a]); ++a)
+					;
+				if (c < 0)
+					continue;
+			} else {
+				++ndropped;
+				same = 0;
+			}
+			if (mixed[ tgt.recs[ b].file])
+				same = 0;
+			else
+				canon = tgt.recs[ b].file;
+			++b;
+		}
+		if (ns == 0) {
+			INFO( 11, "Signature %08x is gone from the source\n", sig);
+		} else if (same) {
+			++nsame;
+			keep[ canon] = 1;
+		} else {
+			intel_signame( sig, name, sizeof( name));
+			if (snprintf( opath, sizeof( opath), "%s/%s", tdir, name) >= sizeof( opath)) {
+				INFO( 0, "filename buffer too short for %s\n", opath);
+				r = 1;
+				break;
+			}
+			INFO( 11, "%s %s\n", params->writeit ? "Writing" : "Would write", opath);
+			if (params->writeit)
+				r = intel_syncwrite( params, &src, i, ns, opath);
+			++nwritten;
+			// the rewritten file must not be removed below
+			for (int k = j; k < j + nt; ++k)
+				if (!mixed[ tgt.recs[ k].file])
+					keep[ tgt.recs[ k].file] = 1;
+		}
+		i += ns;
+		j += nt;
+	}
+	// what is left are files of signatures gone and files under other names
+	for (int f = 0; !r && f < tgt.npaths; ++f) {
+		if (keep[ f])
+			continue;
+		INFO( 11, "%s %s\n", params->writeit ? "Removing" : "Would remove", tgt.paths[ f]);
+		if (params->writeit && unlink( tgt.paths[ f]) < 0) {
+			INFO( 0, "error removing file %s\n", tgt.paths[ f]);
+			r = 1;
+		}
+		++nremoved;
+	}
+	INFO( 10, "%s%d signatures unchanged, %d files written, %d files removed, %d blobs added, %d blobs dropped\n",
+			params->writeit ? "" : "(Simulated only!) ", nsame, nwritten, nremoved, nadded, ndropped);
+	free( keep);
+	free( mixed);
+	sync_free( &src);
+	sync_free( &tgt);
+	return r;
+}
+
+
+// a blob found by intel_scanimage(), to tell copies of it further on in the image
+struct intel_scanblob {
+	uint32_t	signature,
+				flags,
+				checksum;
+	int32_t		revision;
+	int			intarget;		// bool: already in the target file, not seen in the image yet
+};
+
+
+// adds an entry to the blob table of intel_scanimage(), NULL if out of memory
+static struct intel_scanblob *
+intel_scanadd( struct intel_scanblob **found, int *nfound, int *maxfound, const struct intel_uc_header_t *hdr)
+{
+	struct intel_scanblob *fb;
+
+	if (*nfound == *maxfound) {
+		if ((fb = reallocarray( *found, *maxfound ? 2 * *maxfound : 32, sizeof( **found))) == NULL) {
+			INFO( 0, "Could not allocate blob table!\n");
+			return NULL;
+		}
+		*found = fb;
+		*maxfound = *maxfound ? 2 * *maxfound : 32;
+	}
+	fb = &(*found)[ (*nfound)++];
+	fb->signature = hdr->cpu_signature;
+	fb->flags = hdr->cpu_flags;
+	fb->revision = hdr->revision;
+	fb->checksum = hdr->checksum;
+	fb->intarget = 0;
+	return fb;
+}
+
+
+/* adds the blobs of the existing target file opath to the blob table, so that the
+ * blobs of the image are appended to it only if they are not there yet.
+ * returns 0 if there is no such file, -1 if it is no valid multi-blob file
+ */
+static int
+intel_scantarget( struct cpupdate_params *params, const char *opath, 
+		struct intel_scanblob **found, int *nfound, int *maxfound)
+{
+	struct intel_ucinfo ucinfo;
+	struct intel_scanblob *fb;
+	int r;
+
+	if (access( opath, F_OK))
+		return 0;
+	memset( &ucinfo, 0, sizeof( ucinfo));
+	strcpy( ucinfo.path, opath);
+	if (readucfile( &ucinfo, AT_FDCWD, opath, opath))
+		return -1;
+	r = intel_checkucfile( params, &ucinfo) || ucinfo.istext;
+	for (int i = 0; !r && i < ucinfo.blobcount; ++i) {
+		if ((fb = intel_scanadd( found, nfound, maxfound, 
+				(const struct intel_uc_header_t *) ucinfo.hdrhdrs[ i].image)) == NULL)
+			r = 1;
+		else
+			fb->intarget = 1;
+	}
+	free( ucinfo.image);
+	return r ? -1 : 0;
+}
+
+
+/* lists the microcode blobs embedded in the firmware image filepath with their offsets.
+ * candidates are the dword offsets with header version and loader revision 1 and sizes
+ * that fit, these are confirmed by the checksum and the header checks. with targetdir set,
+ * the blobs are written there as multi-blobbed ff-mm-ss files, copies only once
+ */
+int
+intel_scanimage( struct cpupdate_params *params)
+{
+	const struct intel_uc_header_t *hdr;
+	struct intel_scanblob *found = NULL, *fb;
+	struct intel_hdrhdr_t hdrhdr;
+	struct owriter ow;
+	struct stat st;
+	uint8_t	   *image = MAP_FAILED;
+	size_t		off, size, dsize, total;
+	uint64_t	t;
+	char		opath[ MAXPATHLEN], name[ 16], datestr[ DATELEN];
+	int			fd, i, dup, samesig, r = 0;
+	int			nfound = 0, maxfound = 0, ncopies = 0, ncand = 0;
+	int			ntarget = 0, nonlytarget = 0, nfull = 0;
+
+	if ((fd = open( params->filepath, O_RDONLY | O_CLOEXEC)) < 0) {
+		INFO( 0, "error opening %s for reading\n", params->filepath);
+		return 1;
+	}
+	if (fstat( fd, &st) < 0) {
+		INFO( 0, "File %s fstat failed\n", params->filepath);
+		r = 1;
+	} else if ((size_t) st.st_size < sizeof( *hdr)) {
+		INFO( 0, "File %s is too small for a firmware image\n", params->filepath);
+		r = 1;
+	}
+	size = r ? 0 : st.st_size;
+	if (!r && (image = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		INFO( 0, "File %s: mmap failed\n", params->filepath);
+		r = 1;
+	}
+	close( fd);
+	if (r)
+		return r;
+	madvise( image, size, MADV_SEQUENTIAL);
+	if (strlen( params->targetdir))
+		owrite_init( &ow, params->targetdir);
+	t = cpu_nsecs();
+	off = 0;
+	while (!r && (off = fwscan_find( image, size, off, 1, 
+			offsetof( struct intel_uc_header_t, loader_revision))) < size) {
+		++ncand;
+		hdr = (const struct intel_uc_header_t *) (image + off);
+		// the candidate may lie closer to the end than a whole header
+		if (!intel_blobfits( image + off, size - off)) {
+			off += sizeof( uint32_t);
+			continue;
+		}
+		// plausible sizes: whole dwords, the total a multiple of 1 kB, within the image
+		dsize = (hdr->data_size == 0) ? 2000 : hdr->data_size;
+		total = (hdr->data_size == 0 && hdr->total_size == 0) ? dsize + sizeof( *hdr) : hdr->total_size;
+		if (dsize % sizeof( uint32_t) || total % 1024 ||
+				total < dsize + sizeof( *hdr) || fwscan_sum( image + off, total / sizeof( uint32_t))) {
+			off += sizeof( uint32_t);
+			continue;
+		}
+		memset( &hdrhdr, 0, sizeof( hdrhdr));
+		hdrhdr.image = image + off;
+		if (intel_getHdrInfo( &hdrhdr, params->filepath)) {
+			off += sizeof( uint32_t);
+			continue;
+		}
+		opath[ 0] = '\0';
+		if (strlen( params->targetdir)) {
+			intel_signame( hdr->cpu_signature, name, sizeof( name));
+			if (snprintf( opath, sizeof( opath), "%s/%s", params->targetdir, name) >= sizeof( opath)) {
+				INFO( 0, "filename buffer too short for %s\n", opath);
+				r = 1;
+				break;
+			}
+		}
+		// blobs are added to the target file, which is read at the first blob of its signature
+		for (i = 0; i < nfound && found[ i].signature != hdr->cpu_signature; ++i)
+			;
+		if (i == nfound && strlen( opath) && intel_scantarget( params, opath, &found, &nfound, &maxfound)) {
+			INFO( 0, "%s is no valid microcode file, not adding to it\n", opath);
+			r = 1;
+			break;
+		}
+		// images often hold a blob more than once, e.g. for redundant flash regions
+		dup = samesig = 0;
+		for (i = 0; i < nfound; ++i) {
+			fb = &found[ i];
+			if (fb->signature != hdr->cpu_signature)
+				continue;
+			++samesig;
+			if (fb->flags == hdr->cpu_flags && fb->revision == hdr->revision && fb->checksum == hdr->checksum) {
+				dup = fb->intarget ? 2 : 1;
+				fb->intarget = 0;
+			}
+		}
+		INFO( 10, "0x%08zx: signature %08x, platform flags %02x, revision %08x, date %s, %u bytes%s\n",
+				off, hdr->cpu_signature, hdr->cpu_flags, hdr->revision, 
+				getdatestr( hdr->date, datestr), hdrhdr.total_size, 
+				dup == 1 ? " (copy)" : dup == 2 ? " (already in target)" : "");
+		if (dup == 1) {
+			++ncopies;
+		} else if (dup == 2) {
+			++ntarget;
+		} else if ((fb = intel_scanadd( &found, &nfound, &maxfound, hdr)) == NULL) {
+			r = 1;
+		} else if (strlen( opath)) {
+			if (samesig >= MAXHEADERS) {
+				INFO( 0, "%s already holds %d blobs, not adding the one at 0x%zx\n", opath, samesig, off);
+				++nfull;
+			} else {
+				INFO( 11, "%s blob at 0x%zx to %s\n", samesig ? "Appending" : "Writing", off, opath);
+				// appending to a file not written yet starts from its current content
+				r = owrite_put( &ow, opath, hdrhdr.image, hdrhdr.total_size, 1);
+			}
+		}
+		off += hdrhdr.total_size;
+	}
+	t = cpu_nsecs() - t;
+	if (strlen( params->targetdir)) {
+		if (owrite_commit( &ow))
+			r = 1;
+		owrite_free( &ow);
+	}
+	// blobs only in the target files were not found
+	for (i = 0; i < nfound; ++i)
+		nonlytarget += found[ i].intarget;
+	INFO( 10, "%s: %d blobs found, %d copies of these, %d candidates checked in %.1f ms\n",
+			params->filepath, nfound - nonlytarget, ncopies, ncand, t / 1e6);
+	if (strlen( params->targetdir))
+		INFO( 10, "%d blobs were in %s already, %d did not fit into their file\n", ntarget, params->targetdir, nfull);
+	free( found);
+	munmap( image, size);
+	return r;
+}
+
+
+static const char *intel_tiernames[] = { "no", "header", "structure", "full" };
+
+// state of intel_verifytree()
+struct intel_verifystate {
+	struct cpupdate_params
+			   *params;
+	struct vstate vs;
+	int			usestate;		// bool: vs is used
+	int			tier;			// wanted
+	// the blobs of the current file
+	struct vstate_rec
+			   *recs;
+	int			nrecs,
+				maxrecs;
+	const uint8_t *base;		// image of the file when checking fully
+	// statistics
+	int			nfiles,
+				nstate,			// files whose blobs were validated to the tier before
+				nbad;
+	int			nblobs[ VERIFY_FULL + 1];	// per tier validated to
+};
+
+
+/* checks the blob header at off of the file fd, which has left bytes from there on, to the
+ * tier VERIFY_HEADER or VERIFY_STRUCT, reading only the header and the extended signature
+ * table header. the header is returned in hdr, the blob size in total
+ */
+static int
+intel_checkhdrtier( int fd, off_t off, off_t left, int tier, const char *path, 
+		struct intel_uc_header_t *hdr, size_t *total)
+{
+	struct intel_ext_header_t ext;
+	size_t dsize;
+
+	if (left < (off_t) sizeof( *hdr) || pread( fd, hdr, sizeof( *hdr), off) != sizeof( *hdr)) {
+		INFO( 0, "File %s: Blob at 0x%jx goes past EOF!\n", path, (uintmax_t) off);
+		return 1;
+	}
+	if (hdr->header_version != 1 || hdr->loader_revision != 1) {
+		INFO( 0, "File %s: Unsupported version\n", path);
+		return 1;
+	}
+	dsize = (hdr->data_size == 0) ? 2000 : hdr->data_size;
+	*total = (hdr->data_size == 0 && hdr->total_size == 0) ? dsize + sizeof( *hdr) : hdr->total_size;
+	if (*total < sizeof( *hdr) || (off_t) *total > left) {
+		INFO( 0, "File %s: Blob at 0x%jx goes past EOF!\n", path, (uintmax_t) off);
+		return 1;
+	}
+	if (tier < VERIFY_STRUCT)
+		return 0;
+	if (dsize % sizeof( uint32_t)) {
+		INFO( 0, "File %s: Data size is not multiple of dword\n", path);
+		return 1;
+	}
+	if (*total < dsize + sizeof( *hdr)) {
+		INFO( 0, "File %s: Blob at 0x%jx is smaller than its data\n", path, (uintmax_t) off);
+		return 1;
+	}
+	if (*total > dsize + sizeof( *hdr)) {
+		if (*total - dsize - sizeof( *hdr) < sizeof( ext) ||
+				pread( fd, &ext, sizeof( ext), off + sizeof( *hdr) + dsize) != sizeof( ext)) {
+			INFO( 0, "File %s: Image's extended header incomplete\n", path);
+			return 1;
+		}
+		if (sizeof( ext) + (uint64_t) ext.sig_count * sizeof( union intel_ExtSignatUnion) > 
+				*total - dsize - sizeof( *hdr)) {
+			INFO( 0, "File %s: Extended signature table incomplete\n", path);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+// adds a blob of the current file to vst->recs
+static int
+intel_verifyrec( struct intel_verifystate *vst, uint64_t off, const struct intel_uc_header_t *hdr, int tier)
+{
+	struct vstate_rec *rec;
+
+	if (vst->nrecs == vst->maxrecs) {
+		int max = vst->maxrecs ? 2 * vst->maxrecs : 16;
+
+		if ((rec = reallocarray( vst->recs, max, sizeof( *rec))) == NULL) {
+			INFO( 0, "Could not allocate blob table!\n");
+			return 1;
+		}
+		vst->recs = rec;
+		vst->maxrecs = max;
+	}
+	rec = &vst->recs[ vst->nrecs++];
+	memset( rec, 0, sizeof( *rec));
+	rec->off = off;
+	rec->signature = hdr->cpu_signature;
+	rec->flags = hdr->cpu_flags;
+	rec->revision = hdr->revision;
+	rec->tier = tier;
+	return 0;
+}
+
+
+// intel_foreachblob() callback of the full tier
+static int
+intel_verifyblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg)
+{
+	struct intel_verifystate *vst = arg;
+
+	return intel_verifyrec( vst, hdrhdr->image - vst->base, (struct intel_uc_header_t *) hdrhdr->image, VERIFY_FULL);
+}
+
+
+// lists a blob validated by intel_verifyfile(), as text or as report row
+static void
+intel_verifylist( struct cpupdate_params *params, const char *path, const struct vstate_rec *vrec, const char *how)
+{
+	struct report_rec rec = { .type = REPORT_BLOB };
+
+	if (params->report == NULL) {
+		INFO( 10, "%s: blob at 0x%06jx: signature %08x, platform flags %02x, revision %08x, %s check %s\n",
+				path, (uintmax_t) vrec->off, vrec->signature, vrec->flags, vrec->revision, intel_tiernames[ vrec->tier], how);
+		return;
+	}
+	// the headers are not kept, date and sizes are left 0
+	rec.signature = vrec->signature;
+	rec.flags = vrec->flags;
+	rec.revision = vrec->revision;
+	rec.offset = vrec->off;
+	report_row( params->report, &rec, path);
+}
+
+
+// scan_tree() callback of intel_verifytree(): validates the blobs of a file to the tier wanted
+static int
+intel_verifyfile( int dfd, const char *name, const char *path, void *arg)
+{
+	struct intel_verifystate *vst = arg;
+	struct cpupdate_params *params = vst->params;
+	struct intel_uc_header_t hdr;
+	struct vstate_rec *rec;
+	struct stat st;
+	uint8_t	head[ 64];
+	int64_t	mtime;
+	size_t	total;
+	off_t	off;
+	ssize_t	n;
+	int		fd, first, nstate, tier = vst->tier, r = 0;
+
+	++vst->nfiles;
+	vst->nrecs = 0;
+	if (fstatat( dfd, name, &st, 0) < 0) {
+		INFO( 0, "File %s fstat failed\n", path);
+		++vst->nbad;
+		return 0;
+	}
+	mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	// validated to the tier before, and unchanged since
+	if (vst->usestate && (nstate = vstate_find( &vst->vs, path, &first)) > 0) {
+		int i;
+
+		for (i = first; i < first + nstate; ++i) {
+			rec = &vst->vs.recs[ i];
+			if (rec->tier < tier || rec->size != st.st_size || rec->mtime != mtime)
+				break;
+		}
+		if (i == first + nstate) {
+			++vst->nstate;
+			for (i = first; i < first + nstate; ++i) {
+				rec = &vst->vs.recs[ i];
+				++vst->nblobs[ rec->tier];
+				if (params->verifylist || params->report != NULL)
+					intel_verifylist( params, path, rec, "done before");
+			}
+			return 0;
+		}
+	}
+	if ((fd = openat( dfd, name, O_RDONLY | O_CLOEXEC)) < 0) {
+		INFO( 0, "File %s: Does not exist or could not be read!\n", path);
+		++vst->nbad;
+		return 0;
+	}
+	// text format files have no headers to walk, they get checked fully
+	if (tier < VERIFY_FULL && ((n = pread( fd, head, sizeof( head), 0)) < 0 || dat_istext( head, n))) {
+		INFO( 11, "File %s is in text format, checking it fully\n", path);
+		tier = VERIFY_FULL;
+	}
+	if (tier < VERIFY_FULL) {
+		// walk the headers, the payloads are not read
+		for (off = 0; !r && off < st.st_size; off += total)
+			if (!(r = intel_checkhdrtier( fd, off, st.st_size - off, tier, path, &hdr, &total)))
+				r = intel_verifyrec( vst, off, &hdr, tier);
+		if (st.st_size == 0) {
+			INFO( 0, "File %s: Error in [first] header\n", path);
+			r = 1;
+		}
+		close( fd);
+	} else {
+		close( fd);
+		strcpy( params->filepath, path);
+		params->filedirfd = dfd;
+		params->filename = name;
+		if (!(r = intel_loadcheckmicrocode( params))) {
+			struct intel_ucinfo *ucinfo = params->ucodeinfop;
+
+			vst->base = ucinfo->image;
+			r = intel_foreachblob( params, intel_verifyblob, vst);
+		}
+		intel_freeucodeinfo( params);
+		params->filename = NULL;
+	}
+	if (r) {
+		++vst->nbad;
+		vst->nrecs = 0;
+	}
+	for (int i = 0; i < vst->nrecs; ++i) {
+		rec = &vst->recs[ i];
+		rec->size = st.st_size;
+		rec->mtime = mtime;
+		++vst->nblobs[ rec->tier];
+		if (params->verifylist || params->report != NULL)
+			intel_verifylist( params, path, rec, "passed");
+	}
+	if (r && params->report != NULL) {
+		struct report_rec brec = { .type = REPORT_BAD };
+
+		report_row( params->report, &brec, path);
+	}
+	// a file failing now loses what it passed before
+	if (vst->usestate && vstate_put( &vst->vs, path, vst->recs, vst->nrecs))
+		return 1;
+	return 0;
+}
+
+
+/* -c and -d with --verify or --verify-state: validates the blobs of the files in srcdir
+ * to the tier params->verify. below VERIFY_FULL only the headers are read, with positioned
+ * reads. with a state file, files validated to the tier before are skipped if unchanged,
+ * and the tiers reached are recorded
+ */
+int
+intel_verifytree( struct cpupdate_params *params)
+{
+	struct intel_verifystate vst;
+	int r;
+
+	memset( &vst, 0, sizeof( vst));
+	vst.params = params;
+	vst.tier = (params->verify >= VERIFY_HEADER && params->verify <= VERIFY_FULL) ? params->verify : VERIFY_FULL;
+	if (params->verifystate != NULL) {
+		if (vstate_load( &vst.vs, params->verifystate))
+			return 1;
+		vst.usestate = 1;
+	}
+	r = scan_tree( params->srcdir, params->pattern, intel_verifyfile, &vst);
+	if (vst.usestate && !r)
+		vstate_drop( &vst.vs, params->srcdir, params->pattern);
+	INFO( 10, "%d files, %d with errors, %d unchanged since checked. Blobs checked to tier header: %d, structure: %d, full: %d\n",
+			vst.nfiles, vst.nbad, vst.nstate, 
+			vst.nblobs[ VERIFY_HEADER], vst.nblobs[ VERIFY_STRUCT], vst.nblobs[ VERIFY_FULL]);
+	if (vst.usestate) {
+		if (!r)
+			r = vstate_save( &vst.vs);
+		vstate_free( &vst.vs);
+	}
+	free( vst.recs);
+	return r ? r : (vst.nbad > 0);
+}
+
+
+int
+intel_getcores( struct cpupdate_params *params, struct cpup_coreinfo *cores, int max)
+{
+	struct intel_ProcessorInfo *coreinfo = (struct intel_ProcessorInfo *) params->coreinfop;
+
+	for (int core = 0; core < params->numcores && core < max; ++core, ++coreinfo) {
+		cores[ core].core			= core;
+		cores[ core].signature		= coreinfo->sig.sigInt;
+		cores[ core].platformflags	= coreinfo->flags;
+		cores[ core].revision		= coreinfo->ucoderev;
+	}
+	return params->numcores;
+}
+
+
+struct intel_bloblist {
+	struct cpup_blobinfo
+			   *blobs;
+	int			max;
+	int			base;		// index of the first blob of the current file
+};
+
+
+static int
+intel_infoblob( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, int n, int count, void *arg)
+{
+	struct intel_bloblist *bl = arg;
+	struct intel_uc_header_t *hdr = (struct intel_uc_header_t *) hdrhdr->image;
+	struct cpup_blobinfo *bi;
+
+	if (bl->base + n >= bl->max)
+		return 0;
+	bi = &bl->blobs[ bl->base + n];
+	bi->signature	= hdr->cpu_signature;
+	bi->flags		= hdr->cpu_flags;
+	bi->revision	= hdr->revision;
+	bi->date		= hdr->date;
+	bi->datasize	= hdrhdr->data_size;
+	bi->totalsize	= hdrhdr->total_size;
+	bi->hasexttable	= hdrhdr->has_ext_table;
+	return 0;
+}
+
+
+int
+intel_getblobs( struct cpupdate_params *params, struct cpup_blobinfo *blobs, int max)
+{
+	struct intel_ucinfo *ucinfo = (struct intel_ucinfo *) params->ucodeinfop;
+	struct intel_bloblist bl = { blobs, max, 0 };
+
+	assert( ucinfo != NULL);
+	// the blobs of all signature groups' files, one after the other
+	for ( ; ucinfo != NULL; ucinfo = ucinfo->next) {
+		if (ucinfo->image == NULL)
+			continue;
+		if (intel_foreachblobof( params, ucinfo, intel_infoblob, &bl))
+			return -1;
+		bl.base += ucinfo->istext ? ucinfo->textblobs : ucinfo->blobcount;
+	}
+	return bl.base;
+}
+
+
 const char *
 intel_getvendorname( struct cpupdate_params *params)
 {
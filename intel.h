@@ -154,8 +154,23 @@ struct intel_ucinfo {
 	int		blobcount;
 	struct intel_hdrhdr_t
 			hdrhdrs[ MAXHEADERS];
+	// image was converted from the legacy text format. it may then hold any number of blobs
+	// of different signatures, which are not kept in hdrhdrs but walked by intel_foreachblob()
+	int		istext;
+	int		textblobs;
+	char	path[ MAXPATHLEN];		// file name, for messages
+	// repository lookups load one file per signature group, chained by next.
+	// a file given by path applies to all cores and is not grouped
+	struct intel_ucinfo
+		   *next;
+	int		grouped;
+	uint32_t signature;
 };
 
+// callback for each blob of a loaded file, n is the index of the blob, count the number of blobs
+typedef int (*intel_blob_cb)( struct cpupdate_params *params, struct intel_hdrhdr_t *hdrhdr, 
+			int n, int count, void *arg);
+
 
 extern struct vendor_funcs intel_funcs;
 
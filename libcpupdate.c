@@ -0,0 +1,615 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/param.h>
+#include <sys/linker.h>
+#include <sys/module.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/cpuctl.h>
+
+#include "cpupdate.h"
+#include "intel.h"
+#include "amd.h"
+#include "devio.h"
+
+_Thread_local int cpup_verbosity = 10;
+
+struct vendor_funcs *const cpu_handlers[] = {
+	&intel_funcs,
+	&amd_funcs
+  // other handlers, VIA here
+};
+const int cpu_nhandlers = sizeof( cpu_handlers) / sizeof( *cpu_handlers);
+
+struct cpup_ctx {
+	struct cpupdate_params
+						params;
+	struct vendor_funcs *handler;		// NULL until vendor known
+	int					verbosity;
+	int					probed;			// bool: probe has been done
+};
+
+static int modload( const char *name);
+#ifdef CPUCTL_EVAL_CPU_FEATURES
+static int do_eval_cpu_features( int core);
+static void *eval_worker( void *arg);
+#endif
+static int cmpu64( const void *a, const void *b);
+static int setpath( char *dst, const char *src);
+
+
+static int
+modload( const char *name)
+{
+	if (modfind(name) < 0)
+		if (kldload(name) < 0 || modfind(name) < 0) {
+			warn("%s: module not found", name);
+			return 0;
+		}
+	return 1;
+}
+
+
+/* returns the number of cores as determined by the highest /dev/cpuctlN, loading
+ * the cpuctl module if needed. returns -1 on failure
+ */
+int
+cpup_getcorenum( void)
+{
+	struct dirent *direntry;
+	DIR *dirp;
+	int r = 0;
+	int high = 0;
+	
+	// the cores of the traced host
+	if (devio_mode() == DEVIO_REPLAY)
+		return devio_corenum( 0);
+	if ((dirp = opendir("/dev")) == NULL) {
+		r = -1;
+	} else {
+		modload("cpuctl");
+		while ((direntry = readdir(dirp)) != NULL) {
+			if (direntry->d_namlen == 0)
+				continue;
+			if (!strncmp( direntry->d_name, "cpuctl", 6)) {
+				int x = atoi( direntry->d_name + 6);
+				if (x > high)
+					high = x;
+		}	}
+		r = closedir( dirp);
+	}
+ 	r = (r) ? -1 : ++high;
+	return devio_corenum( r);
+}
+
+
+/* parses a cpu list like "0-3,8,10-11" and sets set[core] for every core listed.
+ * returns 0 on success, -1 on a malformed list or out of range core numbers
+ */
+int
+cpu_parsecpulist( const char *list, char *set)
+{
+	const char *p = list;
+	char *end;
+	long s, e;
+
+	while (*p) {
+		s = strtol( p, &end, 10);
+		if (end == p || s < 0 || s >= MAXCORES)
+			return -1;
+		e = s;
+		p = end;
+		if (*p == '-') {
+			++p;
+			e = strtol( p, &end, 10);
+			if (end == p || e < s || e >= MAXCORES)
+				return -1;
+			p = end;
+		}
+		for ( ; s <= e; ++s)
+			set[ s] = 1;
+		if (*p == ',')
+			++p;
+		else if (*p)
+			return -1;
+	}
+	return 0;
+}
+
+
+/* fills order[] with the core numbers in the sequence they are to be updated:
+ * first all cores not in the exclusion set, then the ones of the exclusion set.
+ * with a core selection, only the selected cores. returns the number of cores
+ */
+int
+cpu_updateorder( struct cpupdate_params *params, int *order)
+{
+	int core, n = 0;
+
+	for (core = 0; core < params->numcores; ++core)
+		if (!params->lastcores[ core] && (!params->nselcores || params->selcores[ core]))
+			order[ n++] = core;
+	for (core = 0; core < params->numcores; ++core)
+		if (params->lastcores[ core] && (!params->nselcores || params->selcores[ core]))
+			order[ n++] = core;
+	return n;
+}
+
+
+uint64_t
+cpu_nsecs( void)
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+void
+cpu_addupdtime( struct cpupdate_params *params, int core, uint64_t ns)
+{
+	params->updns[ core] = ns;
+	if (params->nupdtimes < MAXCORES)
+		params->updtimes[ params->nupdtimes++] = ns;
+}
+
+
+/* to be called after each updated core. updated is the number of cores updated so far,
+ * more is nonzero if there are cores left to walk.
+ * in rolling mode, sleeps batchpause ms at the end of each batch
+ */
+void
+cpu_batchpause( struct cpupdate_params *params, int updated, int more)
+{
+	struct timespec ts;
+
+	if (params->batchsize <= 0 || !more || updated % params->batchsize)
+		return;
+	INFO( 11, "Batch of %d cores done, pausing %d ms\n", params->batchsize, params->batchpause);
+	if (!params->writeit || params->batchpause <= 0)
+		return;
+	ts.tv_sec  = params->batchpause / 1000;
+	ts.tv_nsec = (params->batchpause % 1000) * 1000000L;
+	while (nanosleep( &ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+
+void
+cpu_setchanged( struct cpupdate_params *params, int core)
+{
+	if (!params->changed[ core]) {
+		params->changed[ core] = 1;
+		++params->nchanged;
+	}
+}
+
+
+static int
+cmpu64( const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+// prints the distribution of the CPUCTL_UPDATE call durations
+void
+cpu_printupdtimes( struct cpupdate_params *params)
+{
+	uint64_t sorted[ MAXCORES];
+	uint64_t sum = 0;
+	int n = params->nupdtimes;
+
+	if (n == 0)
+		return;
+	memcpy( sorted, params->updtimes, n * sizeof( *sorted));
+	qsort( sorted, n, sizeof( *sorted), cmpu64);
+	for (int i = 0; i < n; ++i)
+		sum += sorted[ i];
+	INFO( 10, "Update call times of %d cores (us): min %ju  median %ju  p90 %ju  p99 %ju  max %ju  mean %ju\n",
+			n,
+			(uintmax_t) sorted[ 0] / 1000,
+			(uintmax_t) sorted[ n / 2] / 1000,
+			(uintmax_t) sorted[ (n * 90) / 100] / 1000,
+			(uintmax_t) sorted[ (n * 99) / 100] / 1000,
+			(uintmax_t) sorted[ n - 1] / 1000,
+			(uintmax_t) sum / n / 1000);
+}
+
+
+/* opens /dev/cpuctlN of all cores and keeps the descriptors in params, for vendor code
+ * polling the cores repeatedly. does nothing if they are open already
+ */
+int
+cpu_opencorefds( struct cpupdate_params *params)
+{
+	char cpudev[ MAXPATHLEN];
+
+	for ( ; params->ncorefds < params->numcores; ++params->ncorefds) {
+		snprintf( cpudev, sizeof( cpudev), "/dev/cpuctl%d", params->ncorefds);
+		if ((params->corefds[ params->ncorefds] = devio_open( params->ncorefds, O_RDWR | O_CLOEXEC)) < 0) {
+			INFO( 0, "could not open %s for writing\n", cpudev);
+			cpu_closecorefds( params);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+void
+cpu_closecorefds( struct cpupdate_params *params)
+{
+	while (params->ncorefds > 0)
+		close( params->corefds[ --params->ncorefds]);
+}
+
+
+#ifdef CPUCTL_EVAL_CPU_FEATURES
+static int
+do_eval_cpu_features( int core)
+{
+	char dev[ MAXPATHLEN];
+	int fd, error;
+	
+	snprintf( dev, sizeof( dev), "/dev/cpuctl%d", core);
+	fd = devio_open( core, O_RDWR);
+	if (fd < 0) {
+		INFO(0, "register new CPU features: error opening %s for writing\n", dev);
+		return ( 1);
+	}
+	error = devio_ioctl( fd, CPUCTL_EVAL_CPU_FEATURES, NULL);
+	if (error < 0)
+		INFO(0, "Error with registering new CPU features on %s\n", dev);
+	close( fd);
+	return( error);
+}
+
+
+#define EVAL_MAXTHREADS 16
+
+struct eval_job {
+	int		verbosity;		// of the thread starting the job
+	int		ncores;
+	int	   *cores;			// cores to work on: cores[ first], cores[ first + step], ...
+	int		first,
+			step;
+	int	   *results;		// per core result, indexed like cores
+};
+
+
+static void *
+eval_worker( void *arg)
+{
+	struct eval_job *job = arg;
+
+	cpup_verbosity = job->verbosity;
+	for (int i = job->first; i < job->ncores; i += job->step) {
+		// keeps the messages of the cores apart and in core order
+		log_begin( job->cores[ i]);
+		job->results[ i] = do_eval_cpu_features( job->cores[ i]);
+		log_end();
+	}
+	return NULL;
+}
+
+
+/* re-registers the CPU features of the cores in the change set only, concurrently.
+ * returns 0 if all of them succeeded, else -1
+ */
+int
+cpu_evalfeatures( struct cpupdate_params *params)
+{
+	int			cores[ MAXCORES];
+	int			results[ MAXCORES];
+	pthread_t	tids[ EVAL_MAXTHREADS];
+	char		started[ EVAL_MAXTHREADS];
+	struct eval_job jobs[ EVAL_MAXTHREADS];
+	int			n = 0, nthreads, i, r = 0;
+
+	for (i = 0; i < params->numcores; ++i)
+		if (params->changed[ i])
+			cores[ n++] = i;
+	nthreads = (n < EVAL_MAXTHREADS) ? n : EVAL_MAXTHREADS;
+	for (i = 0; i < nthreads; ++i) {
+		jobs[ i].verbosity = cpup_verbosity;
+		jobs[ i].ncores  = n;
+		jobs[ i].cores   = cores;
+		jobs[ i].first   = i;
+		jobs[ i].step    = nthreads;
+		jobs[ i].results = results;
+		started[ i] = (pthread_create( &tids[ i], NULL, eval_worker, &jobs[ i]) == 0);
+		if (!started[ i])
+			// no more threads, do this share here
+			eval_worker( &jobs[ i]);
+	}
+	for (i = 0; i < nthreads; ++i)
+		if (started[ i])
+			pthread_join( tids[ i], NULL);
+	log_flushpending();
+	for (i = 0; i < n; ++i)
+		if (results[ i]) {
+			INFO( 0, "Failed to register core %d features\n", cores[ i]);
+			r = -1;
+		}
+	return r;
+}
+#else
+int
+cpu_evalfeatures( struct cpupdate_params *params)
+{
+	INFO( 10, "NOTICE: This FreeBSD version does not support registering new CPU features!\n");
+	return 0;
+}
+#endif
+
+
+/* the context API.
+ * every entry point first sets the calling thread's verbosity from the context
+ */
+struct cpup_ctx *
+cpup_open( int vendor, int verbosity)
+{
+	struct cpup_ctx *ctx;
+
+	cpup_verbosity = verbosity;
+	if (vendor != CPUP_VENDOR_AUTO && (vendor < 0 || vendor >= cpu_nhandlers)) {
+		INFO( 0, "Unsupported vendor %d\n", vendor);
+		return NULL;
+	}
+	if ((ctx = calloc( 1, sizeof( *ctx))) == NULL) {
+		INFO( 0, "Could not allocate context!\n");
+		return NULL;
+	}
+	ctx->verbosity = verbosity;
+	if (vendor != CPUP_VENDOR_AUTO)
+		ctx->handler = cpu_handlers[ vendor];
+	return ctx;
+}
+
+
+void
+cpup_close( struct cpup_ctx *ctx)
+{
+	if (ctx == NULL)
+		return;
+	cpup_verbosity = ctx->verbosity;
+	if (ctx->handler != NULL)
+		ctx->handler->freeucodeinfo( &ctx->params);
+	cpu_closecorefds( &ctx->params);
+	free( ctx->params.coreinfop);
+	free( ctx);
+}
+
+
+static int
+setpath( char *dst, const char *src)
+{
+	if (src == NULL) {
+		dst[ 0] = '\0';
+		return 0;
+	}
+	if (strlen( src) >= MAXPATHLEN) {
+		INFO( 0, "ERROR: Path too long\n");
+		return 1;
+	}
+	strcpy( dst, src);
+	return 0;
+}
+
+
+// sets the repository paths used by cpup_queryrepo() and cpup_update(), NULL for none
+int
+cpup_setrepo( struct cpup_ctx *ctx, const char *primdir, const char *secdir, const char *packpath)
+{
+	cpup_verbosity = ctx->verbosity;
+	return setpath( ctx->params.primdir, primdir) ||
+			setpath( ctx->params.secdir, secdir) ||
+			setpath( ctx->params.packpath, packpath);
+}
+
+
+// probes the cores and, with CPUP_VENDOR_AUTO, determines the vendor
+int
+cpup_probe( struct cpup_ctx *ctx)
+{
+	int r = 1;
+
+	cpup_verbosity = ctx->verbosity;
+	cpu_closecorefds( &ctx->params);
+	free( ctx->params.coreinfop);
+	ctx->params.coreinfop = NULL;
+	ctx->probed = 0;
+	if ((ctx->params.numcores = cpup_getcorenum()) < 1) {
+		INFO( 0, "Failed to determine number of cores. Did you do 'kldload cpuctl'?\n");
+		return 1;
+	}
+	if (ctx->handler != NULL) {
+		r = ctx->handler->probe( &ctx->params);
+	} else {
+		for (int i = 0; r && i < cpu_nhandlers; ++i)
+			if ((r = cpu_handlers[ i]->probe( &ctx->params)) == 0)
+				ctx->handler = cpu_handlers[ i];
+			else {
+				free( ctx->params.coreinfop);
+				ctx->params.coreinfop = NULL;
+			}
+	}
+	ctx->probed = (r == 0);
+	return r;
+}
+
+
+const char *
+cpup_vendorname( struct cpup_ctx *ctx)
+{
+	return (ctx->handler != NULL) ? ctx->handler->getvendorname() : NULL;
+}
+
+
+// returns the number of cores, filling up to max entries of cores
+int
+cpup_getcores( struct cpup_ctx *ctx, struct cpup_coreinfo *cores, int max)
+{
+	cpup_verbosity = ctx->verbosity;
+	if (!ctx->probed) {
+		INFO( 0, "Cores have not been probed\n");
+		return -1;
+	}
+	return ctx->handler->getcores( &ctx->params, cores, max);
+}
+
+
+/* re-reads only the microcode revisions of the probed cores, much cheaper than a new
+ * probe. the devices are kept open until the context is closed or probed again
+ */
+int
+cpup_refresh( struct cpup_ctx *ctx)
+{
+	cpup_verbosity = ctx->verbosity;
+	if (!ctx->probed) {
+		INFO( 0, "Cores have not been probed\n");
+		return 1;
+	}
+	return ctx->handler->refreshrevs( &ctx->params);
+}
+
+
+/* loads and validates the microcode file at path.
+ * returns the number of blobs, filling up to max entries of blobs, or -1 if the file is invalid
+ */
+int
+cpup_queryfile( struct cpup_ctx *ctx, const char *path, struct cpup_blobinfo *blobs, int max)
+{
+	int r;
+
+	cpup_verbosity = ctx->verbosity;
+	if (ctx->handler == NULL) {
+		INFO( 0, "Vendor unknown, probe first\n");
+		return -1;
+	}
+	if (setpath( ctx->params.filepath, path))
+		return -1;
+	r = ctx->handler->loadcheckmicrocode( &ctx->params);
+	r = r ? -1 : ctx->handler->getblobs( &ctx->params, blobs, max);
+	ctx->handler->freeucodeinfo( &ctx->params);
+	ctx->params.filepath[ 0] = '\0';
+	return r;
+}
+
+
+/* looks up the microcode for the probed cores in the repository.
+ * returns the number of blobs found, filling up to max entries of blobs, or -1 if none was found
+ */
+int
+cpup_queryrepo( struct cpup_ctx *ctx, struct cpup_blobinfo *blobs, int max)
+{
+	int r;
+
+	cpup_verbosity = ctx->verbosity;
+	if (!ctx->probed) {
+		INFO( 0, "Cores have not been probed\n");
+		return -1;
+	}
+	ctx->params.filepath[ 0] = '\0';
+	r = ctx->handler->loadcheckmicrocode( &ctx->params);
+	r = r ? -1 : ctx->handler->getblobs( &ctx->params, blobs, max);
+	ctx->handler->freeucodeinfo( &ctx->params);
+	ctx->params.filepath[ 0] = '\0';
+	return r;
+}
+
+
+/* updates the probed cores from the repository, with writeit == 0 only simulated.
+ * fills up to max per core results. returns 0 if all cores succeeded
+ */
+int
+cpup_update( struct cpup_ctx *ctx, int writeit, struct cpup_updresult *results, int max)
+{
+	struct cpup_coreinfo *before, *after;
+	struct cpupdate_params *params = &ctx->params;
+	int n, r;
+
+	cpup_verbosity = ctx->verbosity;
+	if (!ctx->probed) {
+		INFO( 0, "Cores have not been probed\n");
+		return 1;
+	}
+	if ((before = calloc( 2 * params->numcores, sizeof( *before))) == NULL) {
+		INFO( 0, "Could not allocate core infos!\n");
+		return 1;
+	}
+	after = before + params->numcores;
+	n = ctx->handler->getcores( params, before, params->numcores);
+	params->writeit = writeit;
+	params->nupdtimes = 0;
+	memset( params->updns, 0, sizeof( params->updns));
+	memset( params->updfailed, 0, sizeof( params->updfailed));
+	memset( params->changed, 0, sizeof( params->changed));
+	params->nchanged = 0;
+	params->filepath[ 0] = '\0';
+	r = ctx->handler->loadcheckmicrocode( params);
+	if (r)
+		// no core could be looked at
+		memset( params->updfailed, 1, sizeof( params->updfailed));
+	else
+		r = ctx->handler->update( params);
+	if (!r && params->nchanged)
+		r = cpu_evalfeatures( params);
+	// update re-reads the revisions of the cores it updated
+	ctx->handler->getcores( params, after, params->numcores);
+	for (int i = 0; results != NULL && i < n && i < max; ++i) {
+		results[ i].core	= i;
+		results[ i].oldrev	= before[ i].revision;
+		results[ i].newrev	= after[ i].revision;
+		results[ i].status	= params->updfailed[ i];
+		results[ i].changed	= params->changed[ i];
+		results[ i].ns		= params->updns[ i];
+	}
+	ctx->handler->freeucodeinfo( params);
+	params->filepath[ 0] = '\0';
+	free( before);
+	return r;
+}
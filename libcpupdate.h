@@ -0,0 +1,82 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBCPUPDATE_H
+#define	LIBCPUPDATE_H
+
+#include <stdint.h>
+
+/* libcpupdate: the vendor layer of cpupdate as a reentrant library.
+ * All state lives in a context object. Contexts are independent of each other,
+ * so several threads may probe, query and update at the same time, each with its
+ * own context. A single context must not be used by two threads at once.
+ * Messages are printed to stdout according to the verbosity of the context.
+ */
+
+#define CPUP_VENDOR_AUTO	(-1)		// determine by probing
+#define CPUP_VENDOR_INTEL	0
+#define CPUP_VENDOR_AMD		1
+#define CPUP_VENDOR_VIA		2
+
+struct cpup_ctx;
+
+struct cpup_coreinfo {
+	int			core;
+	uint32_t	signature;				// CPUID(1) EAX
+	uint32_t	platformflags;			// platform ID as flag bit, as used in the blobs' flags
+	int32_t		revision;				// current microcode revision
+};
+
+struct cpup_blobinfo {
+	uint32_t	signature;
+	uint32_t	flags;					// platform flags the blob applies to
+	int32_t		revision;
+	uint32_t	date;					// BCD, as in the blob header
+	uint32_t	datasize;
+	uint32_t	totalsize;
+	int			hasexttable;			// bool: blob has an extended signature table
+};
+
+struct cpup_updresult {
+	int			core;
+	int32_t		oldrev;
+	int32_t		newrev;
+	int			status;					// 0 if updated or up-to-date, nonzero if failed
+	int			changed;				// bool: core moved to a new revision
+	uint64_t	ns;						// duration of the update call, 0 if none was done
+};
+
+struct cpup_ctx *cpup_open( int vendor, int verbosity);
+void		cpup_close( struct cpup_ctx *ctx);
+int			cpup_setrepo( struct cpup_ctx *ctx, const char *primdir, const char *secdir, const char *packpath);
+int			cpup_probe( struct cpup_ctx *ctx);
+const char *cpup_vendorname( struct cpup_ctx *ctx);
+int			cpup_getcores( struct cpup_ctx *ctx, struct cpup_coreinfo *cores, int max);
+int			cpup_refresh( struct cpup_ctx *ctx);
+int			cpup_queryfile( struct cpup_ctx *ctx, const char *path, struct cpup_blobinfo *blobs, int max);
+int			cpup_queryrepo( struct cpup_ctx *ctx, struct cpup_blobinfo *blobs, int max);
+int			cpup_update( struct cpup_ctx *ctx, int writeit, struct cpup_updresult *results, int max);
+int			cpup_getcorenum( void);
+
+#endif /* !LIBCPUPDATE_H */
@@ -0,0 +1,279 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "log.h"
+
+// a piece of captured output waiting for log_flushpending()
+struct log_chunk {
+	struct log_chunk   *next;
+	int					key;
+	unsigned int		seq;		// keeps the chunks of one key in order
+	size_t				len;
+	char				data[];
+};
+
+struct log_tls {
+	int		registered;				// bool: the thread exit hook is set up
+	int		capturing;				// bool: between log_begin() and log_end()
+	int		key;
+	size_t	len;
+	char	buf[ LOG_BUFSIZE];
+};
+
+static _Thread_local struct log_tls logtls;
+
+static pthread_mutex_t	  log_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t	  log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t	  log_key;
+static struct log_chunk	 *log_pending;
+static unsigned int		  log_seq;
+static int				  log_sink = LOG_SINK_TEXT;
+static int				  log_tty;		// bool: stdout is a terminal
+
+static void log_init( void);
+static void log_threadexit( void *arg);
+static void log_spill( struct log_tls *t);
+static void log_append( struct log_tls *t, const char *p, size_t len);
+
+
+static void
+log_init( void)
+{
+	log_tty = isatty( STDOUT_FILENO);
+	pthread_key_create( &log_key, log_threadexit);
+	// captured output of threads that never reached log_end() must not get lost
+	atexit( log_flushpending);
+}
+
+
+// a thread's buffered messages are written out (or kept pending) when it exits
+static void
+log_threadexit( void *arg)
+{
+	log_spill( arg);
+	fflush( stdout);
+}
+
+
+void
+log_setsink( int sink)
+{
+	log_sink = sink;
+}
+
+
+int
+log_getsink( void)
+{
+	return log_sink;
+}
+
+
+// moves the thread's buffer out: to stdout, or into the pending list if capturing
+static void
+log_spill( struct log_tls *t)
+{
+	struct log_chunk *c, **pp;
+
+	if (t->len == 0)
+		return;
+	if (!t->capturing) {
+		fwrite( t->buf, 1, t->len, stdout);
+		t->len = 0;
+		return;
+	}
+	if ((c = malloc( sizeof( *c) + t->len)) == NULL) {
+		// rather lose the order than the messages
+		fwrite( t->buf, 1, t->len, stdout);
+		t->len = 0;
+		return;
+	}
+	c->key = t->key;
+	c->len = t->len;
+	memcpy( c->data, t->buf, t->len);
+	t->len = 0;
+	pthread_mutex_lock( &log_mtx);
+	c->seq = log_seq++;
+	// insert sorted by key, behind the chunks of the same key
+	for (pp = &log_pending; *pp != NULL && (*pp)->key <= c->key; pp = &(*pp)->next)
+		;
+	c->next = *pp;
+	*pp = c;
+	pthread_mutex_unlock( &log_mtx);
+}
+
+
+static void
+log_append( struct log_tls *t, const char *p, size_t len)
+{
+	while (len > 0) {
+		size_t n = sizeof( t->buf) - t->len;
+		if (n == 0) {
+			log_spill( t);
+			continue;
+		}
+		if (n > len)
+			n = len;
+		memcpy( t->buf + t->len, p, n);
+		t->len += n;
+		p += n;
+		len -= n;
+	}
+}
+
+
+// escapes len chars of src for a JSON string into dst, which must hold 6 * len chars
+size_t
+log_jsonescape( char *dst, const char *src, size_t len)
+{
+	char *d = dst;
+
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char c = src[ i];
+		if (c == '"' || c == '\\') {
+			*d++ = '\\';
+			*d++ = c;
+		} else if (c == '\n') {
+			*d++ = '\\';
+			*d++ = 'n';
+		} else if (c < 0x20) {
+			d += sprintf( d, "\\u%04x", c);
+		} else
+			*d++ = c;
+	}
+	return d - dst;
+}
+
+
+void
+log_msg( int level, const char *fmt, ...)
+{
+	struct log_tls *t = &logtls;
+	char	msg[ 2048], *m = msg;
+	va_list ap;
+	int		n;
+
+	pthread_once( &log_once, log_init);
+	if (!t->registered) {
+		pthread_setspecific( log_key, t);
+		t->registered = 1;
+	}
+	va_start( ap, fmt);
+	n = vsnprintf( msg, sizeof( msg), fmt, ap);
+	va_end( ap);
+	if (n < 0)
+		return;
+	if ((size_t) n >= sizeof( msg) && (m = malloc( n + 1)) != NULL) {
+		va_start( ap, fmt);
+		vsnprintf( m, n + 1, fmt, ap);
+		va_end( ap);
+	} else if (m == NULL) {
+		m = msg;
+		n = sizeof( msg) - 1;
+	}
+	if (log_sink == LOG_SINK_JSON) {
+		char   *j;
+		size_t	len = n;
+
+		// one record per message, the trailing newline belongs to the record
+		if (len && m[ len - 1] == '\n')
+			--len;
+		if ((j = malloc( 6 * len + 64)) != NULL) {
+			size_t jl = sprintf( j, "{\"level\":%d,", level);
+			if (t->capturing)
+				jl += sprintf( j + jl, "\"key\":%d,", t->key);
+			jl += sprintf( j + jl, "\"msg\":\"");
+			jl += log_jsonescape( j + jl, m, len);
+			jl += sprintf( j + jl, "\"}\n");
+			log_append( t, j, jl);
+			free( j);
+		}
+	} else
+		log_append( t, m, n);
+	if (m != msg)
+		free( m);
+	// errors are shown at once, even if stdout is a pipe, and a terminal gets every message
+	if (!t->capturing && (level == 0 || log_tty))
+		log_flush();
+}
+
+
+// captures the calling thread's messages under key, until log_end()
+void
+log_begin( int key)
+{
+	log_spill( &logtls);
+	logtls.capturing = 1;
+	logtls.key = key;
+}
+
+
+void
+log_end( void)
+{
+	log_spill( &logtls);
+	logtls.capturing = 0;
+	logtls.key = LOG_NOKEY;
+}
+
+
+// writes out all captured messages, ordered by key
+void
+log_flushpending( void)
+{
+	struct log_chunk *c, *next;
+
+	log_flush();
+	pthread_mutex_lock( &log_mtx);
+	c = log_pending;
+	log_pending = NULL;
+	pthread_mutex_unlock( &log_mtx);
+	for ( ; c != NULL; c = next) {
+		next = c->next;
+		fwrite( c->data, 1, c->len, stdout);
+		free( c);
+	}
+	fflush( stdout);
+}
+
+
+// writes out the calling thread's buffered messages
+void
+log_flush( void)
+{
+	if (!logtls.capturing)
+		log_spill( &logtls);
+	fflush( stdout);
+}
@@ -0,0 +1,67 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LOG_H
+#define	LOG_H
+
+/* Message output.
+ * Every thread collects its messages in its own buffer, which is written to
+ * stdout in one piece when it is full, on log_flush() and when the thread exits.
+ * Level 0 messages, and all messages if stdout is a terminal, are written at
+ * once. A thread working on one item of a parallel job (a core, a file) can
+ * capture its messages under a key with log_begin()/log_end(); log_flushpending()
+ * then writes all captured messages ordered by key, so the output does not
+ * interleave. Code writing to stdout itself must call log_flush() first.
+ * Levels above CPUP_LOG_MAX are compiled out.
+ */
+
+#ifndef CPUP_LOG_MAX
+#define CPUP_LOG_MAX 12
+#endif
+
+// output formats
+#define LOG_SINK_TEXT	0
+#define LOG_SINK_JSON	1		// one JSON object per message and line
+
+#define LOG_BUFSIZE		8192	// per-thread message buffer
+#define LOG_NOKEY		(-1)
+
+// spamminess level. per thread, the library sets it from the context on every call
+extern _Thread_local int cpup_verbosity;
+
+void log_setsink( int sink);
+int  log_getsink( void);
+void log_msg( int level, const char *fmt, ...) __printflike( 2, 3);
+void log_begin( int key);
+void log_end( void);
+void log_flushpending( void);
+void log_flush( void);
+size_t log_jsonescape( char *dst, const char *src, size_t len);
+
+#define INFO(level, ...) do { \
+		if ((level) <= CPUP_LOG_MAX && (level) <= cpup_verbosity) \
+			log_msg( (level), __VA_ARGS__); \
+	} while (0)
+
+#endif /* !LOG_H */
@@ -0,0 +1,255 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "cpupdate.h"
+#include "owrite.h"
+
+static struct owrite_file *owrite_find( struct owriter *ow, const char *path);
+static int owrite_reserve( struct owrite_file *f, size_t size);
+static int owrite_preload( struct owrite_file *f);
+static int owrite_writeall( int fd, const void *data, size_t size);
+
+
+void
+owrite_init( struct owriter *ow, const char *dir)
+{
+	memset( ow, 0, sizeof( *ow));
+	strcpy( ow->dir, dir);
+}
+
+
+static struct owrite_file *
+owrite_find( struct owriter *ow, const char *path)
+{
+	// the file written last is the likely one
+	for (int i = ow->n - 1; i >= 0; --i)
+		if (!strcmp( ow->files[ i].path, path))
+			return &ow->files[ i];
+	return NULL;
+}
+
+
+static int
+owrite_reserve( struct owrite_file *f, size_t size)
+{
+	size_t max = f->max ? f->max : 4096;
+	uint8_t *p;
+
+	if (f->size + size <= f->max)
+		return 0;
+	while (max < f->size + size)
+		max *= 2;
+	if ((p = realloc( f->data, max)) == NULL) {
+		INFO( 0, "Could not allocate output buffer for %s!\n", f->path);
+		return 1;
+	}
+	f->data = p;
+	f->max = max;
+	return 0;
+}
+
+
+// reads the current content of the file, if there is one
+static int
+owrite_preload( struct owrite_file *f)
+{
+	struct stat st;
+	int		fd, r = 0;
+
+	if ((fd = open( f->path, O_RDONLY | O_CLOEXEC)) < 0)
+		return (errno == ENOENT) ? 0 : 1;
+	if (fstat( fd, &st) < 0 || owrite_reserve( f, st.st_size) ||
+			read( fd, f->data, st.st_size) != st.st_size)
+		r = 1;
+	else
+		f->size = st.st_size;
+	close( fd);
+	if (r)
+		INFO( 0, "error reading file %s\n", f->path);
+	return r;
+}
+
+
+static int
+owrite_writeall( int fd, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	ssize_t n;
+
+	while (size > 0) {
+		if ((n = write( fd, p, size)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+
+/* adds data to the output file path, after its current content if append is set,
+ * else replacing it. writes the batch first if it is full
+ */
+int
+owrite_put( struct owriter *ow, const char *path, const void *data, size_t size, int append)
+{
+	struct owrite_file *f;
+
+	if ((f = owrite_find( ow, path)) == NULL) {
+		if ((ow->n >= OWRITE_BATCH || ow->buffered >= OWRITE_MAXBUF) && owrite_commit( ow))
+			return 1;
+		if (ow->n == ow->max) {
+			int max = ow->max ? 2 * ow->max : 64;
+
+			if ((f = reallocarray( ow->files, max, sizeof( *f))) == NULL) {
+				INFO( 0, "Could not allocate output file table!\n");
+				return 1;
+			}
+			ow->files = f;
+			ow->max = max;
+		}
+		f = &ow->files[ ow->n];
+		memset( f, 0, sizeof( *f));
+		if ((f->path = strdup( path)) == NULL) {
+			INFO( 0, "Could not allocate output file table!\n");
+			return 1;
+		}
+		// without its current content, the file must not be written at all
+		if (append && owrite_preload( f)) {
+			free( f->path);
+			free( f->data);
+			return 1;
+		}
+		++ow->n;
+		ow->buffered += f->size;
+	} else if (!append) {
+		ow->buffered -= f->size;
+		f->size = 0;
+	}
+	if (owrite_reserve( f, size))
+		return 1;
+	memcpy( f->data + f->size, data, size);
+	f->size += size;
+	ow->buffered += size;
+	return 0;
+}
+
+
+/* writes the batch: all files to temporary files, then syncs these, renames them
+ * into place and syncs the directory once. returns nonzero if any file failed,
+ * the others are in place then
+ */
+int
+owrite_commit( struct owriter *ow)
+{
+	char  (*tmppaths)[ MAXPATHLEN];
+	int	   *fds;
+	int		i, dfd, err, nok = 0, r = 0;
+
+	if (ow->n == 0)
+		return 0;
+	if ((tmppaths = calloc( ow->n, sizeof( *tmppaths))) == NULL ||
+			(fds = calloc( ow->n, sizeof( *fds))) == NULL) {
+		INFO( 0, "Could not allocate output file table!\n");
+		free( tmppaths);
+		return 1;
+	}
+	// writing all first lets the file system schedule the data together
+	for (i = 0; i < ow->n; ++i) {
+		struct owrite_file *f = &ow->files[ i];
+
+		fds[ i] = -1;
+		if (snprintf( tmppaths[ i], MAXPATHLEN, "%s.XXXXXX", f->path) >= MAXPATHLEN) {
+			INFO( 0, "filename buffer too short for %s\n", f->path);
+		} else if ((fds[ i] = mkstemp( tmppaths[ i])) < 0) {
+			INFO( 0, "error opening output file %s\n", tmppaths[ i]);
+		} else if (fchmod( fds[ i], 0644) < 0 || owrite_writeall( fds[ i], f->data, f->size)) {
+			INFO( 0, "error writing to file %s\n", tmppaths[ i]);
+			close( fds[ i]);
+			unlink( tmppaths[ i]);
+			fds[ i] = -1;
+		}
+	}
+	// the content must be on disk before the rename makes it visible
+	for (i = 0; i < ow->n; ++i) {
+		if (fds[ i] < 0) {
+			r = 1;
+			continue;
+		}
+		err = (fsync( fds[ i]) < 0);
+		if (close( fds[ i]) < 0)
+			err = 1;
+		if (err || rename( tmppaths[ i], ow->files[ i].path) < 0) {
+			INFO( 0, "error writing to file %s\n", ow->files[ i].path);
+			unlink( tmppaths[ i]);
+			r = 1;
+		} else
+			++nok;
+	}
+	if ((dfd = open( ow->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 || fsync( dfd) < 0) {
+		INFO( 0, "error syncing directory %s\n", ow->dir);
+		r = 1;
+	}
+	if (dfd >= 0)
+		close( dfd);
+	INFO( 11, "%d files written to %s\n", nok, ow->dir);
+	for (i = 0; i < ow->n; ++i) {
+		free( ow->files[ i].path);
+		free( ow->files[ i].data);
+	}
+	ow->n = 0;
+	ow->buffered = 0;
+	free( tmppaths);
+	free( fds);
+	return r;
+}
+
+
+// drops what was not committed
+void
+owrite_free( struct owriter *ow)
+{
+	for (int i = 0; i < ow->n; ++i) {
+		free( ow->files[ i].path);
+		free( ow->files[ i].data);
+	}
+	free( ow->files);
+	memset( ow, 0, sizeof( *ow));
+}
@@ -0,0 +1,60 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OWRITE_H
+#define	OWRITE_H
+
+/* Buffered atomic output of the converted files.
+ * Output files are collected in memory, appends included, and written in batches:
+ * each to a temporary file in the target directory, which is synced and renamed over
+ * the final name, then the directory is synced once for the whole batch. So readers
+ * never see a partial file, and a crash leaves either the old or the new file.
+ * Appending to a file not in the batch starts from its current content.
+ */
+
+#define OWRITE_BATCH	256					// files per batch
+#define OWRITE_MAXBUF	(64 * 1024 * 1024)	// bytes buffered before a batch is written
+
+struct owrite_file {
+	char	   *path;
+	uint8_t	   *data;
+	size_t		size,
+				max;
+};
+
+struct owriter {
+	char		dir[ MAXPATHLEN];		// directory of the files, synced per batch
+	struct owrite_file
+			   *files;
+	int			n,
+				max;
+	size_t		buffered;
+};
+
+void owrite_init( struct owriter *ow, const char *dir);
+int  owrite_put( struct owriter *ow, const char *path, const void *data, size_t size, int append);
+int  owrite_commit( struct owriter *ow);
+void owrite_free( struct owriter *ow);
+
+#endif /* !OWRITE_H */
@@ -0,0 +1,336 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sha256.h>
+#include <zlib.h>
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "cpupdate.h"
+#include "pack.h"
+
+static int pack_cmpentry( const void *a, const void *b);
+
+
+void
+pack_hash( const void *data, size_t size, uint8_t *hash)
+{
+	SHA256_CTX ctx;
+
+	SHA256_Init( &ctx);
+	SHA256_Update( &ctx, data, size);
+	SHA256_Final( hash, &ctx);
+}
+
+
+/* maps the container at path and checks its header.
+ * only the header page is touched here, the table and blobs fault in on use
+ */
+int
+pack_open( struct pack_map *pm, const char *path)
+{
+	struct stat st;
+	int fd, r = 0;
+
+	memset( pm, 0, sizeof( *pm));
+	if ((fd = open( path, O_RDONLY | O_CLOEXEC)) < 0) {
+		INFO( 12, "Failed to open container %s\n", path);
+		return 1;
+	}
+	if (fstat( fd, &st) < 0 || st.st_size < (off_t) sizeof( struct pack_header)) {
+		INFO( 0, "Container %s: too short\n", path);
+		r = 1;
+	}
+	if (!r) {
+		pm->size = st.st_size;
+		pm->base = mmap( NULL, pm->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (pm->base == MAP_FAILED) {
+			INFO( 0, "Container %s: mmap failed\n", path);
+			pm->base = NULL;
+			r = 1;
+		}
+	}
+	close( fd);
+	if (!r) {
+		pm->hdr = pm->base;
+		if (memcmp( pm->hdr->magic, PACK_MAGIC, sizeof( pm->hdr->magic)) ||
+				pm->hdr->version != PACK_VERSION) {
+			INFO( 0, "Container %s: not a cpupdate container or unsupported version\n", path);
+			r = 1;
+		} else if (pm->hdr->tableoff + (uint64_t) pm->hdr->nentries * sizeof( struct pack_entry) > pm->size ||
+				pm->hdr->dataoff + pm->hdr->datasize > pm->size) {
+			INFO( 0, "Container %s: truncated\n", path);
+			r = 1;
+		}
+	}
+	if (!r) {
+		pm->table = (struct pack_entry *) ((uint8_t *) pm->base + pm->hdr->tableoff);
+		pm->data  = (const uint8_t *) pm->base + pm->hdr->dataoff;
+	} else
+		pack_close( pm);
+	return r;
+}
+
+
+void
+pack_close( struct pack_map *pm)
+{
+	if (pm->base != NULL)
+		munmap( pm->base, pm->size);
+	memset( pm, 0, sizeof( *pm));
+}
+
+
+/* binary searches the table for signature.
+ * returns the number of entries with that signature, *first is set to the index of the first one
+ */
+int
+pack_find( struct pack_map *pm, uint32_t signature, int *first)
+{
+	int lo = 0, hi = pm->hdr->nentries, n;
+
+	// lower bound of signature
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (pm->table[ mid].signature < signature)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+	for (n = lo; n < (int) pm->hdr->nentries && pm->table[ n].signature == signature; ++n)
+		;
+	return n - lo;
+}
+
+
+/* copies (or decompresses) the blob of entry e to buf, which must hold e->size bytes,
+ * and verifies its hash
+ */
+int
+pack_getblob( struct pack_map *pm, const struct pack_entry *e, void *buf)
+{
+	uint8_t hash[ PACK_HASHLEN];
+	uLongf	len = e->size;
+
+	if (e->offset + e->csize > pm->hdr->datasize) {
+		INFO( 0, "Container entry %08x/%x rev 0x%x lies outside data area\n", e->signature, e->flags, e->revision);
+		return 1;
+	}
+	if (e->comp == PACK_COMP_NONE && e->csize == e->size) {
+		memcpy( buf, pm->data + e->offset, e->size);
+	} else if (e->comp == PACK_COMP_ZLIB) {
+		if (uncompress( buf, &len, pm->data + e->offset, e->csize) != Z_OK || len != e->size) {
+			INFO( 0, "Container entry %08x/%x rev 0x%x: decompression failed\n", e->signature, e->flags, e->revision);
+			return 1;
+		}
+	} else {
+		INFO( 0, "Container entry %08x/%x rev 0x%x: unsupported compression\n", e->signature, e->flags, e->revision);
+		return 1;
+	}
+	pack_hash( buf, e->size, hash);
+	if (memcmp( hash, e->hash, sizeof( hash))) {
+		INFO( 0, "Container entry %08x/%x rev 0x%x: content hash mismatch\n", e->signature, e->flags, e->revision);
+		return 1;
+	}
+	return 0;
+}
+
+
+// adds a copy of blob to the writer, compressed if that is enabled and pays off
+int
+pack_add( struct pack_writer *pw, uint32_t signature, uint32_t flags, int32_t revision,
+			uint32_t date, const void *blob, uint32_t size)
+{
+	struct pack_entry *e;
+	void   *stored = NULL;
+	uLongf	clen;
+
+	if (pw->n == pw->max) {
+		int nmax = pw->max ? pw->max * 2 : 256;
+		void *ne = realloc( pw->entries, nmax * sizeof( *pw->entries));
+		void *nb = (ne != NULL) ? realloc( pw->blobs, nmax * sizeof( *pw->blobs)) : NULL;
+		if (ne != NULL)
+			pw->entries = ne;
+		if (nb == NULL) {
+			INFO( 0, "Could not allocate container table!\n");
+			return 1;
+		}
+		pw->blobs = nb;
+		pw->max = nmax;
+	}
+	e = &pw->entries[ pw->n];
+	memset( e, 0, sizeof( *e));
+	e->signature = signature;
+	e->flags	 = flags;
+	e->revision	 = revision;
+	e->date		 = date;
+	e->size		 = size;
+	e->csize	 = size;
+	e->comp		 = PACK_COMP_NONE;
+	pack_hash( blob, size, e->hash);
+	if (pw->compress) {
+		clen = compressBound( size);
+		if ((stored = malloc( clen)) != NULL &&
+				compress2( stored, &clen, blob, size, Z_BEST_COMPRESSION) == Z_OK && clen < size) {
+			e->csize = clen;
+			e->comp  = PACK_COMP_ZLIB;
+		} else {
+			free( stored);
+			stored = NULL;
+		}
+	}
+	if (stored == NULL) {
+		if ((stored = malloc( size)) == NULL) {
+			INFO( 0, "Buffer allocation of %u bytes failed\n", size);
+			return 1;
+		}
+		memcpy( stored, blob, size);
+	}
+	pw->blobs[ pw->n] = stored;
+	// remember the insertion index in offset until the table gets sorted
+	e->offset = pw->n++;
+	return 0;
+}
+
+
+static int
+pack_cmpentry( const void *a, const void *b)
+{
+	const struct pack_entry *x = a, *y = b;
+
+	if (x->signature != y->signature)
+		return (x->signature > y->signature) - (x->signature < y->signature);
+	if (x->flags != y->flags)
+		return (x->flags > y->flags) - (x->flags < y->flags);
+	// revisions compare unsigned, like in the update path
+	if (x->revision != y->revision)
+		return ((uint32_t) x->revision < (uint32_t) y->revision) ? -1 : 1;
+	// keep insertion order for identical keys, so earlier sources take precedence
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+
+/* sorts the collected entries, drops duplicates and writes the container
+ * to a temporary file which is then renamed to path
+ */
+int
+pack_write( struct pack_writer *pw, const char *path)
+{
+	struct pack_header hdr;
+	char	tmppath[ MAXPATHLEN];
+	void  **blobs = NULL;
+	uint64_t off = 0;
+	int		fd, i, n = 0, r = 0;
+	long	pgsz = sysconf( _SC_PAGESIZE);
+
+	qsort( pw->entries, pw->n, sizeof( *pw->entries), pack_cmpentry);
+	if (pw->n && (blobs = malloc( pw->n * sizeof( *blobs))) == NULL) {
+		INFO( 0, "Could not allocate container table!\n");
+		return 1;
+	}
+	// drop identical blobs, assign the data offsets in table order
+	for (i = 0; i < pw->n; ++i) {
+		struct pack_entry *e = &pw->entries[ i];
+		void *blob = pw->blobs[ e->offset];
+
+		if (n > 0) {
+			struct pack_entry *p = &pw->entries[ n - 1];
+			if (p->signature == e->signature && p->flags == e->flags && p->revision == e->revision) {
+				if (!memcmp( p->hash, e->hash, sizeof( e->hash))) {
+					INFO( 12, "Container: dropping duplicate of %08x/%x rev 0x%x\n", e->signature, e->flags, e->revision);
+					continue;
+				}
+				INFO( 0, "Notice: blobs %08x/%x rev 0x%x differ in content, keeping both\n", e->signature, e->flags, e->revision);
+			}
+		}
+		blobs[ n] = blob;
+		e->offset = off;
+		off += e->csize;
+		pw->entries[ n++] = *e;
+	}
+	memset( &hdr, 0, sizeof( hdr));
+	memcpy( hdr.magic, PACK_MAGIC, sizeof( hdr.magic));
+	hdr.version	 = PACK_VERSION;
+	hdr.nentries = n;
+	hdr.tableoff = sizeof( hdr);
+	hdr.dataoff	 = roundup2( hdr.tableoff + (uint64_t) n * sizeof( struct pack_entry), pgsz);
+	hdr.datasize = off;
+
+	if (snprintf( tmppath, sizeof( tmppath), "%s.XXXXXX", path) >= (int) sizeof( tmppath)) {
+		INFO( 0, "filename buffer too short for %s\n", path);
+		free( blobs);
+		return 1;
+	}
+	if ((fd = mkstemp( tmppath)) < 0) {
+		INFO( 0, "error opening output file %s\n", tmppath);
+		free( blobs);
+		return 1;
+	}
+	fchmod( fd, 0644);
+	if (write( fd, &hdr, sizeof( hdr)) != sizeof( hdr) ||
+			write( fd, pw->entries, n * sizeof( struct pack_entry)) != (ssize_t) (n * sizeof( struct pack_entry)) ||
+			lseek( fd, hdr.dataoff, SEEK_SET) < 0)
+		r = 1;
+	for (i = 0; !r && i < n; ++i)
+		if (write( fd, blobs[ i], pw->entries[ i].csize) != pw->entries[ i].csize)
+			r = 1;
+	if (!r && fsync( fd) < 0)
+		r = 1;
+	if (close( fd) < 0)
+		r = 1;
+	if (!r && rename( tmppath, path) < 0)
+		r = 1;
+	if (r) {
+		INFO( 0, "error writing container %s\n", path);
+		unlink( tmppath);
+	} else {
+		INFO( 10, "Wrote container %s: %d blobs, %ju bytes of blob data\n", path, n, (uintmax_t) off);
+	}
+	free( blobs);
+	return r;
+}
+
+
+void
+pack_freewriter( struct pack_writer *pw)
+{
+	for (int i = 0; i < pw->n; ++i)
+		free( pw->blobs[ i]);
+	free( pw->blobs);
+	free( pw->entries);
+	memset( pw, 0, sizeof( *pw));
+}
@@ -0,0 +1,98 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PACK_H
+#define	PACK_H
+
+/* Packed repository container.
+ * A single file holding many microcode blobs, laid out as
+ *    pack_header | pack_entry table | padding to page boundary | blob data
+ * The entry table is sorted by signature, flags and revision, so that all blobs
+ * of one signature are adjacent and can be found by binary search.
+ * All fields are in host byte order, the container is meant to be built on the host using it.
+ */
+#define PACK_MAGIC		("CPUPACK1")
+#define PACK_VERSION	1
+
+// compression methods of a blob
+#define PACK_COMP_NONE	0
+#define PACK_COMP_ZLIB	1
+
+#define PACK_HASHLEN	32		// SHA-256
+
+struct pack_header {
+	char		magic[ 8];
+	uint32_t	version;
+	uint32_t	nentries;
+	uint64_t	tableoff;		// file offset of the entry table
+	uint64_t	dataoff;		// file offset of the blob data area
+	uint64_t	datasize;		// size of the blob data area
+};
+
+struct pack_entry {
+	uint32_t	signature;
+	uint32_t	flags;			// platform flags the blob applies to
+	int32_t		revision;
+	uint32_t	date;
+	uint64_t	offset;			// offset of the stored blob, relative to the data area
+	uint32_t	size;			// uncompressed blob size
+	uint32_t	csize;			// stored blob size
+	uint32_t	comp;			// PACK_COMP_*
+	uint32_t	reserved;
+	uint8_t		hash[ PACK_HASHLEN];	// hash of the uncompressed blob
+};
+
+// a container mapped for reading
+struct pack_map {
+	void	   *base;
+	size_t		size;
+	struct pack_header
+			   *hdr;
+	struct pack_entry
+			   *table;
+	const uint8_t
+			   *data;
+};
+
+// collects blobs for writing a container
+struct pack_writer {
+	struct pack_entry
+			   *entries;
+	void	  **blobs;			// stored (possibly compressed) blob per entry
+	int			n,
+				max;
+	int			compress;		// bool: try compressing the blobs
+};
+
+int  pack_open( struct pack_map *pm, const char *path);
+void pack_close( struct pack_map *pm);
+int  pack_find( struct pack_map *pm, uint32_t signature, int *first);
+int  pack_getblob( struct pack_map *pm, const struct pack_entry *e, void *buf);
+void pack_hash( const void *data, size_t size, uint8_t *hash);
+int  pack_add( struct pack_writer *pw, uint32_t signature, uint32_t flags, int32_t revision,
+			uint32_t date, const void *blob, uint32_t size);
+int  pack_write( struct pack_writer *pw, const char *path);
+void pack_freewriter( struct pack_writer *pw);
+
+#endif /* !PACK_H */
@@ -0,0 +1,191 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/param.h>
+#include <sys/types.h>
+
+#include "cpupdate.h"
+#include "prune.h"
+
+static int prune_cmpfile( const void *a, const void *b);
+static int prune_cmpkeep( const void *a, const void *b);
+static int prune_cmppos( const void *a, const void *b);
+
+
+// adds a file to the table, returns its index or -1
+int
+prune_addfile( struct prune_set *ps, const char *path, off_t size, int nblobs, int sorted)
+{
+	struct prune_file *f;
+
+	if (ps->nfiles == ps->maxfiles) {
+		int max = ps->maxfiles ? 2 * ps->maxfiles : 256;
+		if ((f = reallocarray( ps->files, max, sizeof( *f))) == NULL) {
+			INFO( 0, "Could not allocate file table!\n");
+			return -1;
+		}
+		ps->files = f;
+		ps->maxfiles = max;
+	}
+	f = &ps->files[ ps->nfiles];
+	if ((f->path = strdup( path)) == NULL) {
+		INFO( 0, "Could not allocate file table!\n");
+		return -1;
+	}
+	f->size   = size;
+	f->nblobs = nblobs;
+	f->nkept  = 0;
+	f->sorted = sorted;
+	f->pref   = ps->nfiles;
+	return ps->nfiles++;
+}
+
+
+int
+prune_addrec( struct prune_set *ps, int file, int blob, uint32_t signature, uint32_t flags,
+			int32_t revision, uint32_t size)
+{
+	struct prune_rec *rec;
+
+	if (ps->nrecs == ps->maxrecs) {
+		int max = ps->maxrecs ? 2 * ps->maxrecs : 1024;
+		if ((rec = reallocarray( ps->recs, max, sizeof( *rec))) == NULL) {
+			INFO( 0, "Could not allocate blob table!\n");
+			return 1;
+		}
+		ps->recs = rec;
+		ps->maxrecs = max;
+	}
+	rec = &ps->recs[ ps->nrecs++];
+	rec->signature	= signature;
+	rec->flags		= flags;
+	rec->revision	= revision;
+	rec->size		= size;
+	rec->file		= file;
+	rec->blob		= blob;
+	rec->keep		= 0;
+	return 0;
+}
+
+
+// orders files by preference for keeping their copy of a blob: more blobs first, then by path
+static int
+prune_cmpfile( const void *a, const void *b)
+{
+	const struct prune_file *fa = *(struct prune_file * const *) a, *fb = *(struct prune_file * const *) b;
+
+	if (fa->nblobs != fb->nblobs)
+		return (fa->nblobs > fb->nblobs) ? -1 : 1;
+	return strcmp( fa->path, fb->path);
+}
+
+
+// orders by signature, flags, newest revision first, then by preference of the copy
+static int
+prune_cmpkeep( const void *a, const void *b)
+{
+	const struct prune_rec *ra = a, *rb = b;
+
+	if (ra->signature != rb->signature)
+		return (ra->signature < rb->signature) ? -1 : 1;
+	if (ra->flags != rb->flags)
+		return (ra->flags < rb->flags) ? -1 : 1;
+	if (ra->revision != rb->revision)
+		return ((uint32_t) ra->revision > (uint32_t) rb->revision) ? -1 : 1;
+	if (ra->pref != rb->pref)
+		return ra->pref - rb->pref;
+	return ra->blob - rb->blob;
+}
+
+
+// orders by file and position in the file
+static int
+prune_cmppos( const void *a, const void *b)
+{
+	const struct prune_rec *ra = a, *rb = b;
+
+	if (ra->file != rb->file)
+		return ra->file - rb->file;
+	return ra->blob - rb->blob;
+}
+
+
+/* marks the blobs to keep: per signature and flags the keep newest revisions and the
+ * pinned ones, each only once. afterwards the records are in file order again
+ */
+void
+prune_select( struct prune_set *ps, int keep, const uint32_t *pinsig, const int32_t *pinrev, int npins)
+{
+	struct prune_rec *rec, *prev = NULL;
+	struct prune_file **order;
+	int rank = 0;
+
+	// rank the files, so the choice of the copy to keep does not depend on directory order
+	if ((order = calloc( ps->nfiles, sizeof( *order))) != NULL) {
+		for (int i = 0; i < ps->nfiles; ++i)
+			order[ i] = &ps->files[ i];
+		qsort( order, ps->nfiles, sizeof( *order), prune_cmpfile);
+		for (int i = 0; i < ps->nfiles; ++i)
+			order[ i]->pref = i;
+		free( order);
+	}
+	for (int i = 0; i < ps->nrecs; ++i)
+		ps->recs[ i].pref = ps->files[ ps->recs[ i].file].pref;
+	qsort( ps->recs, ps->nrecs, sizeof( *ps->recs), prune_cmpkeep);
+	for (int i = 0; i < ps->nrecs; prev = rec, ++i) {
+		rec = &ps->recs[ i];
+		if (prev == NULL || prev->signature != rec->signature || prev->flags != rec->flags)
+			rank = 0;
+		else if (prev->revision == rec->revision)
+			continue;			// another copy of the same revision
+		else
+			++rank;
+		rec->keep = (rank < keep);
+		for (int p = 0; !rec->keep && p < npins; ++p)
+			rec->keep = (pinsig[ p] == rec->signature && pinrev[ p] == rec->revision);
+	}
+	qsort( ps->recs, ps->nrecs, sizeof( *ps->recs), prune_cmppos);
+	for (int i = 0; i < ps->nrecs; ++i)
+		if (ps->recs[ i].keep)
+			++ps->files[ ps->recs[ i].file].nkept;
+}
+
+
+void
+prune_free( struct prune_set *ps)
+{
+	for (int i = 0; i < ps->nfiles; ++i)
+		free( ps->files[ i].path);
+	free( ps->files);
+	free( ps->recs);
+	memset( ps, 0, sizeof( *ps));
+}
@@ -0,0 +1,74 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PRUNE_H
+#define	PRUNE_H
+
+/* Repository pruning.
+ * The vendor code records every blob found in the repository, prune_select() then
+ * decides which ones stay: for each signature and set of platform flags the newest
+ * revisions, plus pinned ones. A revision found in several files is kept only once,
+ * preferring the file with the most blobs, so single-blob copies of blobs that are
+ * also in a multi-blob file go away.
+ */
+
+// a blob found in the repository
+struct prune_rec {
+	uint32_t	signature;
+	uint32_t	flags;
+	int32_t		revision;
+	uint32_t	size;
+	int			file;			// index into the file table
+	int			blob;			// index of the blob in its file
+	int			pref;			// preference of the file, lower is better
+	int			keep;			// bool, set by prune_select()
+};
+
+struct prune_file {
+	char	   *path;
+	off_t		size;
+	int			nblobs;
+	int			nkept;			// set by prune_select()
+	int			sorted;			// bool: blobs are in (flags, revision) order
+	int			pref;			// rank by prune_select(), lower is preferred
+};
+
+struct prune_set {
+	struct prune_rec
+			   *recs;
+	int			nrecs,
+				maxrecs;
+	struct prune_file
+			   *files;
+	int			nfiles,
+				maxfiles;
+};
+
+int  prune_addfile( struct prune_set *ps, const char *path, off_t size, int nblobs, int sorted);
+int  prune_addrec( struct prune_set *ps, int file, int blob, uint32_t signature, uint32_t flags,
+			int32_t revision, uint32_t size);
+void prune_select( struct prune_set *ps, int keep, const uint32_t *pinsig, const int32_t *pinrev, int npins);
+void prune_free( struct prune_set *ps);
+
+#endif /* !PRUNE_H */
@@ -0,0 +1,299 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/param.h>
+
+#include "cpupdate.h"
+#include "report.h"
+
+static int report_flush( struct report *rp);
+static char *report_str( char *d, const char *s);
+static char *report_hex( char *d, uint32_t v, int digits);
+static char *report_dec( char *d, uint64_t v);
+static char *report_date( char *d, uint32_t date);
+static char *report_csvname( char *d, const char *name, size_t len);
+
+static const char *report_types[] = { "", "blob", "cores", "bad" };
+static const char report_digits[] = "0123456789abcdef";
+
+
+// returns the format named name, or -1
+int
+report_format( const char *name)
+{
+	if (!strcmp( name, "json"))
+		return REPORT_JSON;
+	if (!strcmp( name, "csv"))
+		return REPORT_CSV;
+	if (!strcmp( name, "bin"))
+		return REPORT_BIN;
+	return -1;
+}
+
+
+// starts a report to the file path, or stdout for "-"
+struct report *
+report_open( const char *path, int format)
+{
+	struct report *rp;
+	struct report_hdr hdr = { REPORT_MAGIC, REPORT_VERSION };
+
+	if ((rp = malloc( sizeof( *rp))) == NULL) {
+		INFO( 0, "Could not allocate report buffer!\n");
+		return NULL;
+	}
+	memset( rp, 0, offsetof( struct report, buf));
+	rp->format = format;
+	if (!strcmp( path, "-")) {
+		// the report shares stdout with the messages, which must come out first
+		log_flush();
+		rp->fd = STDOUT_FILENO;
+	} else if ((rp->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+		INFO( 0, "Could not create report %s: %s\n", path, strerror( errno));
+		free( rp);
+		return NULL;
+	} else
+		rp->closefd = 1;
+	if (format == REPORT_CSV)
+		rp->len = report_str( rp->buf, REPORT_CSVHEADER) - rp->buf;
+	else if (format == REPORT_BIN) {
+		memcpy( rp->buf, &hdr, sizeof( hdr));
+		rp->len = sizeof( hdr);
+	}
+	return rp;
+}
+
+
+// writes out the rest of the report and frees it. returns nonzero if a write failed
+int
+report_close( struct report *rp)
+{
+	int r;
+
+	if (rp == NULL)
+		return 0;
+	report_flush( rp);
+	if (rp->closefd && close( rp->fd) < 0 && !rp->error) {
+		INFO( 0, "Could not write report: %s\n", strerror( errno));
+		rp->error = 1;
+	}
+	r = rp->error;
+	INFO( 11, "%ju report rows written\n", (uintmax_t) rp->nrows);
+	free( rp);
+	return r;
+}
+
+
+// appends a row. name is the file path of blob and bad rows, the cpu list of cores rows
+void
+report_row( struct report *rp, const struct report_rec *rec, const char *name)
+{
+	struct report_rec brec;
+	size_t	namelen = strnlen( name, MAXPATHLEN);
+	char   *d;
+
+	if (rp == NULL || rp->error)
+		return;
+	// the longest row, a JSON row with all of the name escaped, must fit
+	if (rp->len + 6 * namelen + 512 > sizeof( rp->buf) && report_flush( rp))
+		return;
+	d = rp->buf + rp->len;
+	switch (rp->format) {
+		case REPORT_BIN:
+			brec = *rec;
+			brec.pad = 0;
+			brec.namelen = namelen;
+			memcpy( d, &brec, sizeof( brec));
+			memcpy( d + sizeof( brec), name, namelen);
+			d += sizeof( brec) + namelen;
+			break;
+		case REPORT_CSV:
+			d = report_str( d, report_types[ rec->type]);
+			*d++ = ',';
+			d = report_csvname( d, name, namelen);
+			*d++ = ',';
+			if (rec->type == REPORT_BLOB)
+				d = report_dec( d, rec->offset);
+			*d++ = ',';
+			if (rec->type != REPORT_BAD) {
+				d = report_hex( d, rec->signature, 8);
+				*d++ = ',';
+				d = report_hex( d, rec->flags, 2);
+				*d++ = ',';
+				d = report_hex( d, rec->revision, 8);
+			} else
+				d = report_str( d, ",,");
+			*d++ = ',';
+			if (rec->type == REPORT_BLOB && rec->totalsize != 0) {
+				d = report_date( d, rec->date);
+				*d++ = ',';
+				d = report_dec( d, rec->datasize);
+				*d++ = ',';
+				d = report_dec( d, rec->totalsize);
+			} else
+				d = report_str( d, ",,");
+			*d++ = ',';
+			if (rec->type == REPORT_CORES || (rec->type == REPORT_BLOB && rec->totalsize != 0))
+				d = report_dec( d, rec->count);
+			*d++ = '\n';
+			break;
+		default:
+			d = report_str( d, "{\"type\":\"");
+			d = report_str( d, report_types[ rec->type]);
+			d = report_str( d, "\",\"name\":\"");
+			d += log_jsonescape( d, name, namelen);
+			*d++ = '"';
+			if (rec->type == REPORT_BLOB) {
+				d = report_str( d, ",\"offset\":");
+				d = report_dec( d, rec->offset);
+			}
+			if (rec->type != REPORT_BAD) {
+				d = report_str( d, ",\"signature\":\"");
+				d = report_hex( d, rec->signature, 8);
+				d = report_str( d, "\",\"flags\":\"");
+				d = report_hex( d, rec->flags, 2);
+				d = report_str( d, "\",\"revision\":\"");
+				d = report_hex( d, rec->revision, 8);
+				*d++ = '"';
+			}
+			if (rec->type == REPORT_BLOB && rec->totalsize != 0) {
+				d = report_str( d, ",\"date\":\"");
+				d = report_date( d, rec->date);
+				d = report_str( d, "\",\"datasize\":");
+				d = report_dec( d, rec->datasize);
+				d = report_str( d, ",\"totalsize\":");
+				d = report_dec( d, rec->totalsize);
+				d = report_str( d, ",\"extsigs\":");
+				d = report_dec( d, rec->count);
+			}
+			if (rec->type == REPORT_CORES) {
+				d = report_str( d, ",\"count\":");
+				d = report_dec( d, rec->count);
+			}
+			d = report_str( d, "}\n");
+			break;
+	}
+	rp->len = d - rp->buf;
+	++rp->nrows;
+}
+
+
+static int
+report_flush( struct report *rp)
+{
+	size_t	done = 0;
+	ssize_t	n;
+
+	// messages printed so far come first
+	if (rp->fd == STDOUT_FILENO)
+		log_flush();
+	while (!rp->error && done < rp->len) {
+		if ((n = write( rp->fd, rp->buf + done, rp->len - done)) < 0) {
+			if (errno == EINTR)
+				continue;
+			INFO( 0, "Could not write report: %s\n", strerror( errno));
+			rp->error = 1;
+		} else
+			done += n;
+	}
+	rp->len = 0;
+	return rp->error;
+}
+
+
+static char *
+report_str( char *d, const char *s)
+{
+	while (*s)
+		*d++ = *s++;
+	return d;
+}
+
+
+// lower case, zero padded to digits
+static char *
+report_hex( char *d, uint32_t v, int digits)
+{
+	for (int i = digits - 1; i >= 0; --i, v >>= 4)
+		d[ i] = report_digits[ v & 0xf];
+	return d + digits;
+}
+
+
+static char *
+report_dec( char *d, uint64_t v)
+{
+	char	tmp[ 20];
+	int		n = 0;
+
+	do
+		tmp[ n++] = '0' + v % 10;
+	while ((v /= 10) != 0);
+	while (n > 0)
+		*d++ = tmp[ --n];
+	return d;
+}
+
+
+// the header date field holds month, day and year as BCD: mmddyyyy, written as yyyy-mm-dd
+static char *
+report_date( char *d, uint32_t date)
+{
+	d = report_hex( d, date & 0xffff, 4);
+	*d++ = '-';
+	d = report_hex( d, date >> 24, 2);
+	*d++ = '-';
+	return report_hex( d, (date >> 16) & 0xff, 2);
+}
+
+
+// quoted only if needed, quotes doubled
+static char *
+report_csvname( char *d, const char *name, size_t len)
+{
+	if (strcspn( name, ",\"\n\r") >= len) {
+		memcpy( d, name, len);
+		return d + len;
+	}
+	*d++ = '"';
+	for (size_t i = 0; i < len; ++i) {
+		if (name[ i] == '"')
+			*d++ = '"';
+		*d++ = name[ i];
+	}
+	*d++ = '"';
+	return d;
+}
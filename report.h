@@ -0,0 +1,88 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REPORT_H
+#define	REPORT_H
+
+/* Machine readable reports of -i, -f, -c and -d.
+ * The rows are formatted from the parsed headers straight into a large buffer, which
+ * is written out whenever it fills up, so big repositories report without per field
+ * stdio calls. Formats:
+ *  json	one object per line: {"type":"blob","name":...,"offset":...,"signature":"000906ea",...}
+ *  csv		a header line, then one line per row with the columns of REPORT_CSVHEADER
+ *  bin		struct report_hdr, then per row a struct report_rec followed by namelen
+ *			bytes of the name (file path or cpu list), in host byte order
+ */
+
+#define REPORT_MAGIC	0x50525043		// "CPRP"
+#define REPORT_VERSION	1
+#define REPORT_BUFSIZE	(256 * 1024)
+
+// formats
+#define REPORT_JSON		0
+#define REPORT_CSV		1
+#define REPORT_BIN		2
+
+// row types
+#define REPORT_BLOB		1				// a blob of a microcode file
+#define REPORT_CORES	2				// a group of cores with equal signature, flags and revision
+#define REPORT_BAD		3				// a microcode file that failed the check
+
+#define REPORT_CSVHEADER "type,name,offset,signature,flags,revision,date,datasize,totalsize,count\n"
+
+struct report_hdr {
+	uint32_t	magic;
+	uint32_t	version;
+};
+
+struct report_rec {
+	uint8_t		type;
+	uint8_t		pad;
+	uint16_t	namelen;
+	uint32_t	signature;
+	uint32_t	flags;
+	uint32_t	revision;
+	uint32_t	date;			// as in the header: mmddyyyy, BCD
+	uint32_t	datasize;
+	uint32_t	totalsize;		// 0 if the header was not kept: date and sizes are unknown and left out
+	uint32_t	count;			// extended signatures of a blob, cores of a group
+	uint64_t	offset;			// of a blob in the (decoded) file image
+};
+
+struct report {
+	int			fd;
+	int			format;
+	int			closefd;		// bool: fd was opened by report_open()
+	int			error;			// bool: a write failed, later rows are dropped
+	uint64_t	nrows;
+	size_t		len;			// used of buf
+	char		buf[ REPORT_BUFSIZE];
+};
+
+int  report_format( const char *name);
+struct report *report_open( const char *path, int format);
+int  report_close( struct report *rp);
+void report_row( struct report *rp, const struct report_rec *rec, const char *name);
+
+#endif /* !REPORT_H */
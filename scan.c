@@ -0,0 +1,167 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cpupdate.h"
+#include "scan.h"
+
+/* Recursive repository walker.
+ * Directories are read via descriptors, file types are taken from d_type and
+ * only if the file system does not provide it (or for symlinks) an fstatat()
+ * relative to the directory descriptor is done. The path name is built up
+ * incrementally in a single buffer.
+ */
+struct scan_state {
+	const char *pattern;		// fnmatch pattern for file names, NULL for all files
+	scan_cb		cb;
+	void	   *arg;
+	char		path[ MAXPATHLEN];
+	int			nfiles,
+				ndirs,
+				nstats;
+};
+
+static int scan_dir( struct scan_state *st, int dfd, size_t pathlen, int depth);
+
+
+static int
+scan_dir( struct scan_state *st, int dfd, size_t pathlen, int depth)
+{
+	DIR			  *dirp;
+	struct dirent *direntry;
+	struct stat	   sb;
+	size_t		   namelen;
+	int			   type, fd, r = 0;
+
+	if ((dirp = fdopendir( dfd)) == NULL) {
+		INFO( 0, "Failed to access directory %s\n", st->path);
+		close( dfd);
+		return 0;
+	}
+	++st->ndirs;
+	while (!r && (direntry = readdir( dirp)) != NULL) {
+		if (direntry->d_namlen == 0 ||
+				strcmp( direntry->d_name, ".") == 0 ||
+				strcmp( direntry->d_name, "..") == 0)
+			continue;
+		namelen = strlen( direntry->d_name);
+		if (pathlen + 1 + namelen >= sizeof( st->path)) {
+			INFO( 0, "skipping %s, filename buffer too short\n", direntry->d_name);
+			continue;
+		}
+		st->path[ pathlen] = '/';
+		memcpy( st->path + pathlen + 1, direntry->d_name, namelen + 1);
+		type = direntry->d_type;
+		if (type == DT_UNKNOWN || type == DT_LNK) {
+			++st->nstats;
+			if (fstatat( dirfd( dirp), direntry->d_name, &sb, 0) < 0) {
+				INFO( 0, "stat(%s) failed\n", st->path);
+				continue;
+			}
+			if (S_ISDIR( sb.st_mode))
+				// do not follow symlinked directories, they might loop
+				type = (type == DT_LNK) ? DT_UNKNOWN : DT_DIR;
+			else
+				type = S_ISREG( sb.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+		if (type == DT_DIR) {
+			if (depth >= SCAN_MAXDEPTH) {
+				INFO( 0, "skipping %s: nested too deep\n", st->path);
+				continue;
+			}
+			fd = openat( dirfd( dirp), direntry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0) {
+				INFO( 0, "Failed to access directory %s\n", st->path);
+				continue;
+			}
+			r = scan_dir( st, fd, pathlen + 1 + namelen, depth + 1);
+		} else if (type == DT_REG) {
+			if (st->pattern != NULL && fnmatch( st->pattern, direntry->d_name, FNM_PERIOD))
+				continue;
+			++st->nfiles;
+			r = st->cb( dirfd( dirp), direntry->d_name, st->path, st->arg);
+		} else {
+			INFO( 12, "skipping %s: not a regular file\n", st->path);
+		}
+	}
+	st->path[ pathlen] = '\0';
+	closedir( dirp);
+	return r;
+}
+
+
+/* walks root recursively and calls cb for every regular file whose name
+ * matches pattern. returns 0, or the first nonzero callback return value
+ */
+int
+scan_tree( const char *root, const char *pattern, scan_cb cb, void *arg)
+{
+	struct scan_state *st;
+	size_t len;
+	int fd, r;
+
+	len = strlen( root);
+	// strip trailing slashes, but keep a lone "/"
+	while (len > 1 && root[ len - 1] == '/')
+		--len;
+	if (len >= MAXPATHLEN) {
+		INFO( 0, "ERROR: Path too long\n");
+		return 1;
+	}
+	if ((fd = open( root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		INFO( 0, "Failed to access directory %s\n", root);
+		return 1;
+	}
+	if ((st = calloc( 1, sizeof( *st))) == NULL) {
+		INFO( 0, "Could not allocate scanner state!\n");
+		close( fd);
+		return 1;
+	}
+	st->pattern = pattern;
+	st->cb = cb;
+	st->arg = arg;
+	memcpy( st->path, root, len);
+	if (len == 1 && root[ 0] == '/')
+		len = 0;
+	st->path[ len] = '\0';
+	r = scan_dir( st, fd, len, 0);
+	INFO( 12, "Scanned %d directories, %d files, %d stat calls\n", st->ndirs, st->nfiles, st->nstats);
+	free( st);
+	return r;
+}
@@ -0,0 +1,575 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "cpupdate.h"
+#include "gen.h"
+#include "pack.h"
+#include "scan.h"
+#include "serve.h"
+
+#define SERVE_LINEMAX	1024		// longest JSON request
+
+// a loaded repository, freed when the last request using it is done
+struct serve_snap {
+	struct pack_map
+				maps[ SERVE_MAXSRCS];
+	int			nmaps;
+	int			refs;
+	uint64_t	fingerprint;	// of the repository files it was loaded from
+};
+
+struct serve_state {
+	struct vendor_funcs
+			   *vf;
+	struct cpupdate_params
+			   *params;
+	const char *sockpath;
+	int			verbosity;		// of the thread starting the server
+	pthread_mutex_t
+				mtx;			// protects snap, the snapshots' refs and nclients
+	struct serve_snap
+			   *snap;			// current snapshot
+	int			nclients;
+};
+
+struct serve_client {
+	struct serve_state
+			   *st;
+	int			fd;
+};
+
+static void serve_mix( uint64_t *h, const void *data, size_t size);
+static int serve_fpfile( int dfd, const char *name, const char *path, void *arg);
+static uint64_t serve_fingerprint( struct serve_state *st);
+static void serve_freesnap( struct serve_snap *snap);
+static struct serve_snap *serve_load( struct serve_state *st, uint64_t fingerprint);
+static struct serve_snap *serve_acquire( struct serve_state *st);
+static void serve_release( struct serve_state *st, struct serve_snap *snap);
+static void serve_reload( struct serve_state *st);
+static int serve_count( struct serve_snap *snap);
+static const struct pack_entry *serve_best( struct serve_snap *snap, uint32_t signature, uint32_t pflags,
+			struct pack_map **pmp);
+static int serve_writeall( int fd, const void *data, size_t size);
+static int serve_putjson( int fd, const struct serve_reply *rep);
+static int serve_answer( struct serve_state *st, int fd, uint32_t op, uint32_t signature, uint32_t pfid,
+			int32_t revision, int json);
+static int serve_jsonnum( const char *line, const char *key, uint32_t *val);
+static int serve_json( struct serve_state *st, int fd, const char *line);
+static void *serve_client( void *arg);
+static void serve_accept( struct serve_state *st, int lfd);
+
+
+// FNV-1a
+static void
+serve_mix( uint64_t *h, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+
+	while (size--) {
+		*h ^= *p++;
+		*h *= 0x100000001b3ULL;
+	}
+}
+
+
+// scan_tree() callback for serve_fingerprint: mixes path, size, mtime and inode of a file into the hash
+static int
+serve_fpfile( int dfd, const char *name, const char *path, void *arg)
+{
+	struct stat sb;
+
+	if (fstatat( dfd, name, &sb, 0) < 0)
+		return 0;
+	serve_mix( arg, path, strlen( path) + 1);
+	serve_mix( arg, &sb.st_size, sizeof( sb.st_size));
+	serve_mix( arg, &sb.st_mtim, sizeof( sb.st_mtim));
+	serve_mix( arg, &sb.st_ino, sizeof( sb.st_ino));
+	return 0;
+}
+
+
+/* a hash over the metadata of all repository files. the repository tools replace
+ * files by rename, so any change shows up here without reading the files
+ */
+static uint64_t
+serve_fingerprint( struct serve_state *st)
+{
+	struct cpupdate_params *params = st->params;
+	const char *dirs[] = { params->primdir, params->secdir };
+	struct stat sb;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	if (strlen( params->packpath) && stat( params->packpath, &sb) == 0) {
+		serve_mix( &h, &sb.st_size, sizeof( sb.st_size));
+		serve_mix( &h, &sb.st_mtim, sizeof( sb.st_mtim));
+		serve_mix( &h, &sb.st_ino, sizeof( sb.st_ino));
+	}
+	for (int i = 0; i < nitems( dirs); ++i)
+		if (strlen( dirs[ i]) && !access( dirs[ i], R_OK))
+			scan_tree( dirs[ i], params->pattern, serve_fpfile, &h);
+	return h;
+}
+
+
+static void
+serve_freesnap( struct serve_snap *snap)
+{
+	for (int i = 0; i < snap->nmaps; ++i)
+		pack_close( &snap->maps[ i]);
+	free( snap);
+}
+
+
+/* loads the repository: the configured container is mapped as is, the directories are
+ * packed into containers next to the socket, which are mapped and unlinked right away
+ */
+static struct serve_snap *
+serve_load( struct serve_state *st, uint64_t fingerprint)
+{
+	struct cpupdate_params *p = NULL;
+	struct serve_snap *snap;
+	char	dirs[ 2][ MAXPATHLEN];
+	int r = 0;
+
+	if ((snap = calloc( 1, sizeof( *snap))) == NULL || (p = malloc( sizeof( *p))) == NULL) {
+		INFO( 0, "Could not allocate repository snapshot!\n");
+		free( snap);
+		return NULL;
+	}
+	snap->refs = 1;
+	snap->fingerprint = fingerprint;
+	// a snapshot of the generations current now
+	strcpy( dirs[ 0], st->params->primdir);
+	strcpy( dirs[ 1], st->params->secdir);
+	for (int i = 0; i < nitems( dirs); ++i)
+		gen_resolve( dirs[ i]);
+	if (strlen( st->params->packpath)) {
+		if (!(r = pack_open( &snap->maps[ snap->nmaps], st->params->packpath)))
+			++snap->nmaps;
+	}
+	for (int i = 0; !r && i < nitems( dirs); ++i) {
+		if (!strlen( dirs[ i]) || access( dirs[ i], R_OK))
+			continue;
+		*p = *st->params;
+		strcpy( p->srcdir, dirs[ i]);
+		p->packcompress = 0;
+		if (snprintf( p->packpath, sizeof( p->packpath), "%s.snap%d", st->sockpath, i) >= sizeof( p->packpath)) {
+			INFO( 0, "filename buffer too short for %s\n", p->packpath);
+			r = 1;
+			break;
+		}
+		INFO( 11, "Loading %s\n", dirs[ i]);
+		if (!(r = st->vf->pack( p)) && !(r = pack_open( &snap->maps[ snap->nmaps], p->packpath)))
+			++snap->nmaps;
+		unlink( p->packpath);
+	}
+	free( p);
+	if (r) {
+		serve_freesnap( snap);
+		return NULL;
+	}
+	return snap;
+}
+
+
+static struct serve_snap *
+serve_acquire( struct serve_state *st)
+{
+	struct serve_snap *snap;
+
+	pthread_mutex_lock( &st->mtx);
+	snap = st->snap;
+	++snap->refs;
+	pthread_mutex_unlock( &st->mtx);
+	return snap;
+}
+
+
+static void
+serve_release( struct serve_state *st, struct serve_snap *snap)
+{
+	int last;
+
+	pthread_mutex_lock( &st->mtx);
+	last = (--snap->refs == 0);
+	pthread_mutex_unlock( &st->mtx);
+	if (last)
+		serve_freesnap( snap);
+}
+
+
+// loads the repository again if it changed, keeps serving the old one if that fails
+static void
+serve_reload( struct serve_state *st)
+{
+	struct serve_snap *snap, *old;
+	uint64_t fp = serve_fingerprint( st);
+
+	// only this thread replaces st->snap
+	if (fp == st->snap->fingerprint)
+		return;
+	INFO( 11, "Repository changed, reloading\n");
+	if ((snap = serve_load( st, fp)) == NULL) {
+		INFO( 0, "Reloading the repository failed, still serving the previous one\n");
+		return;
+	}
+	pthread_mutex_lock( &st->mtx);
+	old = st->snap;
+	st->snap = snap;
+	pthread_mutex_unlock( &st->mtx);
+	serve_release( st, old);
+	INFO( 10, "Reloaded, serving %d blobs\n", serve_count( snap));
+}
+
+
+static int
+serve_count( struct serve_snap *snap)
+{
+	int n = 0;
+
+	for (int i = 0; i < snap->nmaps; ++i)
+		n += snap->maps[ i].hdr->nentries;
+	return n;
+}
+
+
+/* the newest blob of signature applying to the platform flags pflags, from all sources.
+ * on equal revisions the earlier source wins
+ */
+static const struct pack_entry *
+serve_best( struct serve_snap *snap, uint32_t signature, uint32_t pflags, struct pack_map **pmp)
+{
+	const struct pack_entry *best = NULL;
+	int first, n;
+
+	for (int m = 0; m < snap->nmaps; ++m) {
+		n = pack_find( &snap->maps[ m], signature, &first);
+		for (int i = first; i < first + n; ++i) {
+			const struct pack_entry *e = &snap->maps[ m].table[ i];
+
+			if ((e->flags & pflags) && (best == NULL || (uint32_t) e->revision > (uint32_t) best->revision)) {
+				best = e;
+				*pmp = &snap->maps[ m];
+			}
+		}
+	}
+	return best;
+}
+
+
+// a client going away must not kill the server, so no SIGPIPE
+static int
+serve_writeall( int fd, const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t n;
+
+	while (size > 0) {
+		if ((n = send( fd, p, size, MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+
+static int
+serve_putjson( int fd, const struct serve_reply *rep)
+{
+	static const char *const status[] = { "ok", "none", "bad request", "error" };
+	char	buf[ 512];
+	int		n;
+
+	if (rep->status != SERVE_OK)
+		return serve_writeall( fd, buf, snprintf( buf, sizeof( buf), "{\"status\":\"%s\"}\n", status[ rep->status]));
+	n = snprintf( buf, sizeof( buf), "{\"status\":\"ok\",\"signature\":\"0x%08x\",\"flags\":\"0x%x\","
+				"\"revision\":\"0x%x\",\"date\":\"0x%08x\",\"size\":%u,\"newer\":%s,\"sha256\":\"",
+				rep->signature, rep->flags, rep->revision, rep->date, rep->size, rep->newer ? "true" : "false");
+	for (int i = 0; i < PACK_HASHLEN; ++i)
+		n += snprintf( buf + n, sizeof( buf) - n, "%02x", rep->hash[ i]);
+	n += snprintf( buf + n, sizeof( buf) - n, "\"}\n");
+	return serve_writeall( fd, buf, n);
+}
+
+
+// answers one request. the blob is copied out before the snapshot is released
+static int
+serve_answer( struct serve_state *st, int fd, uint32_t op, uint32_t signature, uint32_t pfid,
+			int32_t revision, int json)
+{
+	struct serve_reply rep;
+	struct serve_snap *snap;
+	struct pack_map *pm = NULL;
+	const struct pack_entry *e;
+	void   *blob = NULL;
+	int		r;
+
+	memset( &rep, 0, sizeof( rep));
+	rep.magic = SERVE_MAGIC;
+	rep.signature = signature;
+	if (pfid > 7 || (op != SERVE_OP_QUERY && op != SERVE_OP_BLOB)) {
+		rep.status = SERVE_BADREQ;
+	} else {
+		snap = serve_acquire( st);
+		if ((e = serve_best( snap, signature, 1 << pfid, &pm)) == NULL) {
+			rep.status = SERVE_NONE;
+		} else {
+			rep.flags = e->flags;
+			rep.revision = e->revision;
+			rep.date = e->date;
+			rep.size = e->size;
+			rep.newer = (uint32_t) e->revision > (uint32_t) revision;
+			memcpy( rep.hash, e->hash, sizeof( rep.hash));
+			if (op == SERVE_OP_BLOB && ((blob = malloc( e->size)) == NULL || pack_getblob( pm, e, blob)))
+				rep.status = SERVE_ERROR;
+		}
+		serve_release( st, snap);
+	}
+	INFO( 12, "Request %08x/%u rev 0x%x: status %u, rev 0x%x\n", signature, pfid, revision, rep.status, rep.revision);
+	r = json ? serve_putjson( fd, &rep) : serve_writeall( fd, &rep, sizeof( rep));
+	if (!r && rep.status == SERVE_OK && blob != NULL)
+		r = serve_writeall( fd, blob, rep.size);
+	free( blob);
+	return r;
+}
+
+
+/* the value of "key" in the JSON object line: a number, a number in a string, or a bool.
+ * returns 0 if found, 1 if missing, -1 if malformed
+ */
+static int
+serve_jsonnum( const char *line, const char *key, uint32_t *val)
+{
+	char	pat[ 32], *end;
+	const char *p;
+
+	snprintf( pat, sizeof( pat), "\"%s\"", key);
+	if ((p = strstr( line, pat)) == NULL)
+		return 1;
+	for (p += strlen( pat); isspace( (unsigned char) *p); ++p)
+		;
+	if (*p++ != ':')
+		return -1;
+	for (; isspace( (unsigned char) *p); ++p)
+		;
+	if (!strncmp( p, "true", 4) || !strncmp( p, "false", 5)) {
+		*val = (*p == 't');
+		return 0;
+	}
+	if (*p == '"')
+		++p;
+	errno = 0;
+	*val = strtoul( p, &end, 0);
+	return (end == p || errno) ? -1 : 0;
+}
+
+
+static int
+serve_json( struct serve_state *st, int fd, const char *line)
+{
+	uint32_t sig = 0, pfid = 0, rev = 0, blob = 0, op = SERVE_OP_QUERY;
+
+	if (serve_jsonnum( line, "signature", &sig) || serve_jsonnum( line, "platform", &pfid) < 0 ||
+			serve_jsonnum( line, "revision", &rev) < 0 || serve_jsonnum( line, "blob", &blob) < 0)
+		op = 0;
+	else if (blob)
+		op = SERVE_OP_BLOB;
+	return serve_answer( st, fd, op, sig, pfid, rev, 1);
+}
+
+
+// connection thread: answers requests until the client hangs up or sends garbage
+static void *
+serve_client( void *arg)
+{
+	struct serve_client *cl = arg;
+	struct serve_state *st = cl->st;
+	struct serve_req req;
+	char	buf[ SERVE_LINEMAX], *nl;
+	size_t	len = 0, used, skip;
+	ssize_t	n;
+	int		r = 0;
+
+	cpup_verbosity = st->verbosity;
+	while (!r) {
+		// whitespace between requests
+		for (skip = 0; skip < len && isspace( (unsigned char) buf[ skip]); ++skip)
+			;
+		memmove( buf, buf + skip, len -= skip);
+		used = 0;
+		if (len > 0 && buf[ 0] == '{') {
+			if ((nl = memchr( buf, '\n', len)) != NULL) {
+				*nl = '\0';
+				r = serve_json( st, cl->fd, buf);
+				used = nl + 1 - buf;
+			}
+		} else if (len >= sizeof( req)) {
+			memcpy( &req, buf, sizeof( req));
+			if (req.magic != SERVE_MAGIC)
+				break;
+			r = serve_answer( st, cl->fd, req.op, req.signature, req.pfid, req.revision, 0);
+			used = sizeof( req);
+		}
+		if (used) {
+			memmove( buf, buf + used, len -= used);
+			continue;
+		}
+		if (len == sizeof( buf))
+			break;
+		if ((n = read( cl->fd, buf + len, sizeof( buf) - len)) < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	close( cl->fd);
+	pthread_mutex_lock( &st->mtx);
+	--st->nclients;
+	pthread_mutex_unlock( &st->mtx);
+	free( cl);
+	return NULL;
+}
+
+
+static void
+serve_accept( struct serve_state *st, int lfd)
+{
+	struct serve_client *cl;
+	pthread_t tid;
+	int		fd, full;
+
+	if ((fd = accept4( lfd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+		return;
+	pthread_mutex_lock( &st->mtx);
+	if (!(full = (st->nclients >= SERVE_MAXCLIENTS)))
+		++st->nclients;
+	pthread_mutex_unlock( &st->mtx);
+	if (full) {
+		INFO( 11, "Too many clients, refusing connection\n");
+		close( fd);
+		return;
+	}
+	if ((cl = malloc( sizeof( *cl))) != NULL) {
+		cl->st = st;
+		cl->fd = fd;
+		if (pthread_create( &tid, NULL, serve_client, cl) == 0) {
+			pthread_detach( tid);
+			return;
+		}
+		free( cl);
+	}
+	INFO( 0, "Could not start client thread!\n");
+	close( fd);
+	pthread_mutex_lock( &st->mtx);
+	--st->nclients;
+	pthread_mutex_unlock( &st->mtx);
+}
+
+
+/* loads the repository of params with vf and answers queries on the socket sockpath.
+ * every interval seconds the repository is checked for changes. only returns on errors
+ */
+int
+serve_run( struct vendor_funcs *vf, struct cpupdate_params *params, const char *sockpath, int interval)
+{
+	struct serve_state st;
+	struct sockaddr_un sun;
+	struct pollfd pfd;
+	struct stat sb;
+	uint64_t lastcheck;
+	int		lfd, n, listening = 0, r = 0;
+
+	memset( &sun, 0, sizeof( sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen( sockpath) >= sizeof( sun.sun_path)) {
+		INFO( 0, "ERROR: Socket path too long\n");
+		return 1;
+	}
+	strcpy( sun.sun_path, sockpath);
+	memset( &st, 0, sizeof( st));
+	st.vf = vf;
+	st.params = params;
+	st.sockpath = sockpath;
+	st.verbosity = cpup_verbosity;
+	pthread_mutex_init( &st.mtx, NULL);
+	if ((st.snap = serve_load( &st, serve_fingerprint( &st))) == NULL)
+		return 1;
+	// left over by a server that was killed
+	if (lstat( sockpath, &sb) == 0 && S_ISSOCK( sb.st_mode))
+		unlink( sockpath);
+	if ((lfd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+			(r = bind( lfd, (struct sockaddr *) &sun, sizeof( sun))) < 0 || listen( lfd, SOMAXCONN) < 0) {
+		INFO( 0, "Could not listen on socket %s\n", sockpath);
+		if (r == 0 && lfd >= 0)
+			unlink( sockpath);
+		r = 1;
+	} else {
+		INFO( 10, "Serving %d blobs on %s\n", serve_count( st.snap), sockpath);
+		listening = 1;
+	}
+	pfd.fd = lfd;
+	pfd.events = POLLIN;
+	lastcheck = cpu_nsecs();
+	while (!r) {
+		if ((n = poll( &pfd, 1, interval * 1000)) < 0 && errno != EINTR) {
+			INFO( 0, "Polling socket %s failed\n", sockpath);
+			r = 1;
+		} else if (n > 0)
+			serve_accept( &st, lfd);
+		// also when busy
+		if (!r && cpu_nsecs() - lastcheck >= (uint64_t) interval * 1000000000) {
+			serve_reload( &st);
+			lastcheck = cpu_nsecs();
+		}
+		log_flush();
+	}
+	if (listening)
+		unlink( sockpath);
+	if (lfd >= 0)
+		close( lfd);
+	// client threads may still use the current snapshot, so it is left to them
+	return r;
+}
@@ -0,0 +1,79 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SERVE_H
+#define	SERVE_H
+
+/* Query server on a UNIX domain socket.
+ * The repository is loaded once into a snapshot of containers: the configured container
+ * as is, and the primary and secondary directories packed (and so validated) into private
+ * ones. Clients ask for the best blob for a signature, platform ID and current revision,
+ * the newest one applying. The snapshot is rebuilt when the repository changes and swapped
+ * in atomically, requests in flight finish on the old one.
+ *
+ * Requests are either binary, struct serve_req in host byte order answered by struct
+ * serve_reply, or a JSON object on one line, e.g.
+ *    {"signature":"0x906ea","platform":1,"revision":"0xb4","blob":false}
+ * answered by a JSON object on one line. With SERVE_OP_BLOB, or "blob":true, the reply
+ * is followed by the size bytes of the blob if one was found.
+ * A connection may carry any number of requests.
+ */
+
+#define SERVE_MAGIC		0x31515043	// "CPQ1" on little endian hosts
+#define SERVE_MAXCLIENTS 64			// connections served at the same time
+#define SERVE_MAXSRCS	3			// container, primary and secondary directory
+
+// operations
+#define SERVE_OP_QUERY	1			// metadata only
+#define SERVE_OP_BLOB	2			// metadata and blob
+
+// reply status
+#define SERVE_OK		0
+#define SERVE_NONE		1			// no blob for signature and platform
+#define SERVE_BADREQ	2
+#define SERVE_ERROR		3			// blob could not be read
+
+struct serve_req {
+	uint32_t	magic;
+	uint32_t	op;
+	uint32_t	signature;
+	uint32_t	pfid;				// platform ID, 0-7
+	int32_t		revision;			// current revision of the asking core
+};
+
+struct serve_reply {
+	uint32_t	magic;
+	uint32_t	status;
+	uint32_t	signature;
+	uint32_t	flags;
+	int32_t		revision;
+	uint32_t	date;
+	uint32_t	size;
+	uint32_t	newer;				// bool: revision is newer than the one asked with
+	uint8_t		hash[ PACK_HASHLEN];
+};
+
+int serve_run( struct vendor_funcs *vf, struct cpupdate_params *params, const char *sockpath, int interval);
+
+#endif /* !SERVE_H */
@@ -0,0 +1,149 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/param.h>
+
+#include "cpupdate.h"
+#include "pack.h"
+#include "sync.h"
+
+static int sync_cmprec( const void *a, const void *b);
+
+
+// adds a file to the path table, returns its index or -1
+int
+sync_addfile( struct sync_tree *st, const char *path)
+{
+	if (st->npaths == st->maxpaths) {
+		int max = st->maxpaths ? 2 * st->maxpaths : 256;
+		char **p;
+
+		if ((p = reallocarray( st->paths, max, sizeof( *p))) == NULL) {
+			INFO( 0, "Could not allocate path table!\n");
+			return -1;
+		}
+		st->paths = p;
+		st->maxpaths = max;
+	}
+	if ((st->paths[ st->npaths] = strdup( path)) == NULL) {
+		INFO( 0, "Could not allocate path table!\n");
+		return -1;
+	}
+	return st->npaths++;
+}
+
+
+int
+sync_addrec( struct sync_tree *st, int file, int blob, uint32_t signature, uint32_t flags,
+			int32_t revision, const void *data, uint32_t size)
+{
+	struct sync_rec *rec;
+
+	if (st->nrecs == st->maxrecs) {
+		int max = st->maxrecs ? 2 * st->maxrecs : 1024;
+
+		if ((rec = reallocarray( st->recs, max, sizeof( *rec))) == NULL) {
+			INFO( 0, "Could not allocate blob table!\n");
+			return 1;
+		}
+		st->recs = rec;
+		st->maxrecs = max;
+	}
+	rec = &st->recs[ st->nrecs++];
+	rec->signature	= signature;
+	rec->flags		= flags;
+	rec->revision	= revision;
+	rec->size		= size;
+	rec->file		= file;
+	rec->blob		= blob;
+	pack_hash( data, size, rec->hash);
+	return 0;
+}
+
+
+// orders by signature, flags, revision and content
+int
+sync_cmpkey( const struct sync_rec *a, const struct sync_rec *b)
+{
+	if (a->signature != b->signature)
+		return (a->signature < b->signature) ? -1 : 1;
+	if (a->flags != b->flags)
+		return (a->flags < b->flags) ? -1 : 1;
+	if (a->revision != b->revision)
+		return ((uint32_t) a->revision < (uint32_t) b->revision) ? -1 : 1;
+	return memcmp( a->hash, b->hash, PACK_HASHLEN);
+}
+
+
+// as sync_cmpkey(), then by position, so the sort order is stable
+static int
+sync_cmprec( const void *a, const void *b)
+{
+	const struct sync_rec *ra = a, *rb = b;
+	int c;
+
+	if ((c = sync_cmpkey( ra, rb)))
+		return c;
+	if (ra->file != rb->file)
+		return ra->file - rb->file;
+	return ra->blob - rb->blob;
+}
+
+
+void
+sync_sort( struct sync_tree *st)
+{
+	qsort( st->recs, st->nrecs, sizeof( *st->recs), sync_cmprec);
+}
+
+
+// returns the number of records of the signature of recs[ first], which must be sorted
+int
+sync_group( struct sync_tree *st, int first)
+{
+	int n = first;
+
+	while (n < st->nrecs && st->recs[ n].signature == st->recs[ first].signature)
+		++n;
+	return n - first;
+}
+
+
+void
+sync_free( struct sync_tree *st)
+{
+	for (int i = 0; i < st->npaths; ++i)
+		free( st->paths[ i]);
+	free( st->paths);
+	free( st->recs);
+	memset( st, 0, sizeof( *st));
+}
@@ -0,0 +1,63 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SYNC_H
+#define	SYNC_H
+
+/* Repository sync.
+ * The blobs of the source and the target tree are recorded with signature, flags,
+ * revision and content hash, and sorted. The vendor code then compares the trees
+ * signature by signature and rewrites only the target files whose blobs differ.
+ */
+
+// a blob found in a tree
+struct sync_rec {
+	uint32_t	signature;
+	uint32_t	flags;
+	int32_t		revision;
+	uint32_t	size;
+	int			file;			// index into the path table
+	int			blob;			// index of the blob in its file
+	uint8_t		hash[ PACK_HASHLEN];
+};
+
+struct sync_tree {
+	struct sync_rec
+			   *recs;
+	int			nrecs,
+				maxrecs;
+	char	  **paths;
+	int			npaths,
+				maxpaths;
+};
+
+int  sync_addfile( struct sync_tree *st, const char *path);
+int  sync_addrec( struct sync_tree *st, int file, int blob, uint32_t signature, uint32_t flags,
+			int32_t revision, const void *data, uint32_t size);
+void sync_sort( struct sync_tree *st);
+int  sync_group( struct sync_tree *st, int first);
+int  sync_cmpkey( const struct sync_rec *a, const struct sync_rec *b);
+void sync_free( struct sync_tree *st);
+
+#endif /* !SYNC_H */
@@ -0,0 +1,262 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "cpupdate.h"
+#include "cpio.h"
+
+/* Round-trip test of the newc cpio writer.
+ * A small independent reader parses what cpio_add() and cpio_close() wrote and
+ * compares every field with what went in. Called with archive file names, it
+ * instead lists and checks these archives, e.g. the output of --early-cpio.
+ * Exits 0 if all checks passed.
+ */
+
+#define CPIO_HDRSIZE	110			// magic and 13 fields of 8 hex digits
+
+struct cpio_entry {
+	uint32_t	fields[ 13];		// ino, mode, uid, gid, nlink, mtime, filesize, devmajor,
+									// devminor, rdevmajor, rdevminor, namesize, check
+	const char *name;
+	const uint8_t
+			   *data;
+};
+
+#define E_INO		0
+#define E_MODE		1
+#define E_UID		2
+#define E_GID		3
+#define E_NLINK		4
+#define E_MTIME		5
+#define E_SIZE		6
+#define E_NAMESIZE	11
+
+_Thread_local int cpup_verbosity = 10;
+
+static int nfail;
+
+static int  readfile( const char *path, uint8_t **buf, size_t *len);
+static int  gethex( const uint8_t *p, uint32_t *v);
+static int  cpio_next( const uint8_t *buf, size_t len, size_t *off, struct cpio_entry *e);
+static int  checkarchive( const char *path, int list);
+static void roundtrip( const char *dir);
+
+
+#define CHECK(cond, ...) do { \
+		if (!(cond)) { \
+			printf( "FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf( __VA_ARGS__); \
+			printf( "\n"); \
+			++nfail; \
+		} \
+	} while (0)
+
+
+static int
+readfile( const char *path, uint8_t **buf, size_t *len)
+{
+	struct stat sb;
+	int fd, r = 1;
+
+	if ((fd = open( path, O_RDONLY)) < 0)
+		return 1;
+	if (fstat( fd, &sb) == 0 && (*buf = malloc( sb.st_size + 1)) != NULL) {
+		if (read( fd, *buf, sb.st_size) == sb.st_size) {
+			*len = sb.st_size;
+			r = 0;
+		} else
+			free( *buf);
+	}
+	close( fd);
+	return r;
+}
+
+
+// parses 8 hex digits, upper or lower case
+static int
+gethex( const uint8_t *p, uint32_t *v)
+{
+	*v = 0;
+	for (int i = 0; i < 8; ++i) {
+		if (p[ i] >= '0' && p[ i] <= '9')
+			*v = (*v << 4) | (p[ i] - '0');
+		else if ((p[ i] | 0x20) >= 'a' && (p[ i] | 0x20) <= 'f')
+			*v = (*v << 4) | ((p[ i] | 0x20) - 'a' + 10);
+		else
+			return 1;
+	}
+	return 0;
+}
+
+
+/* reads the entry at *off and advances *off behind its padded data.
+ * returns 0 for an entry, 1 for the trailer, -1 if the archive is malformed
+ */
+static int
+cpio_next( const uint8_t *buf, size_t len, size_t *off, struct cpio_entry *e)
+{
+	size_t o = *off;
+
+	if (len - o < CPIO_HDRSIZE || memcmp( buf + o, CPIO_MAGIC, 6))
+		return -1;
+	for (int i = 0; i < 13; ++i)
+		if (gethex( buf + o + 6 + 8 * i, &e->fields[ i]))
+			return -1;
+	o += CPIO_HDRSIZE;
+	if (e->fields[ E_NAMESIZE] == 0 || len - o < e->fields[ E_NAMESIZE] ||
+			buf[ o + e->fields[ E_NAMESIZE] - 1] != '\0')
+		return -1;
+	e->name = (const char *) buf + o;
+	// the header and name together are padded to a multiple of 4
+	o = roundup2( o + e->fields[ E_NAMESIZE], 4);
+	if (o > len || len - o < e->fields[ E_SIZE])
+		return -1;
+	e->data = buf + o;
+	o = roundup2( o + e->fields[ E_SIZE], 4);
+	if (o > len)
+		return -1;
+	*off = o;
+	return strcmp( e->name, CPIO_TRAILER) == 0;
+}
+
+
+// checks the structure of an archive, with list also prints its entries
+static int
+checkarchive( const char *path, int list)
+{
+	struct cpio_entry e;
+	uint8_t *buf;
+	size_t	 len, off = 0;
+	int		 r;
+
+	if (readfile( path, &buf, &len)) {
+		printf( "FAIL cannot read %s\n", path);
+		return 1;
+	}
+	while ((r = cpio_next( buf, len, &off, &e)) == 0)
+		if (list)
+			printf( "%06o %8u %s\n", e.fields[ E_MODE], e.fields[ E_SIZE], e.name);
+	if (r < 0)
+		printf( "FAIL %s: malformed entry at offset %zu\n", path, off);
+	else if (off != len) {
+		printf( "FAIL %s: %zu bytes behind the trailer\n", path, len - off);
+		r = -1;
+	}
+	free( buf);
+	return r < 0;
+}
+
+
+// writes an archive through cpio.c and compares everything read back
+static void
+roundtrip( const char *dir)
+{
+	static const char *names[] = { "a", "ab", "abc", "abcd", "kernel/x86/microcode/GenuineIntel.bin" };
+	struct cpio_writer cw;
+	struct cpio_entry e;
+	char	 path[ MAXPATHLEN];
+	uint8_t	 data[ 64], *buf;
+	size_t	 len, off = 0;
+	int		 n = 0, r;
+	DIR		*dirp;
+	struct dirent *de;
+
+	for (size_t i = 0; i < sizeof( data); ++i)
+		data[ i] = i * 7 + 1;
+	snprintf( path, sizeof( path), "%s/test.cpio", dir);
+	CHECK( cpio_open( &cw, path) == 0, "cpio_open %s", path);
+	cpio_add( &cw, "kernel", CPIO_MODE_DIR, NULL, 0);
+	// all name and data lengths modulo 4, so every padding case is written
+	for (uint32_t size = 0; size < 8; ++size)
+		cpio_add( &cw, names[ size % nitems( names)], CPIO_MODE_FILE, data, size);
+	cpio_add( &cw, names[ 4], CPIO_MODE_FILE, data, sizeof( data));
+	CHECK( cpio_close( &cw) == 0, "cpio_close");
+
+	CHECK( readfile( path, &buf, &len) == 0, "read %s", path);
+	if (nfail)
+		return;
+	CHECK( len % 4 == 0, "archive size %zu not padded", len);
+	for (; (r = cpio_next( buf, len, &off, &e)) == 0; ++n) {
+		uint32_t mode = n == 0 ? CPIO_MODE_DIR : CPIO_MODE_FILE;
+		uint32_t size = n == 0 ? 0 : n <= 8 ? n - 1 : sizeof( data);
+		const char *name = n == 0 ? "kernel" : n <= 8 ? names[ (n - 1) % nitems( names)] : names[ 4];
+
+		CHECK( e.fields[ E_INO] == (uint32_t) n + 1, "entry %d: inode %u", n, e.fields[ E_INO]);
+		CHECK( e.fields[ E_MODE] == mode, "entry %d: mode %o", n, e.fields[ E_MODE]);
+		CHECK( e.fields[ E_UID] == 0 && e.fields[ E_GID] == 0, "entry %d: owner", n);
+		CHECK( e.fields[ E_MTIME] == 0, "entry %d: mtime", n);
+		CHECK( e.fields[ E_NLINK] == (n == 0 ? 2 : 1), "entry %d: nlink %u", n, e.fields[ E_NLINK]);
+		CHECK( e.fields[ E_SIZE] == size, "entry %d: size %u, expected %u", n, e.fields[ E_SIZE], size);
+		CHECK( e.fields[ E_NAMESIZE] == strlen( name) + 1, "entry %d: namesize", n);
+		CHECK( !strcmp( e.name, name), "entry %d: name %s, expected %s", n, e.name, name);
+		CHECK( !memcmp( e.data, data, size), "entry %d: data differs", n);
+	}
+	CHECK( r == 1, "malformed entry %d at offset %zu", n, off);
+	CHECK( n == 10, "%d entries, expected 10", n);
+	CHECK( r != 1 || e.fields[ E_SIZE] == 0, "trailer has data");
+	CHECK( off == len, "%zu bytes behind the trailer", len - off);
+	free( buf);
+
+	// the temporary file must be gone
+	if ((dirp = opendir( dir)) != NULL) {
+		while ((de = readdir( dirp)) != NULL)
+			CHECK( de->d_name[ 0] == '.' || !strcmp( de->d_name, "test.cpio"), "left over %s", de->d_name);
+		closedir( dirp);
+	}
+	unlink( path);
+}
+
+
+int
+main( int argc, char *argv[])
+{
+	char dir[] = "/tmp/cpio_test.XXXXXX";
+
+	if (argc > 1) {
+		for (int i = 1; i < argc; ++i)
+			nfail += checkarchive( argv[ i], 1);
+		return nfail != 0;
+	}
+	if (mkdtemp( dir) == NULL) {
+		printf( "FAIL cannot create %s\n", dir);
+		return 1;
+	}
+	roundtrip( dir);
+	rmdir( dir);
+	printf( "%s\n", nfail ? "FAILED" : "ok");
+	return nfail != 0;
+}
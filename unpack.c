@@ -0,0 +1,225 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "cpupdate.h"
+#include "scan.h"
+#include "aload.h"
+#include "unpack.h"
+
+static struct archive *unpack_open( const char *path);
+static int unpack_entry( struct archive *a, const char *name, void **image, size_t *size);
+static const char *unpack_name( const char *path);
+
+
+// path for messages
+static const char *
+unpack_name( const char *path)
+{
+	return strcmp( path, "-") ? path : "(stdin)";
+}
+
+
+// opens path, or stdin for "-", for reading archive entries or a single (compressed) file
+static struct archive *
+unpack_open( const char *path)
+{
+	struct archive *a;
+	int r;
+
+	if ((a = archive_read_new()) == NULL) {
+		INFO( 0, "Could not allocate archive reader!\n");
+		return NULL;
+	}
+	archive_read_support_filter_all( a);
+	archive_read_support_format_tar( a);
+	archive_read_support_format_cpio( a);
+	archive_read_support_format_zip( a);
+	// whatever is no archive is taken as one file
+	archive_read_support_format_raw( a);
+	if (!strcmp( path, "-"))
+		r = archive_read_open_fd( a, STDIN_FILENO, UNPACK_BLOCK);
+	else
+		r = archive_read_open_filename( a, path, UNPACK_BLOCK);
+	if (r != ARCHIVE_OK) {
+		INFO( 0, "File %s: %s\n", unpack_name( path), archive_error_string( a));
+		archive_read_free( a);
+		return NULL;
+	}
+	return a;
+}
+
+
+/* decompresses the current entry into a malloc()ed image.
+ * returns 0, 1 if the entry is too large and got skipped, -1 if the input is broken
+ */
+static int
+unpack_entry( struct archive *a, const char *name, void **image, size_t *size)
+{
+	uint8_t	   *buf = NULL, *nb;
+	size_t		len = 0, max = 0;
+	la_ssize_t	n;
+
+	for (;;) {
+		if (len == max) {
+			if (max >= UNPACK_MAXFILE) {
+				INFO( 0, "File %s: larger than %d MB, skipped\n", name, UNPACK_MAXFILE >> 20);
+				free( buf);
+				return 1;
+			}
+			max = max ? 2 * max : UNPACK_BLOCK;
+			if ((nb = realloc( buf, max)) == NULL) {
+				INFO( 0, "Buffer allocation of %zu bytes failed\n", max);
+				free( buf);
+				return -1;
+			}
+			buf = nb;
+		}
+		if ((n = archive_read_data( a, buf + len, max - len)) < 0) {
+			INFO( 0, "File %s: %s\n", name, archive_error_string( a));
+			free( buf);
+			return -1;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+	*image = buf;
+	*size = len;
+	return 0;
+}
+
+
+/* calls cb for every file matching pattern in the directory tree, archive or single file
+ * at path, with the file's content set in params. archive entries are named archive:entry
+ * for the messages. returns the first nonzero cb return
+ */
+int
+unpack_tree( struct cpupdate_params *params, const char *path, const char *pattern, scan_cb cb, void *arg)
+{
+	struct archive *a;
+	struct archive_entry *entry;
+	struct stat st;
+	const char *name, *base;
+	char	epath[ MAXPATHLEN];
+	int		raw, e, n = 0, r = 0;
+
+	if (strcmp( path, "-") && stat( path, &st) == 0 && S_ISDIR( st.st_mode))
+		return aload_tree( params, path, pattern, cb, arg);
+	if ((a = unpack_open( path)) == NULL)
+		return 1;
+	while (!r && ((e = archive_read_next_header( a, &entry)) == ARCHIVE_OK || e == ARCHIVE_WARN)) {
+		raw = (archive_format( a) == ARCHIVE_FORMAT_RAW);
+		if (raw) {
+			strcpy( epath, unpack_name( path));
+		} else {
+			if (archive_entry_filetype( entry) != AE_IFREG)
+				continue;
+			name = archive_entry_pathname( entry);
+			base = (strrchr( name, '/') != NULL) ? strrchr( name, '/') + 1 : name;
+			if (pattern != NULL && fnmatch( pattern, base, FNM_PERIOD))
+				continue;
+			if (snprintf( epath, sizeof( epath), "%s:%s", unpack_name( path), name) >= (int) sizeof( epath)) {
+				INFO( 0, "ERROR: Path too long, skipping %s\n", name);
+				continue;
+			}
+		}
+		if ((e = unpack_entry( a, epath, &params->fileimage, &params->fileimagesize)) < 0) {
+			r = 1;
+			break;
+		}
+		if (e == 0) {
+			++n;
+			r = cb( AT_FDCWD, epath, epath, arg);
+		}
+		// not taken over if the callback did not load the file
+		free( params->fileimage);
+		params->fileimage = NULL;
+	}
+	if (!r && e != ARCHIVE_EOF) {
+		INFO( 0, "File %s: %s\n", unpack_name( path), archive_error_string( a));
+		r = 1;
+	}
+	INFO( 12, "Unpacked %d files from %s\n", n, unpack_name( path));
+	archive_read_free( a);
+	return r;
+}
+
+
+/* -f and -U: if filepath is compressed, an archive or "-", unpacks the file it holds into
+ * params->fileimage. archives must hold exactly one file. plain files are left to the loader
+ */
+int
+unpack_file( struct cpupdate_params *params)
+{
+	struct archive *a;
+	struct archive_entry *entry;
+	const char *path = params->filepath;
+	int		e, n = 0, r = 0;
+
+	if ((a = unpack_open( path)) == NULL)
+		return 1;
+	while (!r && ((e = archive_read_next_header( a, &entry)) == ARCHIVE_OK || e == ARCHIVE_WARN)) {
+		if (archive_format( a) == ARCHIVE_FORMAT_RAW) {
+			if (archive_filter_code( a, 0) == ARCHIVE_FILTER_NONE && strcmp( path, "-"))
+				break;			// plain file
+		} else if (archive_entry_filetype( entry) != AE_IFREG)
+			continue;
+		if (++n > 1) {
+			INFO( 0, "File %s holds more than one file, please use -c, -d, -C or -X for archives\n", 
+					unpack_name( path));
+			r = 1;
+		} else if (unpack_entry( a, unpack_name( path), &params->fileimage, &params->fileimagesize))
+			r = 1;
+	}
+	if (!r && e != ARCHIVE_OK && e != ARCHIVE_WARN && e != ARCHIVE_EOF) {
+		INFO( 0, "File %s: %s\n", unpack_name( path), archive_error_string( a));
+		r = 1;
+	} else if (!r && e == ARCHIVE_EOF && n == 0) {
+		INFO( 0, "File %s holds no file\n", unpack_name( path));
+		r = 1;
+	}
+	if (r) {
+		free( params->fileimage);
+		params->fileimage = NULL;
+	}
+	archive_read_free( a);
+	return r;
+}
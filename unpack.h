@@ -0,0 +1,41 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UNPACK_H
+#define	UNPACK_H
+
+/* Compressed and archive input of the repository commands, read with libarchive.
+ * A directory is scanned as before. Any other path, or "-" for stdin, is read as tar,
+ * cpio or zip archive, or as a single file, each maybe compressed (gzip, xz, zstd,
+ * bzip2...). Entries are decompressed one after the other into memory and handed
+ * to the scan callback as params->fileimage, nothing gets extracted to disk.
+ */
+
+#define UNPACK_BLOCK	(64 * 1024)			// read size of the input
+#define UNPACK_MAXFILE	(64 * 1024 * 1024)	// larger entries are skipped
+
+int unpack_tree( struct cpupdate_params *params, const char *path, const char *pattern, scan_cb cb, void *arg);
+int unpack_file( struct cpupdate_params *params);
+
+#endif /* !UNPACK_H */
@@ -0,0 +1,291 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fnmatch.h>
+
+#include <sys/param.h>
+#include <sys/types.h>
+
+#include "cpupdate.h"
+#include "owrite.h"
+#include "vstate.h"
+
+static int vstate_cmp( const void *a, const void *b);
+static int vstate_cmpput( const void *a, const void *b);
+static struct vstate_rec *vstate_add( struct vstate *vs);
+
+
+static int
+vstate_cmp( const void *a, const void *b)
+{
+	const struct vstate_rec *ra = a, *rb = b;
+	int c;
+
+	if ((c = strcmp( ra->path, rb->path)))
+		return c;
+	return (ra->off > rb->off) - (ra->off < rb->off);
+}
+
+
+// as vstate_cmp(), but the records of the last vstate_put() call for a file first
+static int
+vstate_cmpput( const void *a, const void *b)
+{
+	const struct vstate_rec *ra = a, *rb = b;
+	int c;
+
+	if ((c = strcmp( ra->path, rb->path)))
+		return c;
+	if (ra->put != rb->put)
+		return (ra->put < rb->put) - (ra->put > rb->put);
+	return (ra->off > rb->off) - (ra->off < rb->off);
+}
+
+
+// a new record at the end, NULL if out of memory
+static struct vstate_rec *
+vstate_add( struct vstate *vs)
+{
+	struct vstate_rec *recs;
+
+	if (vs->n == vs->max) {
+		int max = vs->max ? 2 * vs->max : 256;
+
+		if ((recs = reallocarray( vs->recs, max, sizeof( *recs))) == NULL) {
+			INFO( 0, "Could not allocate verification state!\n");
+			return NULL;
+		}
+		vs->recs = recs;
+		vs->max = max;
+	}
+	return &vs->recs[ vs->n++];
+}
+
+
+// reads the state file path. a missing file is an empty state
+int
+vstate_load( struct vstate *vs, const char *path)
+{
+	struct vstate_rec *rec;
+	FILE   *f;
+	char   *line = NULL;
+	size_t	size = 0;
+	ssize_t len;
+	int		pos, r = 0;
+
+	memset( vs, 0, sizeof( *vs));
+	if (strlen( path) >= sizeof( vs->path)) {
+		INFO( 0, "ERROR: Path too long\n");
+		return 1;
+	}
+	strcpy( vs->path, path);
+	if ((f = fopen( path, "r")) == NULL) {
+		if (errno == ENOENT)
+			return 0;
+		INFO( 0, "could not open verification state %s\n", path);
+		return 1;
+	}
+	while (!r && (len = getline( &line, &size, f)) > 0) {
+		struct vstate_rec v;
+		intmax_t fsize, mtime;
+		uintmax_t off;
+
+		if (line[ len - 1] == '\n')
+			line[ --len] = '\0';
+		if (line[ 0] == '#')
+			continue;
+		if (sscanf( line, "%d %jd %jd %jx %x %x %x %n", &v.tier, &fsize, &mtime, &off, 
+				&v.signature, &v.flags, (uint32_t *) &v.revision, &pos) != 7 || 
+				pos >= len || v.tier < VERIFY_HEADER || v.tier > VERIFY_FULL) {
+			INFO( 11, "Verification state %s: ignoring line %s\n", path, line);
+			continue;
+		}
+		v.size = fsize;
+		v.mtime = mtime;
+		v.off = off;
+		v.put = v.seen = 0;
+		if ((rec = vstate_add( vs)) == NULL) {
+			r = 1;
+		} else if ((v.path = strdup( line + pos)) == NULL) {
+			--vs->n;
+			INFO( 0, "Could not allocate verification state!\n");
+			r = 1;
+		} else
+			*rec = v;
+	}
+	free( line);
+	fclose( f);
+	if (r) {
+		vstate_free( vs);
+		return r;
+	}
+	qsort( vs->recs, vs->n, sizeof( *vs->recs), vstate_cmp);
+	vs->nloaded = vs->n;
+	INFO( 12, "Verification state %s: %d blobs\n", path, vs->n);
+	return 0;
+}
+
+
+// returns the number of loaded records of file, the first of them in *first, and marks them seen
+int
+vstate_find( struct vstate *vs, const char *file, int *first)
+{
+	int lo = 0, hi = vs->nloaded, mid, n;
+
+	// the first record not before file
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strcmp( vs->recs[ mid].path, file) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+	for (n = 0; lo + n < vs->nloaded && !strcmp( vs->recs[ lo + n].path, file); ++n)
+		vs->recs[ lo + n].seen = 1;
+	return n;
+}
+
+
+/* replaces the records of file by the n records recs, which are copied.
+ * records of earlier calls for file are dropped by vstate_save(), which keeps only those
+ * of the last call. with n == 0 a record of tier 0 marks that call
+ */
+int
+vstate_put( struct vstate *vs, const char *file, const struct vstate_rec *recs, int n)
+{
+	static const struct vstate_rec none;
+	struct vstate_rec *rec;
+	int first, old;
+
+	old = vstate_find( vs, file, &first);
+	for (int i = first; i < first + old; ++i)
+		vs->recs[ i].tier = 0;
+	++vs->nputs;
+	for (int i = 0; i < (n ? n : 1); ++i) {
+		if ((rec = vstate_add( vs)) == NULL)
+			return 1;
+		*rec = n ? recs[ i] : none;
+		rec->put = vs->nputs;
+		if ((rec->path = strdup( file)) == NULL) {
+			--vs->n;
+			INFO( 0, "Could not allocate verification state!\n");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/* drops the loaded records of files below root whose name matches pattern (all with
+ * pattern NULL) that were not looked up, as the files are gone
+ */
+void
+vstate_drop( struct vstate *vs, const char *root, const char *pattern)
+{
+	struct vstate_rec *rec;
+	const char *name;
+	size_t	len = strlen( root);
+	int		n = 0;
+
+	// the paths are built by scan_tree(), without trailing slashes of root
+	while (len > 0 && root[ len - 1] == '/')
+		--len;
+	for (rec = vs->recs; rec < vs->recs + vs->nloaded; ++rec) {
+		if (rec->seen || !rec->tier || strncmp( rec->path, root, len) || rec->path[ len] != '/')
+			continue;
+		name = strrchr( rec->path, '/') + 1;
+		if (pattern != NULL && fnmatch( pattern, name, FNM_PERIOD))
+			continue;
+		rec->tier = 0;
+		++n;
+	}
+	if (n)
+		INFO( 11, "Verification state %s: dropping %d blobs of files no longer found\n", vs->path, n);
+}
+
+
+// writes the state back, atomically replacing the file
+int
+vstate_save( struct vstate *vs)
+{
+	struct owriter ow;
+	struct vstate_rec *rec;
+	FILE   *f;
+	char   *buf = NULL, dir[ MAXPATHLEN], *slash;
+	size_t	size = 0;
+	int		last = 0, r;
+
+	qsort( vs->recs, vs->n, sizeof( *vs->recs), vstate_cmpput);
+	if ((f = open_memstream( &buf, &size)) == NULL) {
+		INFO( 0, "Could not allocate verification state!\n");
+		return 1;
+	}
+	fputs( VSTATE_HEADER, f);
+	for (rec = vs->recs; rec < vs->recs + vs->n; ++rec) {
+		// only the records of the last call for a file count, they come first
+		if (rec == vs->recs || strcmp( rec->path, rec[ -1].path))
+			last = rec->put;
+		if (rec->tier && rec->put == last)
+			fprintf( f, "%d %jd %jd %jx %08x %02x %08x %s\n", rec->tier, (intmax_t) rec->size, 
+					(intmax_t) rec->mtime, (uintmax_t) rec->off, rec->signature, rec->flags, 
+					(uint32_t) rec->revision, rec->path);
+	}
+	if (fclose( f)) {
+		free( buf);
+		INFO( 0, "Could not allocate verification state!\n");
+		return 1;
+	}
+	strcpy( dir, vs->path);
+	if ((slash = strrchr( dir, '/')) != NULL)
+		slash[ slash == dir] = '\0';
+	else
+		strcpy( dir, ".");
+	owrite_init( &ow, dir);
+	if (!(r = owrite_put( &ow, vs->path, buf, size, 0)))
+		r = owrite_commit( &ow);
+	owrite_free( &ow);
+	free( buf);
+	return r;
+}
+
+
+void
+vstate_free( struct vstate *vs)
+{
+	for (int i = 0; i < vs->n; ++i)
+		free( vs->recs[ i].path);
+	free( vs->recs);
+	vs->recs = NULL;
+	vs->n = vs->nloaded = vs->max = 0;
+}
@@ -0,0 +1,69 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef VSTATE_H
+#define	VSTATE_H
+
+/* Verification state of repository files.
+ * Records for each blob of a file the validation tier it passed (see VERIFY_HEADER etc.),
+ * together with size and modification time of the file. A later run then only checks
+ * the blobs of files that changed or were validated to a lower tier than wanted, and
+ * records the higher tier. Records of files below the checked tree that were not seen
+ * in a run are dropped. The state is a text file, one blob per line:
+ * tier size mtime(ns) offset signature flags revision path
+ */
+
+#define VSTATE_HEADER	"# cpupdate verification state 1\n"
+
+struct vstate_rec {
+	char	   *path;
+	off_t		size;
+	int64_t		mtime;			// ns
+	uint64_t	off;			// of the blob in the file
+	uint32_t	signature;
+	uint32_t	flags;
+	int32_t		revision;
+	int			tier;			// 0 for records dropped
+	int			put;			// vstate_put() call that added the record, 0 if loaded
+	int			seen;			// bool: a loaded record was looked up by vstate_find()
+};
+
+struct vstate {
+	char		path[ MAXPATHLEN];
+	struct vstate_rec
+			   *recs;			// the loaded ones sorted by path and offset, then the added ones
+	int			n,
+				nloaded,
+				max;
+	int			nputs;
+};
+
+int  vstate_load( struct vstate *vs, const char *path);
+int  vstate_find( struct vstate *vs, const char *file, int *first);
+int  vstate_put( struct vstate *vs, const char *file, const struct vstate_rec *recs, int n);
+void vstate_drop( struct vstate *vs, const char *root, const char *pattern);
+int  vstate_save( struct vstate *vs);
+void vstate_free( struct vstate *vs);
+
+#endif /* !VSTATE_H */
@@ -0,0 +1,181 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+__FBSDID("$FreeBSD$");
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <sys/cpuctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cpupdate.h"
+#include "watch.h"
+
+static int watch_devd( void);
+static void watch_select( struct cpupdate_params *params, int core);
+static void watch_parse( struct cpupdate_params *params, const char *line);
+static void watch_apply( struct vendor_funcs *vf, struct cpupdate_params *params, uint64_t t0);
+
+
+static int
+watch_devd( void)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	memset( &sun, 0, sizeof( sun));
+	sun.sun_family = AF_UNIX;
+	strcpy( sun.sun_path, WATCH_DEVD_SOCKET);
+	if ((fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+	if (connect( fd, (struct sockaddr *) &sun, sizeof( sun)) < 0) {
+		close( fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static void
+watch_select( struct cpupdate_params *params, int core)
+{
+	if (!params->selcores[ core]) {
+		params->selcores[ core] = 1;
+		++params->nselcores;
+	}
+}
+
+
+// adds the cores affected by the devd event line to the selection
+static void
+watch_parse( struct cpupdate_params *params, const char *line)
+{
+	char   *end;
+	long	n;
+	int		core;
+
+	if (!strncmp( line, "!system=ACPI ", 13) && strstr( line, " subsystem=Resume") != NULL) {
+		INFO( 11, "Event: resume, all cores\n");
+		for (core = 0; core < params->numcores; ++core)
+			watch_select( params, core);
+	} else if (!strncmp( line, "+cpu", 4) && isdigit( line[ 4])) {
+		n = strtol( line + 4, &end, 10);
+		if (*end != ' ' && *end != '\0') {
+			INFO( 12, "Event ignored: %s\n", line);
+		} else if (n < 0 || n >= params->numcores) {
+			INFO( 0, "Event: core %ld is beyond the %d cores probed, ignored\n", n, params->numcores);
+		} else {
+			core = n;
+			INFO( 11, "Event: core %d online\n", core);
+			watch_select( params, core);
+		}
+	} else
+		INFO( 12, "Event ignored: %s\n", line);
+}
+
+
+// updates the selected cores. t0 is when the events were read
+static void
+watch_apply( struct vendor_funcs *vf, struct cpupdate_params *params, uint64_t t0)
+{
+	int r;
+
+	r = vf->update( params);
+#ifdef CPUCTL_EVAL_CPU_FEATURES
+	if (!r && params->nchanged)
+		r = cpu_evalfeatures( params);
+#endif
+	INFO( 10, "%d cores reapplied, %d changed revision, in %.3f ms%s\n", params->nselcores, params->nchanged,
+			(cpu_nsecs() - t0) / 1e6, r ? ", with errors" : "");
+	memset( params->selcores, 0, sizeof( params->selcores));
+	params->nselcores = 0;
+}
+
+
+/* waits for events on source, or the devd socket if NULL, and reapplies the loaded
+ * microcode of params to the affected cores. returns at the end of source, or on errors
+ */
+int
+watch_run( struct vendor_funcs *vf, struct cpupdate_params *params, const char *source)
+{
+	char	buf[ WATCH_BUFSIZE], *line, *nl;
+	size_t	len = 0;
+	ssize_t	n;
+	int		fd, packet = (source == NULL), r = 0;
+
+	// no page faults between the event and the update
+	if (mlockall( MCL_CURRENT | MCL_FUTURE) < 0)
+		INFO( 11, "Could not lock the microcode in memory\n");
+	if (packet)
+		source = WATCH_DEVD_SOCKET;
+	if ((fd = packet ? watch_devd() : open( source, O_RDONLY | O_CLOEXEC)) < 0) {
+		INFO( 0, "Could not open event source %s\n", source);
+		return 1;
+	}
+	INFO( 10, "Waiting for CPU online and resume events on %s\n", source);
+	log_flush();
+	memset( params->selcores, 0, sizeof( params->selcores));
+	params->nselcores = 0;
+	while ((n = read( fd, buf + len, sizeof( buf) - len - 1)) != 0) {
+		uint64_t t0 = cpu_nsecs();
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			INFO( 0, "Reading events from %s failed\n", source);
+			r = 1;
+			break;
+		}
+		len += n;
+		// a devd packet is one event
+		if (packet && buf[ len - 1] != '\n')
+			buf[ len++] = '\n';
+		for (line = buf; (nl = memchr( line, '\n', buf + len - line)) != NULL; line = nl + 1) {
+			*nl = '\0';
+			watch_parse( params, line);
+		}
+		memmove( buf, line, len -= line - buf);
+		if (len == sizeof( buf) - 1) {
+			INFO( 0, "Overlong event line dropped\n");
+			len = 0;
+		}
+		if (params->nselcores)
+			watch_apply( vf, params, t0);
+		log_flush();
+	}
+	close( fd);
+	return r;
+}
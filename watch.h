@@ -0,0 +1,43 @@
+/*-Copyright (c) 2018 Stefan Blachmann <sblachmann at gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WATCH_H
+#define	WATCH_H
+
+/* Event driven reapplication of microcode.
+ * After a normal update, the loaded microcode files stay in (locked) memory and devd
+ * events are read. When a cpu device attaches ("+cpuN ...") that core, and when the
+ * host resumes ("!system=ACPI subsystem=Resume ...") all cores get the update again,
+ * without probing or reading the repository. All events read at once are handled
+ * as one batch.
+ * Instead of the devd socket, a file or FIFO of devd event lines can be given, which
+ * is read up to its end.
+ */
+
+#define WATCH_DEVD_SOCKET	("/var/run/devd.seqpacket.pipe")
+#define WATCH_BUFSIZE		8192
+
+int watch_run( struct vendor_funcs *vf, struct cpupdate_params *params, const char *source);
+
+#endif /* !WATCH_H */